@@ -41,7 +41,8 @@
  *      $ mknod /dev/DragonPCI c <major_number> 0
  *
  * 5) The test program DragonPCITest does some basic PCI_PnP reads
- * and writes.
+ * and writes. "DragonPCITest -b" compares read/write against mmap.
+ * DragonPCI.h holds the ioctl it uses to line the two up.
  *
  * 6) How to remove the driver:
  *
@@ -54,10 +55,13 @@
 #include <linux/pci.h>
 #include <linux/init.h>
 #include <linux/cdev.h>
+#include <linux/mm.h>
 
 #include <asm/byteorder.h>              /* PCI is little endian */
 #include <asm/uaccess.h>                /* copy to/from user */
 
+#include "DragonPCI.h"
+
 #define PCI_VENDOR_ID_PCI_PNP 0x0100
 #define PCI_DEVICE_ID_PCI_PNP 0x0000
 
@@ -101,10 +105,14 @@ int pci_pnp_open(struct inode *, struct file *);
 int pci_pnp_release(struct inode *, struct file *);
 ssize_t pci_pnp_read(struct file *, char __user *, size_t, loff_t *);
 ssize_t pci_pnp_write(struct file *, const char __user *, size_t, loff_t *);
+int pci_pnp_mmap(struct file *, struct vm_area_struct *);
+int pci_pnp_ioctl(struct inode *, struct file *, unsigned int, unsigned long);
 
 static struct file_operations pci_pnp_fops = {
     read: pci_pnp_read,
     write: pci_pnp_write,
+    mmap: pci_pnp_mmap,
+    ioctl: pci_pnp_ioctl,
     open: pci_pnp_open,
     release: pci_pnp_release
 };
@@ -130,6 +138,8 @@ static struct pci_pnp_dev {
     unsigned iobase;                /* I/O base port address        */
     unsigned ioend;                 /* I/O end  port address        */
     size_t iosize;                  /* I/O region size              */
+    unsigned long membase;          /* memory BAR address, 0 = none */
+    unsigned long memsize;          /* memory BAR size              */
 } *pci_pnp_devices;
 
 #if 0
@@ -280,6 +290,23 @@ static int __init pci_pnp_init(void)
         goto fail;
     }
 
+    /*
+     * Look for the memory space address range (BAR1 when PCI_PnP.v is
+     * built with PCI_MEMSPACE). Optional, only mmap uses it.
+     */
+    dev->membase = 0;
+    dev->memsize = 0;
+    for(bar = 0; bar < 6; bar++) {
+        if(pci_resource_flags(dev->pcidev, bar) & IORESOURCE_MEM) {
+            dev->membase = pci_resource_start(dev->pcidev, bar);
+            dev->memsize = pci_resource_len(dev->pcidev, bar);
+            break;
+        }
+    }
+
+    if(dev->membase == 0)
+        printk(KERN_NOTICE "No PCI memory range, mmap not available\n");
+
 #if 0
     /*
      * Make sure no other driver is using the region.
@@ -468,6 +495,62 @@ ssize_t pci_pnp_write(struct file *filep, const char __user *buf,
     return wcnt;
 }
 
+/*
+ * pci_pnp_mmap - map the memory BAR into user space, so the registers and
+ * RAM are read and written without a system call per word. The BAR is
+ * mapped uncached: every user access is one PCI memory cycle. PCI_PnP
+ * decodes 64KB (AD[31:16]) and the RAM repeats every 128 bytes in it.
+ * Word i of the mapping is RAM[i], while read/write offsets start at
+ * RAM[16] when bit 6 of the I/O base is set: location i of read/write is
+ * word i + DRAGONPCI_MAP_OFFSET(iobase) of the mapping, with the I/O base
+ * from the DRAGONPCI_IOC_IOBASE ioctl (see DragonPCI.h).
+ */
+int pci_pnp_mmap(struct file *filep, struct vm_area_struct *vma)
+{
+    struct pci_pnp_dev *dev;
+    unsigned long offset, size;
+
+    dev = filep->private_data;
+    if(dev->membase == 0)
+        return -ENODEV;
+
+    /*
+     * The mapping must stay inside the BAR.
+     */
+    offset = vma->vm_pgoff << PAGE_SHIFT;
+    size = vma->vm_end - vma->vm_start;
+    if((offset >= dev->memsize) || (size > dev->memsize - offset))
+        return -EINVAL;
+
+    vma->vm_page_prot = pgprot_noncached(vma->vm_page_prot);
+    vma->vm_flags |= VM_IO | VM_RESERVED;   /* no core dump, no swap */
+
+    if(io_remap_pfn_range(vma, vma->vm_start,
+                (dev->membase + offset) >> PAGE_SHIFT, size,
+                vma->vm_page_prot))
+        return -EAGAIN;
+
+    /* Success */
+    return 0;
+}
+
+/*
+ * pci_pnp_ioctl - ioctl processing: DRAGONPCI_IOC_IOBASE only.
+ */
+int pci_pnp_ioctl(struct inode *inode, struct file *filep,
+                    unsigned int cmd, unsigned long arg)
+{
+    struct pci_pnp_dev *dev;
+
+    dev = filep->private_data;
+    switch(cmd) {
+    case DRAGONPCI_IOC_IOBASE:
+        return put_user(dev->iobase, (unsigned int __user *)arg);
+    default:
+        return -ENOTTY;
+    }
+}
+
 MODULE_LICENSE("Dual BSD/GPL");
 
 module_init(pci_pnp_init);
@@ -0,0 +1,23 @@
+/*
+ * DragonPCI.h - what the DragonPCI driver shares with the programs that
+ * use it (DragonPCITest.c). Includes only <linux/ioctl.h>, so it builds in
+ * both the kernel and user space.
+ */
+
+#ifndef DRAGONPCI_H
+#define DRAGONPCI_H
+
+#include <linux/ioctl.h>
+
+/*
+ * Get the I/O base port address (unsigned int). PCI_PnP indexes its RAM
+ * with AD[6:2] but decodes the I/O BAR on AD[15:6], so bit 6 of the base
+ * is the top bit of the RAM index: read/write location i is RAM[i + 16]
+ * when it is set. The memory BAR is 64KB aligned, and word i of the
+ * mapping is RAM[i]: location i is word i + DRAGONPCI_MAP_OFFSET(iobase).
+ */
+#define DRAGONPCI_IOC_IOBASE _IOR('D', 1, unsigned int)
+
+#define DRAGONPCI_MAP_OFFSET(iobase) (((iobase) & 0x40) / 4)
+
+#endif /* DRAGONPCI_H */
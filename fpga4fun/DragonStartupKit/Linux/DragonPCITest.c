@@ -10,12 +10,27 @@
 //
 //	gcc -Wall -o DragonPCITest DragonPCITest.c
 //
+// DragonPCITest -b [file] times the per-word read and write latency
+// through read/write (lseek + one system call per word) and through mmap
+// of the memory BAR. With a file instead of /dev/DragonPCI (created and
+// sized as needed) it runs without the board: the numbers are then the
+// software overhead of each path, without the PCI cycles. Location i of
+// read/write is word i + DRAGONPCI_MAP_OFFSET(iobase) of the mapping (see
+// DragonPCI.h); a file has no I/O base, and an offset of 0.
+//
 
 #include <stdio.h>
 #include <stdlib.h>
 #include <unistd.h>
 #include <fcntl.h>
 #include <inttypes.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+
+#include "DragonPCI.h"
 
 uint32_t ReadFromDragon(int fd, uint32_t Addr)
 {
@@ -115,6 +130,109 @@ void WriteDragonAll2(int fd, const unsigned long *buf, int count)
 	}
 }
 
+/*
+ * Map the first size bytes of the memory BAR; exits on error.
+ */
+volatile uint32_t *MapDragon(int fd, size_t size)
+{
+	void *p;
+
+	p = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	if(p == MAP_FAILED) {
+		perror("MapDragon mmap error");
+		exit(1);
+	}
+
+	return (volatile uint32_t *)p;
+}
+
+/*
+ * Index of read/write location 0 in the mapping: the I/O base from the
+ * driver decides it, 0 for a stand-in file.
+ */
+int DragonMapOffset(int fd, int standin)
+{
+	unsigned int iobase;
+
+	if(standin)
+		return 0;
+	if(ioctl(fd, DRAGONPCI_IOC_IOBASE, &iobase) < 0) {
+		perror("DragonMapOffset ioctl error");
+		exit(1);
+	}
+
+	return DRAGONPCI_MAP_OFFSET(iobase);
+}
+
+double Seconds(void)
+{
+	struct timeval tv;
+
+	gettimeofday(&tv, NULL);
+	return tv.tv_sec + tv.tv_usec * 1e-6;
+}
+
+/*
+ * Per-word latency of the two access paths, over the 16 locations.
+ */
+void BenchDragon(const char *devname, int standin)
+{
+	const int words = 1000000;
+	size_t size = sysconf(_SC_PAGESIZE);
+	volatile uint32_t *map;
+	struct stat st;
+	uint32_t sum = 0;
+	double t;
+	int i, fd, base;
+
+	if((fd = open(devname, standin ? O_RDWR | O_CREAT : O_RDWR, 0644)) < 0) {
+		fprintf(stderr, "%s open error\n", devname);
+		perror("");
+		exit(1);
+	}
+
+	// a stand-in file must hold the mapped page
+	if(fstat(fd, &st) == 0 && S_ISREG(st.st_mode) && st.st_size < (off_t)size) {
+		if(ftruncate(fd, size) < 0) {
+			perror("BenchDragon truncate error");
+			exit(1);
+		}
+	}
+
+	// map[i] is read/write location i
+	base = DragonMapOffset(fd, standin);
+	map = MapDragon(fd, size) + base;
+
+	t = Seconds();
+	for(i=0; i<words; i++) WriteToDragon(fd, i & 15, i);
+	printf("write, syscall: %8.1f ns/word\n", (Seconds() - t) * 1e9 / words);
+
+	t = Seconds();
+	for(i=0; i<words; i++) map[i & 15] = i;
+	printf("write, mmap:    %8.1f ns/word\n", (Seconds() - t) * 1e9 / words);
+
+	t = Seconds();
+	for(i=0; i<words; i++) sum += ReadFromDragon(fd, i & 15);
+	printf("read, syscall:  %8.1f ns/word\n", (Seconds() - t) * 1e9 / words);
+
+	t = Seconds();
+	for(i=0; i<words; i++) sum += map[i & 15];
+	printf("read, mmap:     %8.1f ns/word\n", (Seconds() - t) * 1e9 / words);
+
+	// both paths see the same locations
+	for(i=0; i<16; i++) {
+		WriteToDragon(fd, i, 0x01010101 * i);
+		if(map[i] != 0x01010101 * (uint32_t)i)
+			fprintf(stderr, "BenchDragon: WARNING - location %d reads %08X through mmap\n",
+						i, map[i]);
+	}
+
+	printf("(checksum %08X)\n", sum);
+
+	munmap((void *)(map - base), size);
+	close(fd);
+}
+
 #include <sys/select.h>
 
 /*
@@ -147,6 +265,11 @@ int main(int argc, char **argv)
 	};
 	int i, fd;
 
+	if(argc > 1 && strcmp(argv[1], "-b") == 0) {
+		BenchDragon(argc > 2 ? argv[2] : devname, argc > 2);
+		return 0;
+	}
+
 	if((fd = open(devname, O_RDWR)) < 0) {
 		fprintf(stderr, "%s open error\n", devname);
 		perror("");
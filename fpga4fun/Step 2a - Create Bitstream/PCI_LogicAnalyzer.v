@@ -1,223 +1,341 @@
-// PCI_LogicAnalyzer design
-// (c) fpga4fun.com KNJN LLC - 2004, 2005
-//
-// We implement a regular "PCI_IORAM" design
-// We add some logic to store the PCI bus signals into blockrams for 256 clocks
-
-module PCI_LogicAnalyzer
-(
-  // PCI pins
-  PCI_CLK, PCI_RSTn, PCI_FRAMEn, PCI_AD, PCI_CBE, PCI_IRDYn, PCI_TRDYn, PCI_DEVSELn,
-  PCI_IDSEL, PCI_PAR, PCI_GNTn, PCI_LOCKn, PCI_PERRn, PCI_REQn, PCI_SERRn, PCI_STOPn,
-
-  // USB
-  CLK24, USB_FWRn, USB_FRDn, USB_D, 
-
-  // other pins
-  LED, LED2
-);
-
-parameter IO_address = 32'h00000200;
-parameter PCI_CBECD_IORead  = 4'b0010;
-parameter PCI_CBECD_IOWrite = 4'b0011;
-parameter PCI_CBECD_MEMRead  = 4'b0110;
-parameter PCI_CBECD_MEMWrite = 4'b0111;
-parameter PCI_CBECD_CSRead  = 4'b1010;
-parameter PCI_CBECD_CSWrite = 4'b1011;
-
-input PCI_CLK, PCI_RSTn, PCI_FRAMEn, PCI_IRDYn;
-inout [31:0] PCI_AD;
-input [3:0] PCI_CBE;
-output PCI_TRDYn, PCI_DEVSELn;
-input PCI_IDSEL, PCI_PAR, PCI_GNTn, PCI_LOCKn, PCI_PERRn, PCI_REQn, PCI_SERRn, PCI_STOPn;
-
-input CLK24, USB_FRDn, USB_FWRn;
-inout [7:0] USB_D;
-
-output LED, LED2;
-
-////////////////////////////////////////////////////////////////////////////////
-reg PCI_Transaction;
-
-wire PCI_TransactionStart = ~PCI_Transaction & ~PCI_FRAMEn;
-wire PCI_TransactionEnd = PCI_Transaction & PCI_FRAMEn & PCI_IRDYn;
-
-always @(posedge PCI_CLK or negedge PCI_RSTn)
-if(~PCI_RSTn) PCI_Transaction <= 0;
-else
-case(PCI_Transaction)
-  1'b0: PCI_Transaction <= PCI_TransactionStart;
-  1'b1: PCI_Transaction <= ~PCI_TransactionEnd;
-endcase
-
-// We respond only to IO reads/writes, 32-bits aligned
+// PCI_LogicAnalyzer design
+// (c) fpga4fun.com KNJN LLC - 2004, 2005
+//
+// We implement a regular "PCI_IORAM" design
+// We add some logic to store the PCI bus signals into blockrams for 256 clocks
+// around a trigger
+//
+// The trigger is any PCI transaction but the board's own, unless the trigger
+// sequencer is enabled through the IORAM registers (see PCI_TriggerSequencer.v)
+//
+// Define STREAM_CAPTURE to stream the bus to the USB through a FIFO instead,
+// for as long as the host reads (see PCI_StreamCapture.v)
+//`define STREAM_CAPTURE
+//
+// Define RLE_CAPTURE to store a sample into RAM_LA only when it changes, with
+// the number of clocks it lasted (see PCI_RunLength.v)
+//`define RLE_CAPTURE
+
+module PCI_LogicAnalyzer
+(
+  // PCI pins
+  PCI_CLK, PCI_RSTn, PCI_FRAMEn, PCI_AD, PCI_CBE, PCI_IRDYn, PCI_TRDYn, PCI_DEVSELn,
+  PCI_IDSEL, PCI_PAR, PCI_GNTn, PCI_LOCKn, PCI_PERRn, PCI_REQn, PCI_SERRn, PCI_STOPn,
+
+  // USB
+  CLK24, USB_FWRn, USB_FRDn, USB_D, 
+
+  // other pins
+  LED, LED2
+);
+
+parameter IO_address = 32'h00000200;
+parameter PCI_CBECD_IORead  = 4'b0010;
+parameter PCI_CBECD_IOWrite = 4'b0011;
+parameter PCI_CBECD_MEMRead  = 4'b0110;
+parameter PCI_CBECD_MEMWrite = 4'b0111;
+parameter PCI_CBECD_CSRead  = 4'b1010;
+parameter PCI_CBECD_CSWrite = 4'b1011;
+
+input PCI_CLK, PCI_RSTn, PCI_FRAMEn, PCI_IRDYn;
+inout [31:0] PCI_AD;
+input [3:0] PCI_CBE;
+output PCI_TRDYn, PCI_DEVSELn;
+input PCI_IDSEL, PCI_PAR, PCI_GNTn, PCI_LOCKn, PCI_PERRn, PCI_REQn, PCI_SERRn, PCI_STOPn;
+
+input CLK24, USB_FRDn, USB_FWRn;
+inout [7:0] USB_D;
+
+output LED, LED2;
+
+////////////////////////////////////////////////////////////////////////////////
+reg PCI_Transaction;
+
+wire PCI_TransactionStart = ~PCI_Transaction & ~PCI_FRAMEn;
+wire PCI_TransactionEnd = PCI_Transaction & PCI_FRAMEn & PCI_IRDYn;
+
+always @(posedge PCI_CLK or negedge PCI_RSTn)
+if(~PCI_RSTn) PCI_Transaction <= 0;
+else
+case(PCI_Transaction)
+  1'b0: PCI_Transaction <= PCI_TransactionStart;
+  1'b1: PCI_Transaction <= ~PCI_TransactionEnd;
+endcase
+
+// We respond only to IO reads/writes, 32-bits aligned
 wire PCI_Targeted =
 	PCI_TransactionStart &
 		(PCI_AD[/*31*/15:6]==(IO_address>>6))
 		/*& (PCI_AD[1:0]==0)*/
 		&
-		((PCI_CBE==PCI_CBECD_IORead) | (PCI_CBE==PCI_CBECD_IOWrite));
+		((PCI_CBE==PCI_CBECD_IORead) | (PCI_CBE==PCI_CBECD_IOWrite));
 wire PCI_Targeted2 =
-	PCI_Transaction;
-
-// When a transaction starts, the address is available for us to register
-// We just need a 4 bits address here
-reg [3:0] PCI_TransactionAddr;
-always @(posedge PCI_CLK) if(PCI_TransactionStart) PCI_TransactionAddr <= PCI_AD[5:2];
-
-wire PCI_LastDataTransfer = PCI_FRAMEn & ~PCI_IRDYn & ~PCI_TRDYn;
-
-// Is it a read or a write?
-reg PCI_Transaction_Read_nWrite;
-always @(posedge PCI_CLK or negedge PCI_RSTn)
-if(~PCI_RSTn) PCI_Transaction_Read_nWrite <= 0;
-else
-if(~PCI_Transaction & PCI_Targeted) PCI_Transaction_Read_nWrite <= ~PCI_CBE[0];
-
-// Should we claim the transaction?
-reg PCI_DevSelOE;
-always @(posedge PCI_CLK or negedge PCI_RSTn)
-if(~PCI_RSTn) PCI_DevSelOE <= 0;
-else
-case(PCI_Transaction)
-  1'b0: PCI_DevSelOE <= PCI_Targeted;
-  1'b1: if(PCI_TransactionEnd) PCI_DevSelOE <= 1'b0;
-endcase
-
-// PCI_DEVSELn should be asserted up to the last data transfer
-reg PCI_DevSel;
-always @(posedge PCI_CLK or negedge PCI_RSTn)
-if(~PCI_RSTn) PCI_DevSel <= 0;
-else
-case(PCI_Transaction)
-  1'b0: PCI_DevSel <= PCI_Targeted;
-  1'b1: PCI_DevSel <= PCI_DevSel & ~PCI_LastDataTransfer;
-endcase
-
-// PCI_TRDYn is asserted during the whole PCI_Transaction because we don't need wait-states
-// For read transaction, delay by one clock to allow for the turnaround-cycle
-reg PCI_TargetReady;
-always @(posedge PCI_CLK or negedge PCI_RSTn)
-if(~PCI_RSTn) PCI_TargetReady <= 0;
-else
-case(PCI_Transaction)
-  1'b0: PCI_TargetReady <= PCI_Targeted & PCI_CBE[0];  // active now on write, next cycle on reads
-  1'b1: PCI_TargetReady <= PCI_DevSel & ~PCI_LastDataTransfer;
-endcase
-
-// Stop is used to "disconnect with data" (avoid burst)
-reg PCI_Stop;
-always @(posedge PCI_CLK or negedge PCI_RSTn)
-if(~PCI_RSTn) PCI_Stop <= 0;
-else
-case(PCI_Transaction)
-  1'b0: PCI_Stop <= PCI_Targeted & PCI_CBE[0];  // active now on write, next cycle on reads
-  1'b1: PCI_Stop <= PCI_DevSel & ~PCI_FRAMEn;
-endcase
-
-// Drive the AD bus on reads only, and allow for the turnaround cycle
-reg PCI_AD_OE;
-always @(posedge PCI_CLK or negedge PCI_RSTn)
-if(~PCI_RSTn) PCI_AD_OE <= 0;
-else
-PCI_AD_OE <= PCI_DevSel & PCI_Transaction_Read_nWrite & ~PCI_LastDataTransfer;
-
-// Claim the PCI_Transaction
-assign PCI_DEVSELn = PCI_DevSelOE ? ~PCI_DevSel : 1'bZ;
-assign PCI_TRDYn = PCI_DevSelOE ? ~PCI_TargetReady : 1'bZ;
-//assign PCI_STOPn = PCI_DevSelOE ? ~PCI_Stop : 1'bZ;
-
-////////////////////////////////////////////////////////////////////////////////
-wire PCI_DataTransferWrite = PCI_DevSel & ~PCI_Transaction_Read_nWrite & ~PCI_IRDYn & ~PCI_TRDYn;
-
-// Instantiate the RAM
-// We use Xilinx's synthesis here (XST), which supports automatic RAM recognition
-// The following code creates a distributed RAM, but a blockram could also be used (we have 2 clock cycles to get the data out)
-reg [31:0] RAM [15:0];
-always @(posedge PCI_CLK) if(PCI_DataTransferWrite) RAM[PCI_TransactionAddr] <= PCI_AD;
-
-// now we can drive the PCI_AD bus
-assign PCI_AD = PCI_AD_OE ? RAM[PCI_TransactionAddr] : 32'hZZZZZZZZ;
-
-////////////////////////////////////////////////////////////////////////////////
-reg [31:0] PCI_data; always @(posedge PCI_CLK) if(PCI_DataTransferWrite) PCI_data <= PCI_AD;
-
-wire LED = PCI_data[0];
-wire LED2 = PCI_data[1];
-
-////////////////////////////////////////////////////////////////////////////////
-// Logic analyzer part
-//
-reg [47:0] RAM_LA [255:0];  // acquisition RAM
+	PCI_Transaction;
+
+// When a transaction starts, the address is available for us to register
+// We just need a 4 bits address here
+reg [3:0] PCI_TransactionAddr;
+always @(posedge PCI_CLK) if(PCI_TransactionStart) PCI_TransactionAddr <= PCI_AD[5:2];
+
+wire PCI_LastDataTransfer = PCI_FRAMEn & ~PCI_IRDYn & ~PCI_TRDYn;
+
+// Is it a read or a write?
+reg PCI_Transaction_Read_nWrite;
+always @(posedge PCI_CLK or negedge PCI_RSTn)
+if(~PCI_RSTn) PCI_Transaction_Read_nWrite <= 0;
+else
+if(~PCI_Transaction & PCI_Targeted) PCI_Transaction_Read_nWrite <= ~PCI_CBE[0];
+
+// Should we claim the transaction?
+reg PCI_DevSelOE;
+always @(posedge PCI_CLK or negedge PCI_RSTn)
+if(~PCI_RSTn) PCI_DevSelOE <= 0;
+else
+case(PCI_Transaction)
+  1'b0: PCI_DevSelOE <= PCI_Targeted;
+  1'b1: if(PCI_TransactionEnd) PCI_DevSelOE <= 1'b0;
+endcase
+
+// PCI_DEVSELn should be asserted up to the last data transfer
+reg PCI_DevSel;
+always @(posedge PCI_CLK or negedge PCI_RSTn)
+if(~PCI_RSTn) PCI_DevSel <= 0;
+else
+case(PCI_Transaction)
+  1'b0: PCI_DevSel <= PCI_Targeted;
+  1'b1: PCI_DevSel <= PCI_DevSel & ~PCI_LastDataTransfer;
+endcase
+
+// PCI_TRDYn is asserted during the whole PCI_Transaction because we don't need wait-states
+// For read transaction, delay by one clock to allow for the turnaround-cycle
+reg PCI_TargetReady;
+always @(posedge PCI_CLK or negedge PCI_RSTn)
+if(~PCI_RSTn) PCI_TargetReady <= 0;
+else
+case(PCI_Transaction)
+  1'b0: PCI_TargetReady <= PCI_Targeted & PCI_CBE[0];  // active now on write, next cycle on reads
+  1'b1: PCI_TargetReady <= PCI_DevSel & ~PCI_LastDataTransfer;
+endcase
+
+// Stop is used to "disconnect with data" (avoid burst)
+reg PCI_Stop;
+always @(posedge PCI_CLK or negedge PCI_RSTn)
+if(~PCI_RSTn) PCI_Stop <= 0;
+else
+case(PCI_Transaction)
+  1'b0: PCI_Stop <= PCI_Targeted & PCI_CBE[0];  // active now on write, next cycle on reads
+  1'b1: PCI_Stop <= PCI_DevSel & ~PCI_FRAMEn;
+endcase
+
+// Drive the AD bus on reads only, and allow for the turnaround cycle
+reg PCI_AD_OE;
+always @(posedge PCI_CLK or negedge PCI_RSTn)
+if(~PCI_RSTn) PCI_AD_OE <= 0;
+else
+PCI_AD_OE <= PCI_DevSel & PCI_Transaction_Read_nWrite & ~PCI_LastDataTransfer;
+
+// Claim the PCI_Transaction
+assign PCI_DEVSELn = PCI_DevSelOE ? ~PCI_DevSel : 1'bZ;
+assign PCI_TRDYn = PCI_DevSelOE ? ~PCI_TargetReady : 1'bZ;
+//assign PCI_STOPn = PCI_DevSelOE ? ~PCI_Stop : 1'bZ;
+
+////////////////////////////////////////////////////////////////////////////////
+wire PCI_DataTransferWrite = PCI_DevSel & ~PCI_Transaction_Read_nWrite & ~PCI_IRDYn & ~PCI_TRDYn;
+
+// Instantiate the RAM
+// We use Xilinx's synthesis here (XST), which supports automatic RAM recognition
+// The following code creates a distributed RAM, but a blockram could also be used (we have 2 clock cycles to get the data out)
+reg [31:0] RAM [15:0];
+always @(posedge PCI_CLK) if(PCI_DataTransferWrite) RAM[PCI_TransactionAddr] <= PCI_AD;
+
+// The trigger sequencer and the capture take their settings from the writes to the RAM
+// Word 15 reads back the sequencer status instead of the RAM:
+// [15:0] matches in the current stage, [17:16] current stage, [24] armed, [25] fired
+// and word 14 the capture status (LA_Status below)
+wire Trig_Enabled, Trig_Fired, Trig_Fire;
+wire [1:0] Trig_Stage;
+wire [15:0] Trig_Hits;
+wire [31:0] Trig_Status = {6'h00, Trig_Fired, Trig_Enabled & ~Trig_Fired, 6'h00, Trig_Stage, Trig_Hits};
+wire [31:0] LA_Status;
+wire [31:0] PCI_ReadData =
+  (PCI_TransactionAddr == 4'hF) ? Trig_Status :
+  (PCI_TransactionAddr == 4'hE) ? LA_Status : RAM[PCI_TransactionAddr];
+
+// now we can drive the PCI_AD bus
+assign PCI_AD = PCI_AD_OE ? PCI_ReadData : 32'hZZZZZZZZ;
+
+////////////////////////////////////////////////////////////////////////////////
+reg [31:0] PCI_data; always @(posedge PCI_CLK) if(PCI_DataTransferWrite) PCI_data <= PCI_AD;
+
+wire LED = PCI_data[0];
+wire LED2 = PCI_data[1];
+
+////////////////////////////////////////////////////////////////////////////////
+// Logic analyzer part
+//
+// RAM_LA is a circular buffer: once armed, it is written until the trigger,
+// keeping the last clocks before it, then for the post-trigger count and it
+// stops. Word 1 of the RAM sets the post-trigger count (1 to 256, 0 means
+// 256), so anywhere from 255 to 0 entries come before the trigger; writing
+// word 0 or 1 arms the capture again. The USB readout starts at the oldest
+// entry, so the trigger is entry 256 - count of the dump, and word 14 reads
+// it back.
+// The trigger is the trigger sequencer when it is enabled, any PCI
+// transaction otherwise, except the board's own IO cycles: with nothing to
+// keep before the trigger, the capture is ready as soon as it is armed, and
+// would trigger on the rest of the arming write. After a reset, the capture
+// is armed for any transaction with 4 entries before the trigger.
+reg [63:0] RAM_LA [255:0];  // acquisition RAM, 48 signals and a 16 bits tag/timestamp
 reg [7:0] addra;  // we need an 8 bits address (store the PCI bus for 256 clocks)
-reg [7:0] acq_counter;
-reg [1:0] stop_acq;
-
-// trigger when PCI_Targeted is asserted
-reg acquisition;
-always @(posedge PCI_CLK)
-	if(&addra)
-		acquisition <= 1'b0;
-	else if(acq_counter == 5)
-		begin
-			acquisition <= 1'b0;
-			stop_acq <= 1'b1;
-		end
-	else if(PCI_Targeted2)
-		begin
-			stop_acq <= 1'b0;
-			//addrb <= 0;
-			acquisition <= 1'b1;
-		end
-
-
-// We capture the following:
-// [31:0] PCI_AD  // 32
-// [3:0] PCI_CBE  //  4
-// PCI_FRAMEn, PCI_IRDYn  //  2
-// PCI_TRDYn, PCI_DEVSELn //  2
-// PCI_IDSEL, PCI_PAR, PCI_GNTn, PCI_LOCKn, PCI_PERRn, PCI_REQn, PCI_SERRn, PCI_STOPn  // 8
-// Total: 48
-wire [47:0] disr = {
-  PCI_AD, 
-  PCI_CBE, PCI_IRDYn, PCI_TRDYn, PCI_FRAMEn, PCI_DEVSELn, 
-  PCI_IDSEL, PCI_PAR, PCI_GNTn, PCI_LOCKn, PCI_PERRn, PCI_REQn, PCI_SERRn, PCI_STOPn};
-
-// Use 48 shift-registers to delay the 48 signals and get pre-trigger acquisition
-// But the following doesn't work with XST:
-//  reg [47:0] SRDR16 [15:0];  always @(posedge PCI_CLK) {SRDR16} <= {SRDR16[15:1], disr};
-// so we use that instead to delay the signals:
-wire [47:0] dosr;
-SR16_8 SR0(.d(disr[ 7: 0]), .q(dosr[ 7: 0]), .clk(PCI_CLK));
-SR16_8 SR1(.d(disr[15: 8]), .q(dosr[15: 8]), .clk(PCI_CLK));
-SR16_8 SR2(.d(disr[23:16]), .q(dosr[23:16]), .clk(PCI_CLK));
-SR16_8 SR3(.d(disr[31:24]), .q(dosr[31:24]), .clk(PCI_CLK));
-SR16_8 SR4(.d(disr[39:32]), .q(dosr[39:32]), .clk(PCI_CLK));
-SR16_8 SR5(.d(disr[47:40]), .q(dosr[47:40]), .clk(PCI_CLK));
-
-// write to the RAM
-always @(posedge PCI_CLK) if(acquisition) RAM_LA[addra] <= dosr;
-always @(posedge PCI_CLK) if(acquisition) addra <= addra + 1;
-always @(posedge PCI_CLK) if (stop_acq == 1) acq_counter <= 0; else if(acquisition) acq_counter <= acq_counter + 1;
-
-// read the RAM from the USB
-reg [10:0] addrb;  always @(posedge CLK24) if(~USB_FRDn) addrb <= addrb + 1;
-reg [7:0] addr_regb;  always @(posedge CLK24) addr_regb <= addrb[10:3];
-wire [47:0] dob = RAM_LA[addr_regb];
-
-reg [7:0] USB_Data;
-always @(posedge CLK24)
-case(addrb[2:0])
-  3'h0: USB_Data <= dob[ 7: 0];
-  3'h1: USB_Data <= dob[15: 8];
-  3'h2: USB_Data <= dob[23:16];
-  3'h3: USB_Data <= dob[31:24];
-  3'h4: USB_Data <= dob[39:32];
-  3'h5: USB_Data <= dob[47:40];
-  3'h6: USB_Data <= 8'h01;
-  3'h7: USB_Data <= 8'h02;
-endcase
-
-assign USB_D = ~USB_FRDn ? USB_Data : 8'hZZ;
-
+
+wire LA_Arm = PCI_DataTransferWrite & (PCI_TransactionAddr[3:1] == 3'h0);
+reg [8:0] LA_Post;
+always @(posedge PCI_CLK or negedge PCI_RSTn)
+if(~PCI_RSTn) LA_Post <= 9'd252;
+else if(PCI_DataTransferWrite & (PCI_TransactionAddr == 4'h1)) LA_Post <= (PCI_AD[8:0] == 0 || PCI_AD[8:0] > 256) ? 9'd256 : PCI_AD[8:0];
+
+// We capture the following:
+// [31:0] PCI_AD  // 32
+// [3:0] PCI_CBE  //  4
+// PCI_FRAMEn, PCI_IRDYn  //  2
+// PCI_TRDYn, PCI_DEVSELn //  2
+// PCI_IDSEL, PCI_PAR, PCI_GNTn, PCI_LOCKn, PCI_PERRn, PCI_REQn, PCI_SERRn, PCI_STOPn  // 8
+// Total: 48
+wire [47:0] disr = {
+  PCI_AD, 
+  PCI_CBE, PCI_IRDYn, PCI_TRDYn, PCI_FRAMEn, PCI_DEVSELn, 
+  PCI_IDSEL, PCI_PAR, PCI_GNTn, PCI_LOCKn, PCI_PERRn, PCI_REQn, PCI_SERRn, PCI_STOPn};
+
+// The sequencer matches the signals as they are; its stages are registered,
+// so it fires 2 clocks after the event. It only starts matching once the
+// clocks before the trigger are in RAM_LA.
+wire LA_Ready;
+PCI_TriggerSequencer Trigger(
+  .clk(PCI_CLK), .rstn(PCI_RSTn),
+  .we(PCI_DataTransferWrite), .waddr(PCI_TransactionAddr), .wdata(PCI_AD),
+  .sample(disr), .start(PCI_TransactionStart), .ready(LA_Ready),
+  .enabled(Trig_Enabled), .fired(Trig_Fired), .fire(Trig_Fire), .stage(Trig_Stage), .hits(Trig_Hits));
+
+// Delay the signals by the same 2 clocks, so the entry written when the
+// trigger fires is the event itself
+reg [47:0] disr1, dosr;
+always @(posedge PCI_CLK) {dosr, disr1} <= {disr1, disr};
+
+// capture state
+reg LA_Waiting;  // armed, writing the clocks before the trigger
+reg LA_Triggered;  // writing the clocks after the trigger
+reg [8:0] LA_Filled;  // entries written since armed, up to 256
+reg [8:0] LA_Left;  // entries still to write after the trigger
+reg [7:0] LA_TriggerAddr;
+
+wire acquisition = LA_Waiting | LA_Triggered;
+assign LA_Ready = LA_Waiting & (LA_Filled + LA_Post >= 256);
+// PCI_DevSelOE covers the board's cycles up to the end of the transaction.
+// PCI_Transaction is set 1 clock after FRAMEn falls; 1 more lines it up with
+// dosr like Trig_Fire, so that the trigger entry is the address phase.
+reg LA_AnyTransaction;
+always @(posedge PCI_CLK or negedge PCI_RSTn)
+if(~PCI_RSTn) LA_AnyTransaction <= 1'b0;
+else LA_AnyTransaction <= PCI_Targeted2 & ~PCI_DevSelOE;
+wire LA_Trigger = LA_Ready & (Trig_Enabled ? Trig_Fire : LA_AnyTransaction);
+
+// write to the RAM
+`ifdef RLE_CAPTURE
+// Idle cycles cost nothing: an entry is only written when the signals change,
+// so the 256 entries can hold up to 256*4096 clocks. The trigger cuts the run
+// being held, so that the trigger entry starts with the trigger clock; the
+// counts above are in entries, not clocks.
+wire LA_RunValid;
+wire [63:0] LA_Run;
+PCI_RunLength LA_RLE(.clk(PCI_CLK), .rstn(PCI_RSTn), .enable(acquisition), .cut(LA_Trigger), .sample(dosr), .run_valid(LA_RunValid), .run(LA_Run));
+
+wire LA_Write = LA_RunValid & acquisition;
+wire [7:0] LA_TriggerEntry = addra + LA_Write;  // the run cut is written now
+wire [8:0] LA_PostEntries = LA_Post;
+always @(posedge PCI_CLK) if(LA_Write) RAM_LA[addra] <= LA_Run;
+`else
+// Each sample is stored with the low 14 bits of a free-running PCI clock
+// counter, in the last two bytes of the USB record (they used to be the
+// constant 8'h01 8'h02). The top two bits, 2'b01, tell it from a run record.
+// The host rebuilds the time between samples as long as they are less than
+// 16384 clocks apart.
+reg [13:0] LA_Time;
+always @(posedge PCI_CLK) LA_Time <= LA_Time + 1;
+
+wire LA_Write = acquisition;
+wire [7:0] LA_TriggerEntry = addra;  // the trigger clock is written now
+wire [8:0] LA_PostEntries = LA_Post - 1;
+always @(posedge PCI_CLK) if(LA_Write) RAM_LA[addra] <= {2'b01, LA_Time, dosr};
+`endif
+always @(posedge PCI_CLK) if(LA_Write) addra <= addra + 1;
+
+always @(posedge PCI_CLK or negedge PCI_RSTn)
+if(~PCI_RSTn)
+  begin
+    LA_Waiting <= 1'b1;
+    LA_Triggered <= 1'b0;
+    LA_Filled <= 0;
+  end
+else if(LA_Arm)
+  begin
+    LA_Waiting <= 1'b1;
+    LA_Triggered <= 1'b0;
+    LA_Filled <= 0;
+  end
+else if(LA_Trigger)
+  begin
+    LA_Waiting <= 1'b0;
+    LA_Triggered <= (LA_PostEntries != 0);
+    LA_Left <= LA_PostEntries;
+    LA_TriggerAddr <= LA_TriggerEntry;
+  end
+else if(LA_Write)
+  begin
+    if(LA_Waiting & ~LA_Filled[8]) LA_Filled <= LA_Filled + 1;
+    if(LA_Triggered)
+      begin
+        LA_Left <= LA_Left - 1;
+        if(LA_Left == 1) LA_Triggered <= 1'b0;
+      end
+  end
+
+// Word 14: [7:0] trigger entry in the dump, [24] waiting for the trigger,
+// [25] capturing after it, [26] done: RAM_LA holds the capture
+wire LA_Done = ~LA_Waiting & ~LA_Triggered;
+assign LA_Status = {5'h00, LA_Done, LA_Triggered, LA_Waiting, 16'h0000, LA_TriggerAddr - addra};
+
+// read the RAM from the USB
+reg [10:0] addrb;  always @(posedge CLK24) if(~USB_FRDn) addrb <= addrb + 1;
+// from the oldest entry on, which is the next one to write
+reg [7:0] addr_regb;  always @(posedge CLK24) addr_regb <= addrb[10:3] + addra;
+wire [63:0] dob = RAM_LA[addr_regb];
+
+reg [7:0] USB_Data;
+always @(posedge CLK24)
+case(addrb[2:0])
+  3'h0: USB_Data <= dob[ 7: 0];
+  3'h1: USB_Data <= dob[15: 8];
+  3'h2: USB_Data <= dob[23:16];
+  3'h3: USB_Data <= dob[31:24];
+  3'h4: USB_Data <= dob[39:32];
+  3'h5: USB_Data <= dob[47:40];
+  3'h6: USB_Data <= dob[55:48];
+  3'h7: USB_Data <= dob[63:56];
+endcase
+
+`ifdef STREAM_CAPTURE
+// only changes are stored, with their duration, so the FIFO keeps up with
+// the USB as long as the bus is not busy for too long
+wire [7:0] Stream_Data;
+wire Stream_Overflow;
+PCI_StreamCapture Stream(
+  .clk(PCI_CLK), .rstn(PCI_RSTn), .enable(1'b1), .sample(disr),
+  .usb_clk(CLK24), .usb_rdn(USB_FRDn), .usb_data(Stream_Data),
+  .overflow(Stream_Overflow));
+
+assign USB_D = ~USB_FRDn ? Stream_Data : 8'hZZ;
+`else
+assign USB_D = ~USB_FRDn ? USB_Data : 8'hZZ;
+`endif
+
 endmodule
@@ -0,0 +1,41 @@
+// PCI_RunLength
+// Run-length coding of the 48 sampled signals: a sample only comes out when
+// it is followed by a different one (or after 4096 identical cycles, or when
+// enable goes low, or when cut is high), together with the number of cycles
+// it was held.
+// run is a stream sample record, see PCI_StreamCapture.v:
+//   {4'hA, repeat[11:0], sample[47:0]}, the sample lasted repeat+1 cycles
+// run_valid is high for the one cycle in which run is complete.
+
+module PCI_RunLength(clk, rstn, enable, cut, sample, run_valid, run);
+input clk, rstn, enable;
+input cut;  // end the run being held, the current sample starts the next one
+input [47:0] sample;
+output run_valid;
+output [63:0] run;
+
+reg [47:0] held;
+reg [11:0] repeat_count;
+reg holding;
+
+wire same = holding & enable & ~cut & (sample == held) & ~&repeat_count;
+
+assign run_valid = holding & ~same;
+assign run = {4'hA, repeat_count, held};
+
+always @(posedge clk or negedge rstn)
+if(~rstn)
+  begin
+    holding <= 1'b0;
+    repeat_count <= 0;
+  end
+else if(same)
+  repeat_count <= repeat_count + 1;
+else
+  begin
+    held <= sample;
+    repeat_count <= 0;
+    holding <= enable;
+  end
+
+endmodule
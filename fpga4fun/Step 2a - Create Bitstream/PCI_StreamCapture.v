@@ -0,0 +1,157 @@
+// PCI_StreamCapture
+// Deep capture: instead of filling RAM_LA once, stream the bus to the USB
+// for as long as the host keeps reading.
+//
+// A sample is only stored when one of the 48 signals changes (PCI_RunLength.v);
+// it goes into a blockram FIFO together with the number of cycles it was held,
+// and the FIFO is drained at the USB side, 8 bytes per record:
+//   sample record  bytes 0-5: the 48 signals, as in the RAM_LA readout
+//                  bytes 6-7: {4'hA, repeat[11:0]}, the sample lasted repeat+1 cycles
+//   status record  bytes 0-3: PCI clocks lost while the FIFO was full
+//                  bytes 4-5: overflows so far
+//                  byte 6:    bit 0 set when the record follows an overflow
+//                  byte 7:    4'hB, 4'h0
+//   empty record   bytes 0-6: 0, byte 7: 8'hE0 (the FIFO was empty)
+// When the FIFO is full, samples are dropped and counted; a status record
+// marks the gap as soon as there is room again. The overflow output stays
+// set from the first overflow to the next reset.
+
+module PCI_StreamCapture
+(
+  clk, rstn, enable, sample,
+  usb_clk, usb_rdn, usb_data,
+  overflow
+);
+
+parameter FIFO_AW = 8;  // 256 records, 4 blockrams
+
+input clk, rstn, enable;
+input [47:0] sample;
+input usb_clk, usb_rdn;
+output [7:0] usb_data;
+output overflow;
+
+////////////////////////////////////////////////////////////////////////////////
+// FIFO, written on the PCI clock and read on the USB clock
+// The pointers cross the clock domains in Gray code
+reg [63:0] FIFO [(1<<FIFO_AW)-1:0];
+
+reg [FIFO_AW:0] wr_ptr, wr_gray, rd_ptr, rd_gray;
+reg [FIFO_AW:0] rd_gray_w1, rd_gray_w2;  // rd_gray in the PCI clock domain
+reg [FIFO_AW:0] wr_gray_r1, wr_gray_r2;  // wr_gray in the USB clock domain
+
+always @(posedge clk) {rd_gray_w2, rd_gray_w1} <= {rd_gray_w1, rd_gray};
+always @(posedge usb_clk) {wr_gray_r2, wr_gray_r1} <= {wr_gray_r1, wr_gray};
+
+wire fifo_full = (wr_gray == {~rd_gray_w2[FIFO_AW:FIFO_AW-1], rd_gray_w2[FIFO_AW-2:0]});
+wire fifo_empty = (rd_gray == wr_gray_r2);
+
+////////////////////////////////////////////////////////////////////////////////
+// Change detection
+wire emit;  // run is complete
+wire [63:0] run;
+PCI_RunLength RLE(.clk(clk), .rstn(rstn), .enable(enable), .cut(1'b0), .sample(sample), .run_valid(emit), .run(run));
+
+// overflow bookkeeping
+reg gap;  // samples were dropped, the status record is not written yet
+reg [31:0] lost_cycles;
+reg [15:0] overflows;
+reg overflow;
+
+wire [31:0] lost_now = lost_cycles + run[59:48] + 1;
+wire write_status = gap & ~fifo_full;
+wire write_sample = emit & ~gap & ~fifo_full;
+wire [63:0] status_record = {4'hB, 4'h0, 7'h00, 1'b1, overflows, emit ? lost_now : lost_cycles};
+
+always @(posedge clk or negedge rstn)
+if(~rstn)
+  begin
+    gap <= 1'b0;
+    lost_cycles <= 0;
+    overflows <= 0;
+    overflow <= 1'b0;
+  end
+else
+  begin
+    // the sample completed now is lost if the FIFO is full, or if the status
+    // record takes its place (it is then counted in the status record)
+    if(write_status)
+      begin
+        gap <= 1'b0;
+        lost_cycles <= 0;
+      end
+    else if(emit & fifo_full)
+      begin
+        if(~gap) overflows <= overflows + 1;
+        gap <= 1'b1;
+        overflow <= 1'b1;
+        lost_cycles <= (&lost_cycles[31:12]) ? lost_cycles : lost_now;  // saturates
+      end
+  end
+
+always @(posedge clk)
+if(write_status | write_sample)
+  FIFO[wr_ptr[FIFO_AW-1:0]] <= write_status ? status_record : run;
+
+always @(posedge clk or negedge rstn)
+if(~rstn)
+  begin
+    wr_ptr <= 0;
+    wr_gray <= 0;
+  end
+else if(write_status | write_sample)
+  begin
+    wr_ptr <= wr_ptr + 1;
+    wr_gray <= (wr_ptr + 1) ^ ((wr_ptr + 1) >> 1);
+  end
+
+////////////////////////////////////////////////////////////////////////////////
+// USB side: one FIFO record per 8 bytes read, or an empty record
+reg [2:0] usb_byte;
+reg [63:0] usb_record;
+
+// registered read address, so XST can use blockrams
+reg [FIFO_AW-1:0] rd_addr;
+wire [63:0] fifo_q = FIFO[rd_addr];
+wire next_record = ~usb_rdn & (&usb_byte);
+
+always @(posedge usb_clk) rd_addr <= rd_ptr[FIFO_AW-1:0];
+
+always @(posedge usb_clk or negedge rstn)
+if(~rstn)
+  begin
+    usb_byte <= 0;
+    usb_record <= {8'hE0, 56'h0};
+    rd_ptr <= 0;
+    rd_gray <= 0;
+  end
+else
+  begin
+    if(~usb_rdn) usb_byte <= usb_byte + 1;
+    if(next_record)
+      begin
+        if(fifo_empty)
+          usb_record <= {8'hE0, 56'h0};
+        else
+          begin
+            usb_record <= fifo_q;
+            rd_ptr <= rd_ptr + 1;
+            rd_gray <= (rd_ptr + 1) ^ ((rd_ptr + 1) >> 1);
+          end
+      end
+  end
+
+reg [7:0] usb_data;
+always @(posedge usb_clk)
+case(usb_byte)
+  3'h0: usb_data <= usb_record[ 7: 0];
+  3'h1: usb_data <= usb_record[15: 8];
+  3'h2: usb_data <= usb_record[23:16];
+  3'h3: usb_data <= usb_record[31:24];
+  3'h4: usb_data <= usb_record[39:32];
+  3'h5: usb_data <= usb_record[47:40];
+  3'h6: usb_data <= usb_record[55:48];
+  3'h7: usb_data <= usb_record[63:56];
+endcase
+
+endmodule
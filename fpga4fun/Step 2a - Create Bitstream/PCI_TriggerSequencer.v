@@ -0,0 +1,82 @@
+// PCI_TriggerSequencer
+// Host-programmable trigger: up to 3 stages (PCI_TriggerStage.v) that must
+// match one after the other, each a given number of times, before the
+// acquisition starts. Catches a rare event on a busy bus in one capture.
+//
+// It is loaded through the 16-word PCI register file of PCI_LogicAnalyzer.v:
+//   word 0       control: [0] enable, [2:1] last stage (0 to 2)
+//                writing it restarts the sequence at stage 0 (arms it), so it
+//                is written after the stages
+//   words 2-5    stage 0
+//   words 6-9    stage 1
+//   words 10-13  stage 2
+// A stage passes on its count-th matching clock (a count of 0 counts as 1);
+// the next stage only looks at the clocks after that. When the last stage
+// passes, fire is high for one clock and the sequencer stays fired until it
+// is armed again. While it is not enabled, fire stays low.
+// The stages only count while ready is high: the capture is armed and has the
+// clocks it keeps before the trigger.
+
+module PCI_TriggerSequencer(clk, rstn, we, waddr, wdata, sample, start, ready, enabled, fired, fire, stage, hits);
+input clk, rstn, we, start, ready;
+input [3:0] waddr;
+input [31:0] wdata;
+input [47:0] sample;
+output enabled, fired, fire;
+output [1:0] stage;  // the stage being matched
+output [15:0] hits;  // its matches so far
+
+wire match0, match1, match2;
+wire [15:0] count0, count1, count2;
+PCI_TriggerStage #(2) Stage0(.clk(clk), .we(we), .waddr(waddr), .wdata(wdata), .sample(sample), .start(start), .match(match0), .count(count0));
+PCI_TriggerStage #(6) Stage1(.clk(clk), .we(we), .waddr(waddr), .wdata(wdata), .sample(sample), .start(start), .match(match1), .count(count1));
+PCI_TriggerStage #(10) Stage2(.clk(clk), .we(we), .waddr(waddr), .wdata(wdata), .sample(sample), .start(start), .match(match2), .count(count2));
+
+reg enabled, fired, fire;
+reg [1:0] last_stage, stage;
+reg [15:0] hits;
+
+wire arm = we & (waddr == 4'h0);
+wire stage_match = (stage == 2'd0) ? match0 : (stage == 2'd1) ? match1 : match2;
+wire [15:0] stage_count = (stage == 2'd0) ? count0 : (stage == 2'd1) ? count1 : count2;
+wire stage_done = ({1'b0, hits} + 1 >= {1'b0, stage_count});
+wire stage_last = (stage == last_stage) | (stage == 2'd2);
+
+always @(posedge clk or negedge rstn)
+if(~rstn)
+  begin
+    enabled <= 1'b0;
+    last_stage <= 0;
+    stage <= 0;
+    hits <= 0;
+    fired <= 1'b0;
+    fire <= 1'b0;
+  end
+else
+  begin
+    fire <= 1'b0;
+    if(arm)
+      begin
+        {last_stage, enabled} <= wdata[2:0];
+        stage <= 0;
+        hits <= 0;
+        fired <= 1'b0;
+      end
+    else if(enabled & ready & ~fired & stage_match)
+      begin
+        if(~stage_done)
+          hits <= hits + 1;
+        else if(stage_last)
+          begin
+            fired <= 1'b1;
+            fire <= 1'b1;
+          end
+        else
+          begin
+            stage <= stage + 1;
+            hits <= 0;
+          end
+      end
+  end
+
+endmodule
@@ -0,0 +1,46 @@
+// PCI_TriggerStage
+// One stage of the trigger sequencer (PCI_TriggerSequencer.v): a condition on
+// the 48 sampled signals, loaded from 4 words of the PCI register file
+// starting at BASE:
+//   BASE+0  AD value
+//   BASE+1  AD mask, 1 where the AD bit is compared
+//   BASE+2  [11:0] control value, [27:16] control mask, over sample[11:0]
+//           (IRDYn, TRDYn, FRAMEn, DEVSELn, IDSEL, PAR, GNTn, LOCKn, PERRn,
+//           REQn, SERRn, STOPn); [31] match on the address phase only
+//   BASE+3  [15:0] command set, bit n accepts CBE == n; [31:16] count, the
+//           occurrences the sequencer waits for (see there)
+// match is registered: it is high the clock after a matching sample.
+
+module PCI_TriggerStage(clk, we, waddr, wdata, sample, start, match, count);
+parameter BASE = 2;
+
+input clk, we, start;
+input [3:0] waddr;
+input [31:0] wdata;
+input [47:0] sample;
+output match;
+output [15:0] count;
+
+reg [31:0] ad_value, ad_mask;
+reg [11:0] ctl_value, ctl_mask;
+reg address_phase;
+reg [15:0] commands;
+reg [15:0] count;
+
+always @(posedge clk)
+if(we)
+case(waddr)
+  BASE+0: ad_value <= wdata;
+  BASE+1: ad_mask <= wdata;
+  BASE+2: {address_phase, ctl_mask, ctl_value} <= {wdata[31], wdata[27:16], wdata[11:0]};
+  BASE+3: {count, commands} <= wdata;
+endcase
+
+wire ad_ok = ~|((sample[47:16] ^ ad_value) & ad_mask);
+wire ctl_ok = ~|((sample[11:0] ^ ctl_value) & ctl_mask);
+wire cmd_ok = commands[sample[15:12]];
+
+reg match;
+always @(posedge clk) match <= ad_ok & ctl_ok & cmd_ok & (start | ~address_phase);
+
+endmodule
@@ -0,0 +1,400 @@
+// PCI_LogicAnalyzer testbench, for Icarus Verilog (see Makefile)
+// Drives PCI traffic into PCI_LogicAnalyzer.v: the board answers its own IO
+// cycles, and the testbench plays the master and the memory target of the
+// other cycles. The capture is read out of the USB port the way the FX2 does.
+// These files are written, for sim_check (Step 4 - CPP) to decode and compare:
+//   *_reference.pciacq  every clock the capture logic sampled, one .pciacq
+//                       record each (6 bytes of signals, then 0x01 0x02)
+//   the USB bytes       stream.pcistr for a STREAM_CAPTURE build, else the
+//                       RAM_LA dump: rle.pciacq for RLE_CAPTURE, timed.pciacq
+//   *_trigger.txt       RAM_LA builds: the trigger entry the board reports in
+//                       word 14, and the reference clock of the address phase
+//                       of the trigger transaction, which it must be
+//
+// STREAM_CAPTURE: the FIFO is read all along, except during a stretch of
+// back-to-back transactions, so that it overflows once. The phase between
+// the two clocks keeps moving, so the Gray-coded pointers are taken at every
+// point of the other clock's period. An idle bus of more than 4096 clocks
+// ends in saturated runs.
+//
+// RAM_LA builds: first the capture is armed with nothing to keep before the
+// trigger, and must not trigger on the board's own IO cycles. Then it keeps
+// 128 entries on each side of the trigger.
+// The stimulus is the same with and without RLE_CAPTURE, and so is the
+// trigger, so that sim_check can compare the two dumps clock for clock.
+// After the arming write, the bus is parked with a changing AD for long
+// enough for both builds to have their entries before the trigger, then it
+// is idle with GNT# low, and the trigger is the first transaction after that.
+// With RLE_CAPTURE, the trigger cuts the idle run in two. Idle stretches of
+// more than 4096 clocks before and after the trigger end in saturated runs.
+
+`timescale 1ns / 100ps
+
+module PCI_LogicAnalyzer_tb;
+
+parameter IO_address = 32'h00000200;  // as in PCI_LogicAnalyzer.v
+parameter PCI_CBECD_IORead  = 4'b0010;
+parameter PCI_CBECD_IOWrite = 4'b0011;
+parameter PCI_CBECD_MEMRead  = 4'b0110;
+parameter PCI_CBECD_MEMWrite = 4'b0111;
+
+reg PCI_CLK = 0, CLK24 = 0;
+always #15 PCI_CLK = ~PCI_CLK;  // 33MHz
+always #20.8 CLK24 = ~CLK24;  // 24MHz, the phase to PCI_CLK keeps moving
+
+////////////////////////////////////////////////////////////////////////////////
+// The bus, pulled up where nobody drives it
+reg PCI_RSTn = 0;
+tri1 [31:0] PCI_AD;
+tri1 [3:0] PCI_CBE;
+tri1 PCI_FRAMEn, PCI_IRDYn, PCI_TRDYn, PCI_DEVSELn, PCI_STOPn;
+reg PCI_IDSEL = 0, PCI_GNTn = 1, PCI_LOCKn = 1, PCI_PERRn = 1, PCI_REQn = 1, PCI_SERRn = 1;
+
+// PAR covers AD and CBE of the previous clock
+reg PCI_PAR = 0;
+always @(posedge PCI_CLK) PCI_PAR <= ^{PCI_AD, PCI_CBE};
+
+// master
+reg m_frame_n = 1, m_irdy_n = 1;
+reg m_ad_oe = 0, m_cbe_oe = 0;
+reg [31:0] m_ad = 0;
+reg [3:0] m_cbe = 0;
+assign PCI_FRAMEn = m_frame_n;
+assign PCI_IRDYn = m_irdy_n;
+assign PCI_AD = m_ad_oe ? m_ad : 32'hZZZZZZZZ;
+assign PCI_CBE = m_cbe_oe ? m_cbe : 4'hZ;
+
+// memory target
+reg t_oe = 0, t_devsel_n = 1, t_trdy_n = 1;
+reg t_ad_oe = 0;
+reg [31:0] t_ad = 0;
+assign PCI_DEVSELn = t_oe ? t_devsel_n : 1'bZ;
+assign PCI_TRDYn = t_oe ? t_trdy_n : 1'bZ;
+assign PCI_STOPn = t_oe ? 1'b1 : 1'bZ;
+assign PCI_AD = t_ad_oe ? t_ad : 32'hZZZZZZZZ;
+
+wire [7:0] USB_D;
+reg USB_FRDn = 1;
+wire LED, LED2;
+
+// registers without a reset start at 0 after configuration, as on the FPGA
+initial
+begin
+  dut.addra = 0;
+  dut.addrb = 0;
+`ifndef RLE_CAPTURE
+  dut.LA_Time = 0;
+`endif
+end
+
+PCI_LogicAnalyzer dut(
+  .PCI_CLK(PCI_CLK), .PCI_RSTn(PCI_RSTn), .PCI_FRAMEn(PCI_FRAMEn), .PCI_AD(PCI_AD), .PCI_CBE(PCI_CBE),
+  .PCI_IRDYn(PCI_IRDYn), .PCI_TRDYn(PCI_TRDYn), .PCI_DEVSELn(PCI_DEVSELn),
+  .PCI_IDSEL(PCI_IDSEL), .PCI_PAR(PCI_PAR), .PCI_GNTn(PCI_GNTn), .PCI_LOCKn(PCI_LOCKn),
+  .PCI_PERRn(PCI_PERRn), .PCI_REQn(PCI_REQn), .PCI_SERRn(PCI_SERRn), .PCI_STOPn(PCI_STOPn),
+  .CLK24(CLK24), .USB_FWRn(1'b1), .USB_FRDn(USB_FRDn), .USB_D(USB_D),
+  .LED(LED), .LED2(LED2));
+
+////////////////////////////////////////////////////////////////////////////////
+// Reference: the signals the capture logic sees on each clock, the bus as it
+// is for the FIFO, delayed by 2 clocks for RAM_LA
+`ifdef STREAM_CAPTURE
+wire [47:0] captured = dut.disr;
+`else
+wire [47:0] captured = dut.dosr;
+`endif
+integer reference_file;
+integer reference_clocks = 0;
+integer trigger_clock = -1;  // reference clock written to RAM_LA as the trigger
+reg trigger_watch = 0;  // set before the trigger transaction starts
+integer address_clock = -1;  // reference clock of its address phase
+reg captured_FRAMEn = 1;
+always @(posedge PCI_CLK)
+if(PCI_RSTn)
+  begin
+    $fwrite(reference_file, "%c%c%c%c%c%c%c%c",
+      captured[7:0], captured[15:8], captured[23:16], captured[31:24], captured[39:32], captured[47:40],
+      8'h01, 8'h02);
+    if(dut.LA_Trigger) trigger_clock = reference_clocks;
+    if(trigger_watch && address_clock < 0 && captured_FRAMEn && ~captured[9]) address_clock = reference_clocks;
+    captured_FRAMEn = captured[9];
+    reference_clocks = reference_clocks + 1;
+  end
+
+////////////////////////////////////////////////////////////////////////////////
+// USB readout: FRDn low for one CLK24 per byte, high for the next two, and
+// the byte taken while FRDn is low. Once started, a record is read to its end.
+integer usb_file;
+integer usb_bytes = 0;
+reg usb_reading = 0;
+reg [2:0] usb_byte = 0;  // bytes read of the current record
+reg [1:0] usb_wait = 0;
+always @(posedge CLK24)
+begin
+  if(~USB_FRDn)
+    begin
+      $fwrite(usb_file, "%c", USB_D);
+      usb_byte <= usb_byte + 1;
+      usb_bytes <= usb_bytes + 1;
+    end
+  usb_wait <= (usb_wait == 2) ? 0 : usb_wait + 1;
+  USB_FRDn <= ~((usb_wait == 2) & (usb_reading | (usb_byte != 0)));
+end
+
+////////////////////////////////////////////////////////////////////////////////
+// Bus cycles. A task starts just after a clock edge, sets the signals for the
+// clock to come, and returns just after the edge that samples its last ones.
+integer seed = 1;
+reg [31:0] io_data;
+
+task cycle;
+begin
+  @(posedge PCI_CLK);
+  #1;
+end
+endtask
+
+task idle;
+input integer clocks;
+begin
+  repeat(clocks) cycle;
+end
+endtask
+
+// the master gets the bus, unless the arbiter already parked it there
+task arbitrate;
+begin
+  if(PCI_GNTn)
+    begin
+      PCI_REQn = 0;
+      cycle;
+      PCI_GNTn = 0;
+      cycle;
+      PCI_REQn = 1;
+    end
+end
+endtask
+
+// the bus parked on the master: AD and CBE driven, but no transaction
+task park;
+input integer clocks;
+begin
+  m_ad_oe = 1;
+  m_cbe_oe = 1;
+  repeat(clocks)
+    begin
+      m_ad = $random(seed);
+      m_cbe = $random(seed);
+      cycle;
+    end
+  m_ad_oe = 0;
+  m_cbe_oe = 0;
+end
+endtask
+
+task release_bus;
+begin
+  m_irdy_n = 1;
+  m_ad_oe = 0;
+  m_cbe_oe = 0;
+  PCI_GNTn = 1;
+  cycle;
+end
+endtask
+
+// Memory cycle of the given data phases to the testbench target, which
+// answers each after the given wait states (one more on the first read
+// data phase, for the turnaround)
+task mem_cycle;
+input write;
+input [31:0] address;
+input integer phases;
+input integer waits;
+integer p;
+begin
+  arbitrate;
+  m_frame_n = 0;
+  m_ad_oe = 1;
+  m_ad = address;
+  m_cbe_oe = 1;
+  m_cbe = write ? PCI_CBECD_MEMWrite : PCI_CBECD_MEMRead;
+  cycle;
+  m_irdy_n = 0;
+  m_cbe = 4'h0;
+  if(!write) m_ad_oe = 0;
+  t_oe = 1;
+  t_devsel_n = 0;
+  for(p = 0; p < phases; p = p + 1)
+    begin
+      if(p == phases - 1) m_frame_n = 1;
+      if(write) m_ad = $random(seed);
+      t_trdy_n = 1;
+      idle(waits + (!write && p == 0));
+      t_trdy_n = 0;
+      if(!write)
+        begin
+          t_ad_oe = 1;
+          t_ad = $random(seed);
+        end
+      cycle;
+    end
+  t_trdy_n = 1;
+  t_devsel_n = 1;
+  t_ad_oe = 0;
+  release_bus;
+  t_oe = 0;
+end
+endtask
+
+// IO cycle to a word of the board's registers; a read leaves the data in io_data
+task board_io;
+input write;
+input [3:0] word;
+input [31:0] data;
+integer clocks;
+begin
+  arbitrate;
+  m_frame_n = 0;
+  m_ad_oe = 1;
+  m_ad = IO_address + word * 4;
+  m_cbe_oe = 1;
+  m_cbe = write ? PCI_CBECD_IOWrite : PCI_CBECD_IORead;
+  cycle;
+  m_frame_n = 1;
+  m_irdy_n = 0;
+  m_cbe = 4'h0;
+  if(write) m_ad = data;
+  else m_ad_oe = 0;
+  clocks = 0;
+  @(posedge PCI_CLK);
+  while(PCI_TRDYn)
+    begin
+      clocks = clocks + 1;
+      if(clocks == 8)
+        begin
+          $display("FAIL: the board does not answer the IO cycle to word %0d", word);
+          $finish;
+        end
+      @(posedge PCI_CLK);
+    end
+  io_data = PCI_AD;
+  #1;
+  release_bus;
+end
+endtask
+
+// n memory cycles of random length and wait states, the given clocks apart
+task traffic;
+input integer n;
+input integer gap;
+begin
+  repeat(n)
+    begin
+      mem_cycle($random(seed), $random(seed), 1 + {$random(seed)} % 4, {$random(seed)} % 3);
+      idle(gap);
+    end
+end
+endtask
+
+////////////////////////////////////////////////////////////////////////////////
+integer trigger_file;
+
+initial
+begin
+`ifdef STREAM_CAPTURE
+  reference_file = $fopen("stream_reference.pciacq", "wb");
+  usb_file = $fopen("stream.pcistr", "wb");
+`elsif RLE_CAPTURE
+  reference_file = $fopen("rle_reference.pciacq", "wb");
+  usb_file = $fopen("rle.pciacq", "wb");
+  trigger_file = $fopen("rle_trigger.txt", "w");
+`else
+  reference_file = $fopen("timed_reference.pciacq", "wb");
+  usb_file = $fopen("timed.pciacq", "wb");
+  trigger_file = $fopen("timed_trigger.txt", "w");
+`endif
+  idle(4);
+  PCI_RSTn = 1;
+
+`ifdef STREAM_CAPTURE
+  usb_reading = 1;
+  // sparse traffic, the FIFO keeps up
+  traffic(20, 300);
+  board_io(1, 4'h3, 32'h12345678);
+  board_io(0, 4'h3, 0);
+  if(io_data != 32'h12345678)
+    begin
+      $display("FAIL: register word 3 reads back %h", io_data);
+      $finish;
+    end
+  idle(300);
+
+  // stop reading: back-to-back cycles fill the FIFO and it overflows
+  usb_reading = 0;
+  traffic(100, 0);
+  if(~dut.Stream_Overflow)
+    begin
+      $display("FAIL: the FIFO did not overflow");
+      $finish;
+    end
+  usb_reading = 1;
+  idle(10000);  // the status record goes out, the FIFO drains
+
+  traffic(10, 300);
+  idle(9000);  // 2 saturated runs and the rest
+  traffic(1, 0);
+  idle(2000);  // the FIFO drains, the last run stays held
+  if(~dut.Stream.fifo_empty)
+    begin
+      $display("FAIL: the FIFO did not drain");
+      $finish;
+    end
+`else
+  board_io(1, 4'h1, 256);  // all 256 entries after the trigger, and arm
+  idle(20);
+  board_io(0, 4'hE, 0);
+  if(~io_data[24])
+    begin
+      $display("FAIL: the capture triggered on the board's own cycles, status %h", io_data);
+      $finish;
+    end
+
+  board_io(1, 4'h1, 128);  // 128 entries after the trigger, and arm
+  park(300);
+  PCI_GNTn = 0;
+  idle(5000);
+  trigger_watch = 1;
+  mem_cycle(0, 32'h10000000, 4, 1);  // the trigger
+  traffic(3, 10);
+  idle(9000);
+  park(300);
+  board_io(0, 4'hE, 0);
+  if(~io_data[26])
+    begin
+      $display("FAIL: the capture is not done, status %h", io_data);
+      $finish;
+    end
+  if(trigger_clock != address_clock)
+    begin
+      $display("FAIL: the trigger entry is reference clock %0d, the address phase %0d", trigger_clock, address_clock);
+      $finish;
+    end
+  $fwrite(trigger_file, "%0d %0d\n", io_data[7:0], address_clock);
+  $fclose(trigger_file);
+
+  // RAM_LA, from the oldest entry on
+  usb_reading = 1;
+  wait(usb_bytes == 256 * 8 - 7);
+  usb_reading = 0;
+  wait(usb_bytes == 256 * 8);
+`endif
+
+  usb_reading = 0;
+  idle(100);
+  $fclose(reference_file);
+  $fclose(usb_file);
+  $display("Simulation done");
+  $finish;
+end
+
+endmodule
@@ -1,4 +1,7 @@
 
 
 bool TestUSBConnection();
-void ReadFromDragon(char *output_filename);
\ No newline at end of file
+void ReadFromDragon(char *output_filename);
+
+// StreamFromDragon() is portable, in dragon_stream.cpp
+#include "dragon_stream.h"
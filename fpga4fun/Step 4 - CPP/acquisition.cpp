@@ -0,0 +1,298 @@
+#include <stdio.h>
+#include <string.h>
+
+#include "acquisition.h"
+#include "capture_file.h"
+
+acquisition::acquisition(const acquisition_options &options_in)
+	: options(options_in), stopping(false), reader_done(false), sink(NULL), sink_context(NULL)
+{
+	if (options.buffers < 2)
+		options.buffers = 2;
+	pool.resize(options.buffers);
+	for (size_t b = 0; b < pool.size(); b++)
+		pool[b].resize(options.buffer_size);
+	filled_size.resize(options.buffers, options.buffer_size);
+	if (options.drop_when_full)
+		scratch.resize(options.buffer_size);
+	memset(&counters, 0, sizeof(counters));
+}
+
+void acquisition::stop()
+{
+	std::lock_guard<std::mutex> guard(lock);
+	stopping = true;
+	buffer_free.notify_all();
+}
+
+acquisition_stats acquisition::stats() const
+{
+	std::lock_guard<std::mutex> guard(lock);
+	return counters;
+}
+
+void acquisition::writer_thread(acquisition *self)
+{
+	std::unique_lock<std::mutex> guard(self->lock);
+	for (;;) {
+		while (self->filled_buffers.empty() && !self->reader_done)
+			self->buffer_filled.wait(guard);
+		if (self->filled_buffers.empty())
+			break;
+		size_t b = self->filled_buffers.front();
+		size_t size = self->filled_size[b];
+		self->filled_buffers.pop_front();
+
+		// the buffer belongs to this thread until it is handed back
+		guard.unlock();
+		bool ok = self->deliver(&self->pool[b][0], size);
+		guard.lock();
+
+		self->free_buffers.push_back(b);
+		self->buffer_free.notify_one();
+		if (!ok) {
+			self->counters.sink_failed = true;
+			self->stopping = true;
+			// give back whatever is still queued, it will not be written
+			while (!self->filled_buffers.empty()) {
+				self->free_buffers.push_back(self->filled_buffers.front());
+				self->filled_buffers.pop_front();
+			}
+			self->buffer_free.notify_all();
+			break;
+		}
+		self->counters.buffers_written++;
+		self->counters.bytes_written += size;
+	}
+
+	// what is left of a record at the end goes on as it is
+	if (!self->carry.empty() && !self->counters.sink_failed) {
+		guard.unlock();
+		bool ok = self->sink(&self->carry[0], self->carry.size(), self->sink_context);
+		guard.lock();
+		if (!ok)
+			self->counters.sink_failed = true;
+	}
+}
+
+bool acquisition::deliver(const unsigned char *data, size_t size)
+{
+	if (!carry.empty()) {
+		size_t n = PCI_RECORD_SIZE - carry.size();
+		if (n > size)
+			n = size;
+		carry.insert(carry.end(), data, data + n);
+		data += n;
+		size -= n;
+		if (carry.size() < PCI_RECORD_SIZE)
+			return true;
+		bool ok = sink(&carry[0], PCI_RECORD_SIZE, sink_context);
+		carry.clear();
+		if (!ok)
+			return false;
+	}
+	size_t whole = size - size % PCI_RECORD_SIZE;
+	carry.assign(data + whole, data + size);
+	return whole == 0 || sink(data, whole, sink_context);
+}
+
+void acquisition::start(acquisition_sink sink_in, void *sink_context_in)
+{
+	std::lock_guard<std::mutex> guard(lock);
+	sink = sink_in;
+	sink_context = sink_context_in;
+	stopping = false;
+	reader_done = false;
+	free_buffers.clear();
+	filled_buffers.clear();
+	carry.clear();
+	for (size_t b = pool.size(); b-- > 0; )
+		free_buffers.push_back(b);
+	memset(&counters, 0, sizeof(counters));
+	writer = std::thread(writer_thread, this);
+}
+
+bool acquisition::finish()
+{
+	{
+		std::lock_guard<std::mutex> guard(lock);
+		reader_done = true;
+		buffer_filled.notify_one();
+	}
+	writer.join();
+
+	std::lock_guard<std::mutex> guard(lock);
+	return !counters.source_failed && !counters.sink_failed;
+}
+
+void acquisition::queue_filled(size_t b)
+{
+	filled_buffers.push_back(b);
+	if (filled_buffers.size() > counters.queue_high_water)
+		counters.queue_high_water = (unsigned int)filled_buffers.size();
+	buffer_filled.notify_one();
+}
+
+bool acquisition::run(acquisition_source source, void *source_context, acquisition_sink sink_in, void *sink_context_in)
+{
+	start(sink_in, sink_context_in);
+
+	uint64_t bytes_read = 0;
+	for (;;) {
+		if (options.max_bytes != 0 && bytes_read >= options.max_bytes)
+			break;
+
+		// take a free buffer, or decide to drop this read
+		size_t b = 0;
+		bool drop = false;
+		{
+			std::unique_lock<std::mutex> guard(lock);
+			if (stopping)
+				break;
+			if (free_buffers.empty()) {
+				if (options.drop_when_full) {
+					drop = true;
+				} else {
+					counters.reader_waits++;
+					while (free_buffers.empty() && !stopping)
+						buffer_free.wait(guard);
+					if (stopping)
+						break;
+				}
+			}
+			if (!drop) {
+				b = free_buffers.back();
+				free_buffers.pop_back();
+			}
+		}
+
+		unsigned char *buffer = drop ? &scratch[0] : &pool[b][0];
+		bool ok = source(buffer, options.buffer_size, source_context);
+		bytes_read += options.buffer_size;
+
+		std::lock_guard<std::mutex> guard(lock);
+		if (!ok) {
+			counters.source_failed = true;
+			if (!drop)
+				free_buffers.push_back(b);
+			break;
+		}
+		counters.buffers_read++;
+		if (drop) {
+			counters.buffers_dropped++;
+		} else {
+			filled_size[b] = options.buffer_size;
+			queue_filled(b);
+		}
+	}
+	return finish();
+}
+
+bool acquisition::take_buffer(size_t *b)
+{
+	std::unique_lock<std::mutex> guard(lock);
+	if (!stopping && free_buffers.empty()) {
+		counters.reader_waits++;
+		while (free_buffers.empty() && !stopping)
+			buffer_free.wait(guard);
+	}
+	if (stopping)
+		return false;
+	*b = free_buffers.back();
+	free_buffers.pop_back();
+	return true;
+}
+
+bool acquisition::run_async(usb_transport *transport, unsigned int in_flight, acquisition_sink sink_in, void *sink_context_in)
+{
+	// the pool has to hold the reads in flight and at least one more
+	if (in_flight < 1)
+		in_flight = 1;
+	if (in_flight > pool.size() - 1)
+		in_flight = (unsigned int)pool.size() - 1;
+	start(sink_in, sink_context_in);
+
+	std::vector<usb_transfer> transfers(in_flight);
+	uint64_t bytes_submitted = 0;
+	for (size_t t = 0; t < transfers.size(); t++) {
+		size_t b;
+		if ((options.max_bytes != 0 && bytes_submitted >= options.max_bytes) || !take_buffer(&b))
+			break;
+		transfers[t].buffer = &pool[b][0];
+		transfers[t].size = options.buffer_size;
+		transfers[t].user = (void *)b;
+		if (!transport->submit_read(&transfers[t])) {
+			std::lock_guard<std::mutex> guard(lock);
+			free_buffers.push_back(b);
+			counters.source_failed = true;
+			stopping = true;
+			break;
+		}
+		bytes_submitted += options.buffer_size;
+	}
+
+	usb_transfer *transfer;
+	while ((transfer = transport->wait_completion()) != NULL) {
+		size_t b = (size_t)transfer->user;
+		bool reuse = false;	// resubmit the buffer that just completed
+		{
+			std::lock_guard<std::mutex> guard(lock);
+			uint64_t latency = transfer->completed - transfer->submitted;
+			if (counters.transfers_timed == 0 || latency < counters.latency_min)
+				counters.latency_min = latency;
+			if (latency > counters.latency_max)
+				counters.latency_max = latency;
+			counters.latency_total += latency;
+			counters.transfers_timed++;
+
+			if (!transfer->ok) {
+				counters.source_failed = true;
+				stopping = true;
+				free_buffers.push_back(b);
+				buffer_free.notify_all();
+				continue;
+			}
+			// a short read is passed on as it is, and the reads go on
+			if (transfer->transferred < transfer->size)
+				counters.short_transfers++;
+			if (transfer->transferred == 0) {
+				reuse = true;
+			} else {
+				counters.buffers_read++;
+				if (options.drop_when_full && free_buffers.empty()) {
+					counters.buffers_dropped++;
+					reuse = true;
+				} else {
+					filled_size[b] = transfer->transferred;
+					queue_filled(b);
+				}
+			}
+			if (stopping || (options.max_bytes != 0 && bytes_submitted >= options.max_bytes)) {
+				if (reuse)
+					free_buffers.push_back(b);
+				continue;
+			}
+		}
+
+		// keep the same number of reads in flight
+		if (!reuse && !take_buffer(&b))
+			continue;
+		transfer->buffer = &pool[b][0];
+		transfer->size = options.buffer_size;
+		transfer->user = (void *)b;
+		if (!transport->submit_read(transfer)) {
+			std::lock_guard<std::mutex> guard(lock);
+			free_buffers.push_back(b);
+			counters.source_failed = true;
+			stopping = true;
+			continue;
+		}
+		bytes_submitted += options.buffer_size;
+	}
+	return finish();
+}
+
+bool file_sink(const unsigned char *buffer, size_t size, void *context)
+{
+	return fwrite(buffer, 1, size, static_cast<FILE *>(context)) == size;
+}
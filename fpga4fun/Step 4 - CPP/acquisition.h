@@ -0,0 +1,112 @@
+#pragma once
+
+// Continuous acquisition: the reader (the calling thread) keeps pulling
+// buffers from a source into a pool of pre-allocated buffers, and a writer
+// thread drains the filled buffers, in order, to a sink (a file, a decoder).
+// When the writer falls behind and the pool runs dry, the reader either
+// waits for a buffer to come back (backpressure on the source) or reads into
+// a scratch buffer and drops it, so the source is never stalled; either way
+// it is counted.
+// run() reads synchronously from a callback; run_async() keeps several
+// reads in flight on a usb_transport and also reports their latency. A read
+// that completes short passes on the bytes that arrived and is counted; only
+// a failed read stops the acquisition. The sink still gets whole records:
+// the start of a record cut by a short read waits for the rest.
+
+#include <stddef.h>
+#include <stdint.h>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "usb_transport.h"
+
+#define ACQUISITION_BUFFER_SIZE (64*256)	// one 16KB USB read
+#define ACQUISITION_BUFFERS 64
+
+// Fill buffer with size bytes; false stops the acquisition
+typedef bool (*acquisition_source)(unsigned char *buffer, size_t size, void *context);
+// Consume size bytes; false stops the acquisition
+typedef bool (*acquisition_sink)(const unsigned char *buffer, size_t size, void *context);
+
+struct acquisition_options
+{
+	size_t buffer_size;	// bytes per read, a multiple of PCI_RECORD_SIZE
+	unsigned int buffers;	// buffers in the pool
+	bool drop_when_full;	// drop reads instead of waiting for a free buffer
+	uint64_t max_bytes;	// stop after this many bytes read, 0 for no limit
+
+	acquisition_options()
+		: buffer_size(ACQUISITION_BUFFER_SIZE), buffers(ACQUISITION_BUFFERS), drop_when_full(false), max_bytes(0) {}
+};
+
+struct acquisition_stats
+{
+	uint64_t buffers_read;
+	uint64_t buffers_written;
+	uint64_t buffers_dropped;	// read while the pool was empty, never written
+	uint64_t reader_waits;		// times the reader waited for a free buffer
+	uint64_t bytes_written;
+	unsigned int queue_high_water;	// most filled buffers waiting at once
+	uint64_t transfers_timed;	// run_async() only: transfer latency, in ns
+	uint64_t latency_min;
+	uint64_t latency_max;
+	uint64_t latency_total;
+	uint64_t short_transfers;	// run_async() only: completed with fewer bytes than asked
+	bool source_failed;
+	bool sink_failed;
+};
+
+class acquisition
+{
+public:
+	explicit acquisition(const acquisition_options &options);
+
+	// Read until the source or sink fails, max_bytes is reached or stop()
+	// is called. Returns false if the source or sink failed.
+	bool run(acquisition_source source, void *source_context, acquisition_sink sink, void *sink_context);
+	// Same, keeping in_flight reads outstanding on transport; the pool must
+	// have more buffers than that. In drop mode a read that completes while
+	// no buffer is free is dropped and its buffer resubmitted at once.
+	bool run_async(usb_transport *transport, unsigned int in_flight, acquisition_sink sink, void *sink_context);
+	// Ask run() or run_async() to return once the reads in flight are done;
+	// callable from any thread
+	void stop();
+
+	acquisition_stats stats() const;
+
+private:
+	static void writer_thread(acquisition *self);
+	void start(acquisition_sink sink, void *sink_context);
+	bool finish();
+	// call with lock held
+	void queue_filled(size_t b);
+	// wait for a free buffer; false if stopping
+	bool take_buffer(size_t *b);
+	// writer thread: pass size bytes on to the sink in whole records
+	bool deliver(const unsigned char *data, size_t size);
+
+	acquisition_options options;
+	std::vector<std::vector<unsigned char> > pool;
+	std::vector<size_t> filled_size;	// bytes read into each buffer
+	std::vector<unsigned char> scratch;	// target of dropped reads
+	std::vector<unsigned char> carry;	// writer thread: the start of a cut record
+
+	mutable std::mutex lock;
+	std::condition_variable buffer_free;
+	std::condition_variable buffer_filled;
+	std::vector<size_t> free_buffers;
+	std::deque<size_t> filled_buffers;
+	bool stopping;
+	bool reader_done;
+
+	std::thread writer;
+	acquisition_sink sink;
+	void *sink_context;
+	acquisition_stats counters;
+};
+
+// Sink writing every buffer to a FILE *
+bool file_sink(const unsigned char *buffer, size_t size, void *context);
@@ -0,0 +1,236 @@
+#include <stdio.h>
+#include <string.h>
+#include <algorithm>
+
+#include "address_index.h"
+#include "capture_index.h"
+#include "parallel_decoder.h"
+
+// Subtrees of at most this many levels are scanned linearly
+#define ADDRESS_SCAN_LEVEL 3
+
+std::string address_index_filename(const char *capture_filename)
+{
+	return capture_sidecar_filename(capture_filename, ".pciadr");
+}
+
+static bool interval_less(const address_interval &a, const address_interval &b)
+{
+	return a.first < b.first || (a.first == b.first && a.transaction < b.transaction);
+}
+
+struct tree_build
+{
+	std::vector<address_interval> *intervals;
+	std::vector<size_t> bounds;	// sorted runs [bounds[r], bounds[r + 1])
+	size_t width;			// runs merged per item in this round
+};
+
+static void sort_work(size_t item, void *context)
+{
+	tree_build *build = static_cast<tree_build *>(context);
+	address_interval *a = &(*build->intervals)[0];
+	std::sort(a + build->bounds[item], a + build->bounds[item + 1], interval_less);
+}
+
+static void merge_work(size_t item, void *context)
+{
+	tree_build *build = static_cast<tree_build *>(context);
+	size_t runs = build->bounds.size() - 1;
+	size_t left = item * 2 * build->width;
+	size_t middle = left + build->width;
+	size_t right = std::min(middle + build->width, runs);
+	if (middle >= runs)
+		return;
+	address_interval *a = &(*build->intervals)[0];
+	std::inplace_merge(a + build->bounds[left], a + build->bounds[middle], a + build->bounds[right], interval_less);
+}
+
+uint32_t build_address_tree(std::vector<address_interval> &intervals, unsigned int threads)
+{
+	size_t n = intervals.size();
+	if (n == 0)
+		return 0;
+
+	// sort one run per thread, then merge the runs in pairs
+	tree_build build;
+	build.intervals = &intervals;
+	size_t runs = threads > 1 && n >= 2 * threads ? threads : 1;
+	for (size_t r = 0; r <= runs; r++)
+		build.bounds.push_back(n * r / runs);
+	run_workers(threads, runs, sort_work, &build);
+	for (build.width = 1; build.width < runs; build.width *= 2)
+		run_workers(threads, (runs + 2 * build.width - 1) / (2 * build.width), merge_work, &build);
+
+	// leaves are the even indexes; last_max is the largest last of the
+	// rightmost subtree, which may be missing its right child
+	address_interval *a = &intervals[0];
+	size_t last_i = 0;
+	uint32_t last_max = 0;
+	for (size_t i = 0; i < n; i += 2) {
+		last_i = i;
+		last_max = a[i].max_last = a[i].last;
+	}
+	uint32_t k;
+	for (k = 1; ((size_t)1 << k) <= n; k++) {
+		size_t x = (size_t)1 << (k - 1);
+		for (size_t i = (x << 1) - 1; i < n; i += x << 2) {
+			uint32_t left = a[i - x].max_last;
+			uint32_t right = i + x < n ? a[i + x].max_last : last_max;
+			uint32_t m = a[i].last;
+			if (left > m)
+				m = left;
+			if (right > m)
+				m = right;
+			a[i].max_last = m;
+		}
+		last_i = (last_i >> k & 1) ? last_i - x : last_i + x;
+		if (last_i < n && a[last_i].max_last > last_max)
+			last_max = a[last_i].max_last;
+	}
+	return k - 1;
+}
+
+void find_address_range(const address_interval *a, size_t n, uint32_t root_level,
+	uint32_t first, uint32_t last, uint16_t commands, std::vector<uint64_t> *found)
+{
+	if (n == 0)
+		return;
+
+	struct node
+	{
+		size_t x;
+		uint32_t k;
+		bool left_done;
+	} stack[64];
+	int t = 0;
+	stack[t].x = ((size_t)1 << root_level) - 1;
+	stack[t].k = root_level;
+	stack[t++].left_done = false;
+
+	while (t > 0) {
+		node z = stack[--t];
+		if (z.k <= ADDRESS_SCAN_LEVEL) {
+			size_t i0 = z.x >> z.k << z.k;
+			size_t i1 = i0 + ((size_t)1 << (z.k + 1)) - 1;
+			if (i1 > n)
+				i1 = n;
+			for (size_t i = i0; i < i1 && a[i].first <= last; i++) {
+				if (first <= a[i].last && (commands & (1 << a[i].command)))
+					found->push_back(a[i].transaction);
+			}
+		} else if (!z.left_done) {
+			// come back to z after its left subtree; the left child may be
+			// past the end of the array, its subtree is then partly there
+			size_t y = z.x - ((size_t)1 << (z.k - 1));
+			stack[t].x = z.x;
+			stack[t].k = z.k;
+			stack[t++].left_done = true;
+			if (y >= n || a[y].max_last >= first) {
+				stack[t].x = y;
+				stack[t].k = z.k - 1;
+				stack[t++].left_done = false;
+			}
+		} else if (z.x < n && a[z.x].first <= last) {
+			if (first <= a[z.x].last && (commands & (1 << a[z.x].command)))
+				found->push_back(a[z.x].transaction);
+			stack[t].x = z.x + ((size_t)1 << (z.k - 1));
+			stack[t].k = z.k - 1;
+			stack[t++].left_done = false;
+		}
+	}
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+struct interval_fill
+{
+	const capture_index *index;
+	std::vector<address_interval> *intervals;
+	size_t items;
+};
+
+static void fill_work(size_t item, void *context)
+{
+	interval_fill *fill = static_cast<interval_fill *>(context);
+	size_t n = (size_t)fill->index->size();
+	for (size_t i = n * item / fill->items; i < n * (item + 1) / fill->items; i++) {
+		const pciidx_entry &entry = (*fill->index)[i];
+		address_interval &interval = (*fill->intervals)[i];
+
+		// AD[1:0] of a memory command is the burst order, not part of the address
+		uint32_t address = (entry.command & 0x4) ? entry.address & ~3u : entry.address;
+		uint64_t bytes = 4 * (uint64_t)(entry.data_phases > 0 ? entry.data_phases : 1);
+		uint64_t end = (uint64_t)address + bytes - 1;
+
+		memset(&interval, 0, sizeof(interval));
+		interval.first = address;
+		interval.last = end > 0xFFFFFFFF ? 0xFFFFFFFF : (uint32_t)end;
+		interval.command = entry.command & 0x0F;
+		interval.transaction = i;
+	}
+}
+
+bool build_address_index(const char *capture_filename, const capture_index &index, unsigned int threads)
+{
+	std::vector<address_interval> intervals((size_t)index.size());
+	interval_fill fill;
+	fill.index = &index;
+	fill.intervals = &intervals;
+	fill.items = threads > 0 ? threads : 1;
+	run_workers(threads, fill.items, fill_work, &fill);
+
+	pciadr_header header;
+	memset(&header, 0, sizeof(header));
+	memcpy(header.magic, PCIADR_MAGIC, sizeof(header.magic));
+	header.version = PCIADR_VERSION;
+	header.entry_size = sizeof(address_interval);
+	header.capture_hash = index.capture_hash();
+	header.entries = intervals.size();
+	header.root_level = build_address_tree(intervals, threads);
+
+	// write to a temporary file, so a reader never sees a half-built index
+	std::string index_filename = address_index_filename(capture_filename);
+	std::string temp_filename = index_filename + ".tmp";
+	FILE *F = fopen(temp_filename.c_str(), "wb");
+	if (F == NULL)
+		return false;
+	bool ok = fwrite(&header, sizeof(header), 1, F) == 1;
+	ok = ok && (intervals.empty() || fwrite(&intervals[0], sizeof(address_interval), intervals.size(), F) == intervals.size());
+	ok = (fclose(F) == 0) && ok;
+	if (ok) {
+		remove(index_filename.c_str());
+		ok = rename(temp_filename.c_str(), index_filename.c_str()) == 0;
+	}
+	if (!ok)
+		remove(temp_filename.c_str());
+	return ok;
+}
+
+bool address_index::valid(const capture_index &index) const
+{
+	if (file.size() < sizeof(pciadr_header))
+		return false;
+
+	const pciadr_header *h = header();
+	return memcmp(h->magic, PCIADR_MAGIC, sizeof(h->magic)) == 0 && h->version == PCIADR_VERSION
+		&& h->entry_size == sizeof(address_interval)
+		&& file.size() == sizeof(pciadr_header) + h->entries * sizeof(address_interval)
+		&& h->root_level < 64
+		&& h->capture_hash == index.capture_hash() && h->entries == index.size();
+}
+
+bool address_index::open(const char *capture_filename, const capture_index &index, unsigned int threads)
+{
+	std::string index_filename = address_index_filename(capture_filename);
+	was_rebuilt = false;
+
+	if (file.open(index_filename.c_str()) && valid(index))
+		return true;
+	file.close();
+
+	if (!build_address_index(capture_filename, index, threads))
+		return false;
+	was_rebuilt = true;
+	return file.open(index_filename.c_str()) && valid(index);
+}
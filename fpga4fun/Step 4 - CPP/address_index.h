@@ -0,0 +1,87 @@
+#pragma once
+
+// Address interval index (.pciadr), kept next to the .pciidx of a capture.
+// Each transaction covers the bytes [address, address + 4 * data phases),
+// and at least the word at address when it ended without a data phase (a
+// master abort, a retry), as it still targeted it. Bursts may overlap, and
+// the last byte is clipped at 0xFFFFFFFF. The intervals are sorted by start address and laid
+// out as an implicit binary tree over the sorted array: the node at index i
+// on level k (i with k trailing one bits) holds the largest last address of
+// its subtree, so a range query only walks the subtrees that can overlap it.
+// The array is its own serialized form and is used straight from a mapping.
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+#include "capture_file.h"
+
+class capture_index;
+
+#define PCIADR_MAGIC "PCIADR01"
+#define PCIADR_VERSION 1
+
+struct pciadr_header
+{
+	char magic[8];
+	uint32_t version;
+	uint32_t entry_size;
+	uint64_t capture_hash;	// same as the .pciidx it was built from
+	uint64_t entries;
+	uint32_t root_level;
+	uint32_t reserved;
+};
+
+struct address_interval
+{
+	uint32_t first;		// first byte address
+	uint32_t last;		// last byte address, inclusive
+	uint32_t max_last;	// largest last in the subtree rooted here
+	uint8_t command;
+	uint8_t reserved[3];
+	uint64_t transaction;	// index into the .pciidx entries
+};
+
+// Sort intervals by first address and fill in max_last; returns the root
+// level. The sort runs on up to threads threads.
+uint32_t build_address_tree(std::vector<address_interval> &intervals, unsigned int threads);
+
+// Append to *found the transaction index of every interval overlapping
+// [first, last] whose command is in commands (bit n for command n)
+void find_address_range(const address_interval *intervals, size_t count, uint32_t root_level,
+	uint32_t first, uint32_t last, uint16_t commands, std::vector<uint64_t> *found);
+
+class address_index
+{
+public:
+	address_index() : was_rebuilt(false) {}
+
+	// Map the address index of capture_filename, (re)building it from index
+	// if it is missing or was built from other contents
+	bool open(const char *capture_filename, const capture_index &index, unsigned int threads = 1);
+	void close() { file.close(); }
+
+	uint64_t size() const { return header()->entries; }
+	const address_interval *intervals() const { return (const address_interval *)(file.data() + sizeof(pciadr_header)); }
+
+	// Transactions touching any byte of [first, last], in address order
+	void find(uint32_t first, uint32_t last, uint16_t commands, std::vector<uint64_t> *found) const
+	{
+		find_address_range(intervals(), (size_t)size(), header()->root_level, first, last, commands, found);
+	}
+
+	bool rebuilt() const { return was_rebuilt; }
+
+private:
+	const pciadr_header *header() const { return (const pciadr_header *)file.data(); }
+	bool valid(const capture_index &index) const;
+
+	mapped_file file;
+	bool was_rebuilt;
+};
+
+// "capture.pciacq" -> "capture.pciacq.pciadr"
+std::string address_index_filename(const char *capture_filename);
+
+bool build_address_index(const char *capture_filename, const capture_index &index, unsigned int threads);
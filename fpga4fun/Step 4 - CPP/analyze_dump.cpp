@@ -1,113 +1,386 @@
 #include <iostream>
-#include <fstream>
 #include <iomanip>
-
+#include <algorithm>
 #include <vector>
-#include <deque>
 
 #include "analyze_dump.h"
+#include "capture_decode.h"
+#include "capture_index.h"
+#include "address_index.h"
+#include "record_ring.h"
+#include "batch_analyze.h"
+#include "capture_catalog.h"
+#include "capture_stream.h"
+#include "capture_file.h"
+#include "soft_trigger.h"
+#include "trigger_sequencer.h"
+
+
+// The transactions printed so far, and where the board triggered, for a
+// capture with a .pcitrg
+struct transaction_printer
+{
+        uint64_t transactions;
+        bool has_trigger;
+        unsigned int trigger_entry;
+        uint64_t trigger;       // sample index
+
+        transaction_printer() : transactions(0), has_trigger(false), trigger_entry(0), trigger(0) {}
+};
+
+// The sample index of the trigger entry of a RAM_LA dump, from its .pcitrg
+static bool find_trigger(const char *filename, unsigned int *entry, uint64_t *sample)
+{
+        if (!read_trigger_entry(filename, entry))
+                return false;
+        // a dump of .pciacq records has one per clock
+        if (!is_stream_capture(filename)) {
+                *sample = *entry;
+                return true;
+        }
+        return stream_record_sample(filename, *entry, sample);
+}
+
+static void print_transaction(const pci_transaction &transaction, void *context)
+{
+        transaction_printer *printer = static_cast<transaction_printer *>(context);
+        printer->transactions++;
 
+        std::cout << "\nFrame #: " << std::dec << transaction.start;
+        std::cout << " AD [0x" << std::setw(4) << std::setfill('0')
+                                << std::hex << ((transaction.address & 0xFFFF0000) >> 16)
+                                << " "
+                                << std::setw(4) << std::hex << ((transaction.address & 0xFFFF)) << "]";
+        std::cout << " CBE [" << std::hex << (int)transaction.command << " = " <<
+getMessageType((int)transaction.command).c_str() << "]";
+        std::cout << " Wait states [" << std::dec << transaction.wait_states << "]";
+        std::cout << " Termination [" << getTerminationType(transaction.termination) << "]";
+        if (printer->has_trigger && transaction.start <= printer->trigger && printer->trigger <= transaction.end)
+                std::cout << " <- Trigger";
 
-int analyze_file(const char *filename) {
+        // print all data
+        if (transaction.data_phases > 0) {
+                std::cout << "\nData = [" << std::dec;
+                for (size_t i = 0; i < transaction.data.size(); i++)
+                        std::cout << " " << (int)transaction.data[i].data;
+                if (transaction.data_phases > transaction.data.size())
+                        std::cout << " ... (" << transaction.data_phases << " data phases)";
+                std::cout << " ]";
+        }
+        std::cout << "\n";
+}
+
+static void print_entry(const pciidx_entry &entry)
+{
+        std::cout << "\nFrame #: " << std::dec << entry.start;
+        std::cout << " AD [0x" << std::setw(4) << std::setfill('0')
+                                << std::hex << ((entry.address & 0xFFFF0000) >> 16)
+                                << " "
+                                << std::setw(4) << std::hex << ((entry.address & 0xFFFF)) << "]";
+        std::cout << " CBE [" << std::hex << (int)entry.command << " = " <<
+getMessageType((int)entry.command).c_str() << "]";
+        std::cout << " Data phases [" << std::dec << entry.data_phases << "]";
+        std::cout << " Wait states [" << entry.wait_states << "]";
+        std::cout << " Termination [" << getTerminationType((pci_termination)entry.termination) << "]";
+}
+
+static void print_trigger(const transaction_printer &printer)
+{
+        if (printer.has_trigger)
+                std::cout << "\nTrigger: entry " << std::dec << printer.trigger_entry << " at frame #" << printer.trigger;
+}
+
+static void print_totals(const framing_report &framing, uint64_t samples, uint64_t transactions)
+{
+        for (size_t r = 0; r < framing.dropped.size(); r++)
+                std::cout << "\nFraming lost: dropped " << std::dec << framing.dropped[r].length
+                        << " bytes at offset " << framing.dropped[r].offset;
+
+        std::cout << "\n";
+        std::cout << "\nTotal number of captured frames read: " << std::dec << samples;
+        std::cout << "\nTotal number of transactions: " << transactions;
+        std::cout << "\n";
+}
+
+int analyze_file(const char *filename, unsigned int threads) {
 
         std::cout << "\nParsing file";
+        std::cout << "\n";
+
+        transaction_printer printer;
+        printer.has_trigger = find_trigger(filename, &printer.trigger_entry, &printer.trigger);
+        uint64_t samples = 0;
+        framing_report framing;
+        if (!decode_capture(filename, threads, print_transaction, &printer, &framing, &samples))
+        {
+                std::cout << "\nCould not read " << filename;
+                return (-1);
+        }
 
-        char block[8];
-        int file_size, pos = 0;
+        print_trigger(printer);
+        print_totals(framing, samples, printer.transactions);
+        return (0);
+}
+
+int analyze_ring(record_ring *ring) {
+
+        std::cout << "\nParsing stream";
+        std::cout << "\n";
+
+        transaction_printer printer;
+        uint64_t samples = 0;
+        framing_report framing;
+        decode_ring(ring, print_transaction, &printer, &framing, &samples);
+
+        print_totals(framing, samples, printer.transactions);
+        std::cout << "Ring high water: " << ring->high_water() << " of " << ring->capacity() << " records\n";
+        return (0);
+}
 
-        std::ifstream fin (filename, std::ios::in | std::ios::binary | std::ios::ate );
-        fin.seekg(0, std::ios::end);
-        file_size = fin.tellg();
-        fin.seekg(0, std::ios::beg);
-        std::vector<pci_frame> my_frames;
+int list_file(const char *filename, unsigned int threads) {
 
-        if (fin.is_open())
+        capture_index index;
+        if (!index.open(filename, threads))
         {
-                while (fin.is_open()) {
-                        pos = fin.tellg();
-                        if ( pos + 8 <= file_size) {
-                                //3fff 80f0 4408 0102
-                                fin.read ( block, 8 );
-
-                                pci_frame frame_cap;
-                                frame_cap.AD = ( (block[5] & 0xFF) << 24 ) | ( (block[4] & 0xFF)
-<< 16 ) | ( (block[3] & 0xFF) << 8 ) | ( (block[2] & 0xFF) );
-                                frame_cap.CBE = (block[1] & 0xF0) >> 4;
-                                // PCI_IRDYn, PCI_TRDYn, PCI_FRAMEn, PCI_DEVSELn,
-                                frame_cap.IRDYn = (block[1] & 0x08);
-                                frame_cap.TRDYn = (block[1] & 0x04);
-                                frame_cap.FRAMEn = (block[1] & 0x02);
-                                frame_cap.DEVSELn = (block[1] & 0x01);
-                                // PCI_IDSEL, PCI_PAR, PCI_GNTn, PCI_LOCKn, PCI_PERRn, PCI_REQn, PCI_SERRn, PCI_STOPn
-                                frame_cap.IDSEL = (block[1] & 0x80);
-                                frame_cap.PAR = (block[1] & 0x40);
-                                frame_cap.GNTn = (block[1] & 0x20);
-                                frame_cap.LOCKn = (block[1] & 0x10);
-                                frame_cap.PERRn = (block[1] & 0x08);
-                                frame_cap.REQn = (block[1] & 0x04);
-                                frame_cap.SERRn = (block[1] & 0x02);
-                                frame_cap.STOPn = (block[1] & 0x01);
-
-                                my_frames.push_back(frame_cap);
-                                //dump_pci_frame (&frame_cap);
-                        } else {
-                                break;
-                        }
-                }
+                std::cout << "\nCould not index " << filename;
+                return (-1);
+        }
+        if (index.rebuilt())
+                std::cout << "\nBuilt " << capture_index_filename(filename);
 
-                fin.close();
-        }
-
-        std::cout << "\nTotal number of captured frames read: " << my_frames.size();
-
-        bool in_frame = false;
-        int num_find = 5;
-        int i = 0;
-        std::cout << "\n";
-        std::deque<int> data_phases;
-        for (int frame_num = 1; frame_num < 256; frame_num++) {
-                pci_frame it2 = my_frames.at(frame_num);
-                pci_frame prev_it = my_frames.at(frame_num-1);
-                pci_frame *it = &it2;
-                bool isAddressPhase = ( it->FRAMEn == false && prev_it.FRAMEn == true );
-                bool isDataTransfer = ( in_frame == true && it->IRDYn == false &&
-it->TRDYn == false );
-                bool isFrameEnd = ( it->FRAMEn == true && it->TRDYn == true );
-                if (isFrameEnd) {
-                        // print all data
-                        if (data_phases.size() > 0) {
-                                std::cout << "\nData = [" << std::dec;
-                                for (std::deque<int>::iterator it = data_phases.begin(); it !=
-data_phases.end(); ++it) {
-                                        std::cout << " " << *it;
-                                }
-                                std::cout << " ]";
-                                data_phases.clear();
-                        }
-                        in_frame = false;
-                } else if (isAddressPhase) {
-                        in_frame = true;
-                        data_phases.clear();
-                        std::cout << "\nFrame #: " << frame_num;
-                        std::cout << " AD [0x" << std::setw(4) << std::setfill('0')
-                                                << std::hex << ((it->AD & 0xFFFF0000) >> 16)
-                                                << " "
-                                                << std::hex << ((it->AD & 0xFFFF)) << "]";
-                        std::cout << " CBE [" << std::hex << (int)it->CBE << " = " <<
-getMessageType((int)it->CBE).c_str() << "]";
-                        std::cout << "\n";
-                        if ( i++ > num_find )
-                                break;
-                }
-                if (isDataTransfer) {
-                        data_phases.push_back(it->AD);
+        std::cout << "\n";
+        for (size_t i = 0; i < index.size(); i++)
+                print_entry(index[i]);
+
+        std::cout << "\n";
+        std::cout << "\nTotal number of captured frames read: " << std::dec << index.samples();
+        std::cout << "\nTotal number of transactions: " << index.size();
+        std::cout << "\n";
+
+        return (0);
+}
+
+int find_file(const char *filename, uint32_t first, uint32_t last, unsigned int threads) {
+
+        capture_index index;
+        address_index addresses;
+        if (!index.open(filename, threads) || !addresses.open(filename, index, threads))
+        {
+                std::cout << "\nCould not index " << filename;
+                return (-1);
+        }
+        if (index.rebuilt())
+                std::cout << "\nBuilt " << capture_index_filename(filename);
+        if (addresses.rebuilt())
+                std::cout << "\nBuilt " << address_index_filename(filename);
+
+        std::vector<uint64_t> found;
+        addresses.find(first, last, 0xFFFF, &found);
+
+        // in capture order, not address order
+        std::sort(found.begin(), found.end());
+        std::cout << "\n";
+        for (size_t i = 0; i < found.size(); i++)
+                print_entry(index[(size_t)found[i]]);
+
+        std::cout << "\n";
+        std::cout << "\nTransactions touching [0x" << std::hex << first << ", 0x" << last << "]: " << std::dec << found.size();
+        std::cout << "\n";
+
+        return (0);
+}
+
+int analyze_files(const char *path, unsigned int threads) {
+
+        std::vector<std::string> files, skipped;
+        if (!list_capture_files(path, &files, &skipped))
+        {
+                std::cout << "\nCould not list " << path;
+                return (-1);
+        }
+        for (size_t f = 0; f < skipped.size(); f++)
+                std::cout << "\nSkipped " << skipped[f] << ": not a .pciacq capture";
+
+        std::vector<batch_result> results;
+        batch_counts totals = analyze_batch(files, threads, &results);
+
+        size_t failed = 0;
+        for (size_t f = 0; f < results.size(); f++)
+        {
+                if (!results[f].ok)
+                {
+                        std::cout << "\nCould not read " << results[f].filename;
+                        failed++;
+                        continue;
                 }
+                std::cout << "\n" << results[f].filename << ": " << std::dec << results[f].counts.samples
+                        << " frames, " << results[f].counts.transactions << " transactions";
+                if (results[f].counts.dropped_bytes > 0)
+                        std::cout << ", " << results[f].counts.dropped_bytes << " bytes dropped";
         }
+
+        std::cout << "\n";
+        for (int c = 0; c < 16; c++)
+                if (totals.commands[c] > 0)
+                        std::cout << "\nCBE [" << std::hex << c << " = " << getMessageType(c).c_str() << "]: "
+                                << std::dec << totals.commands[c];
+        for (int t = 0; t < BATCH_TERMINATIONS; t++)
+                if (totals.terminations[t] > 0)
+                        std::cout << "\nTermination [" << getTerminationType((pci_termination)t) << "]: "
+                                << std::dec << totals.terminations[t];
+
+        std::cout << "\n";
+        std::cout << "\nFiles read: " << std::dec << (results.size() - failed) << " of " << results.size();
+        std::cout << "\nBytes dropped: " << totals.dropped_bytes;
+        std::cout << "\nTotal number of captured frames read: " << totals.samples;
+        std::cout << "\nTotal number of transactions: " << totals.transactions;
+        std::cout << "\n";
+
+        return (failed == 0 ? 0 : -1);
+}
+
+int list_catalog(const char *path, uint64_t first, size_t count, unsigned int threads) {
+
+        capture_catalog catalog;
+        if (!catalog.open(path, threads))
+        {
+                std::cout << "\nCould not list " << path;
+                return (-1);
+        }
+        for (size_t f = 0; f < catalog.skipped().size(); f++)
+                std::cout << "\nSkipped " << catalog.skipped()[f] << ": not a .pciacq capture";
+        for (size_t f = 0; f < catalog.files(); f++)
+                if (!catalog.file(f).ok)
+                        std::cout << "\nCould not index " << catalog.file(f).filename;
+
+        std::vector<catalog_transaction> page;
+        catalog.read(first, count, &page);
+
+        std::cout << "\n";
+        for (size_t i = 0; i < page.size(); i++)
+        {
+                std::cout << "\n#" << std::dec << page[i].position << " " << catalog.file(page[i].file).filename
+                        << " @ frame " << page[i].sample;
+                print_entry(page[i].entry);
+        }
+
+        std::cout << "\n";
+        std::cout << "\nFiles: " << std::dec << catalog.files();
+        std::cout << "\nTotal number of captured frames read: " << catalog.samples();
+        std::cout << "\nTotal number of transactions: " << catalog.size();
         std::cout << "\n";
 
         return (0);
 }
 
+int show_frames(const char *filename, uint64_t first, size_t count) {
+
+        // only the runs are loaded; the frames shown are expanded from them
+        stream_capture capture;
+        if (!capture.open(filename))
+        {
+                std::cout << "\nCould not open " << filename << " as a stream capture";
+                return (-1);
+        }
+
+        transaction_printer printer;
+        printer.has_trigger = find_trigger(filename, &printer.trigger_entry, &printer.trigger);
+        for (uint64_t i = first; i < first + count && i < capture.samples(); i++)
+        {
+                pci_frame frame_cap = capture.frame(i);
+                std::cout << "\nFrame #: " << std::dec << i;
+                if (printer.has_trigger && i == printer.trigger)
+                        std::cout << " <- Trigger";
+                dump_pci_frame(&frame_cap);
+        }
+
+        print_trigger(printer);
+        std::cout << "\n";
+        std::cout << "\nRuns stored: " << std::dec << capture.runs();
+        std::cout << "\nTotal number of captured frames read: " << capture.samples();
+        std::cout << "\n";
+
+        return (0);
+}
+
+static bool write_sink(const unsigned char *buffer, size_t size, void *context)
+{
+        return fwrite(buffer, 1, size, (FILE *)context) == size;
+}
+
+int trigger_file(const char *filename, const char *expression, size_t pre, size_t post,
+        const char *output_filename) {
+
+        trigger_expression trigger;
+        std::string error;
+        if (!trigger.compile(expression, &error))
+        {
+                std::cout << "\nBad trigger expression: " << error;
+                return (-1);
+        }
+
+        capture_file capture;
+        if (!capture.open(filename))
+        {
+                std::cout << "\nCould not open " << filename;
+                return (-1);
+        }
+        FILE *output = NULL;
+        if (output_filename != NULL && (output = fopen(output_filename, "wb")) == NULL)
+        {
+                std::cout << "\nCould not create " << output_filename;
+                return (-1);
+        }
+
+        uint64_t records_offset = 0;
+        bool stream = is_stream_capture(filename, &records_offset);
+        soft_trigger filter(trigger, pre, post);
+        filter.set_stream(stream);
+        if (output != NULL)
+                filter.set_sink(write_sink, output);
+        const unsigned char *records;
+        size_t count;
+        bool ok = true;
+        // .pciacq samples go out as stream records, with the gaps marked
+        if (!stream && output != NULL)
+                ok = write_sink((const unsigned char *)PCISTR_MAGIC, PCI_RECORD_SIZE, output);
+        while (ok && (count = capture.next(&records)) > 0)
+        {
+                // the .pcistr magic goes straight to the output
+                if (records_offset > 0)
+                {
+                        if (output != NULL)
+                                ok = write_sink(records, PCI_RECORD_SIZE, output);
+                        records += PCI_RECORD_SIZE;
+                        count--;
+                        records_offset = 0;
+                }
+                if (ok && count > 0)
+                        ok = filter.push(records, count * PCI_RECORD_SIZE);
+        }
+        if (ok)
+                ok = filter.finish();
+        if (capture.failed())
+        {
+                std::cout << "\nCould not read " << filename;
+                ok = false;
+        }
+        if (output != NULL && fclose(output) != 0)
+                ok = false;
+
+        const soft_trigger_stats &stats = filter.stats();
+        std::cout << "\nTrigger terms: " << std::dec << trigger.terms().size();
+        std::cout << "\nFrames read: " << stats.samples;
+        std::cout << "\nHits: " << stats.hits;
+        std::cout << "\nWindows: " << stats.windows;
+        std::cout << "\nFrames kept: " << stats.kept;
+        if (capture.tail_bytes() > 0)
+                std::cout << "\nBytes dropped: " << capture.tail_bytes();
+        std::cout << "\n";
+
+        return ok ? (0) : (-1);
+}
+
 std::string getMessageType(int cbe)
 {
         std::string messageType;
@@ -141,7 +414,7 @@ std::string getMessageType(int cbe)
                 messageType = "Memory Write and Invalidate";
                 break;
         default:
-                messageType = "Unknown: " + cbe;
+                messageType = "Unknown: " + std::to_string(cbe);
                 break;
         }
         return messageType;
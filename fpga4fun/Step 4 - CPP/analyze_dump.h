@@ -1,3 +1,10 @@
+#pragma once
+
+#include <stdint.h>
+#include <string>
+
+class record_ring;
+
 
 typedef struct PCI_Transaction
 {
@@ -20,4 +27,30 @@ typedef struct PCI_Transaction
 void show_menu();
 void dump_pci_frame (pci_frame *frame_cap);
 std::string getMessageType(int cbe);
-int analyze_file(const char *filename);
\ No newline at end of file
+// threads > 1 decodes transactions on that many threads, with the same output.
+// A RAM_LA dump with a .pcitrg (see trigger_sequencer.h) has the transaction
+// of its trigger marked, and the frame of the trigger printed.
+int analyze_file(const char *filename, unsigned int threads = 1);
+// Same for records handed over live through ring, until the producer closes it
+int analyze_ring(record_ring *ring);
+// List the transactions of a capture from its .pciidx index, building the index if needed
+int list_file(const char *filename, unsigned int threads = 1);
+// List the transactions whose bursts touch any byte of [first, last], using the
+// .pciadr address index next to the capture
+int find_file(const char *filename, uint32_t first, uint32_t last, unsigned int threads = 1);
+// Decode every .pciacq file in a directory, or every file named in a list
+// file, on up to threads threads; prints a line per file and the totals
+int analyze_files(const char *path, unsigned int threads = 1);
+// Page through the transactions of all captures of a directory (or list
+// file) as one timeline: count of them, from timeline position first
+int list_catalog(const char *path, uint64_t first, size_t count = 100, unsigned int threads = 1);
+// Show frames [first, first + count) of a stream capture (a .pcistr file, or a
+// RAM_LA dump of a board built with RLE_CAPTURE), expanding only those; the
+// frame of the trigger is marked as in analyze_file()
+int show_frames(const char *filename, uint64_t first, size_t count = 16);
+// Run a capture through the software trigger (soft_trigger.h) as if it were
+// streamed: count the hits of expression, and write the pre samples before
+// and post after each to output_filename if not NULL, as a .pcistr with the
+// skipped cycles in status records
+int trigger_file(const char *filename, const char *expression, size_t pre, size_t post,
+	const char *output_filename = NULL);
@@ -0,0 +1,332 @@
+#include <stdio.h>
+#include <string.h>
+#include <algorithm>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#include "batch_analyze.h"
+#include "capture_decode.h"
+#include "parallel_decoder.h"
+#include "io_ring.h"
+
+batch_counts::batch_counts()
+	: samples(0), transactions(0), dropped_bytes(0)
+{
+	memset(commands, 0, sizeof(commands));
+	memset(terminations, 0, sizeof(terminations));
+}
+
+void batch_counts::add(const batch_counts &other)
+{
+	samples += other.samples;
+	transactions += other.transactions;
+	dropped_bytes += other.dropped_bytes;
+	for (int c = 0; c < 16; c++)
+		commands[c] += other.commands[c];
+	for (int t = 0; t < BATCH_TERMINATIONS; t++)
+		terminations[t] += other.terminations[t];
+}
+
+static bool has_extension(const std::string &name, const char *extension)
+{
+	size_t length = strlen(extension);
+	return name.size() > length && name.compare(name.size() - length, length, extension) == 0;
+}
+
+// A capture is named with .pciacq anywhere in it, as view-file.pl takes
+// them ("PCI_LA.pciacq.FIFO-Write-100-103", "capture.00000003.pciacq"); its
+// side files add another .pci* extension to that name (.pciidx, .pciadr, ...)
+static bool is_side_file(const std::string &name)
+{
+	size_t dot = name.find_last_of('.');
+	return dot != std::string::npos && name.compare(dot, 4, ".pci") == 0 && !has_extension(name, ".pciacq");
+}
+
+static void list_name(const std::string &directory, const std::string &name, std::vector<std::string> *files,
+	std::vector<std::string> *skipped)
+{
+	if (name.find(".pciacq") == std::string::npos) {
+		if (skipped != NULL)
+			skipped->push_back(directory + name);
+	} else if (!is_side_file(name)) {
+		files->push_back(directory + name);
+	}
+}
+
+static bool list_directory(const char *path, std::vector<std::string> *files, std::vector<std::string> *skipped)
+{
+	std::string directory(path);
+	if (!directory.empty() && directory[directory.size() - 1] != '/' && directory[directory.size() - 1] != '\\')
+		directory += '/';
+	size_t first = files->size();
+
+#ifdef _WIN32
+	WIN32_FIND_DATAA found;
+	HANDLE search = FindFirstFileA((directory + "*").c_str(), &found);
+	if (search == INVALID_HANDLE_VALUE)
+		return GetLastError() == ERROR_FILE_NOT_FOUND;
+	do {
+		if (!(found.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY))
+			list_name(directory, found.cFileName, files, skipped);
+	} while (FindNextFileA(search, &found));
+	FindClose(search);
+#else
+	DIR *dir = opendir(path);
+	if (dir == NULL)
+		return false;
+	while (dirent *entry = readdir(dir)) {
+		std::string name(entry->d_name);
+		struct stat info;
+		if (stat((directory + name).c_str(), &info) == 0 && S_ISREG(info.st_mode))
+			list_name(directory, name, files, skipped);
+	}
+	closedir(dir);
+#endif
+	// the order of a directory listing means nothing
+	std::sort(files->begin() + first, files->end());
+	if (skipped != NULL)
+		std::sort(skipped->begin(), skipped->end());
+	return true;
+}
+
+static bool is_directory(const char *path)
+{
+#ifdef _WIN32
+	DWORD attributes = GetFileAttributesA(path);
+	return attributes != INVALID_FILE_ATTRIBUTES && (attributes & FILE_ATTRIBUTE_DIRECTORY);
+#else
+	struct stat info;
+	return stat(path, &info) == 0 && S_ISDIR(info.st_mode);
+#endif
+}
+
+bool list_capture_files(const char *path, std::vector<std::string> *files, std::vector<std::string> *skipped)
+{
+	if (is_directory(path))
+		return list_directory(path, files, skipped);
+
+	FILE *list = fopen(path, "r");
+	if (list == NULL)
+		return false;
+	char line[4096];
+	while (fgets(line, sizeof(line), list) != NULL) {
+		size_t length = strlen(line);
+		while (length > 0 && (line[length - 1] == '\n' || line[length - 1] == '\r'))
+			line[--length] = '\0';
+		if (length > 0)
+			files->push_back(line);
+	}
+	fclose(list);
+	return true;
+}
+
+static void count_transaction(const pci_transaction &transaction, void *context)
+{
+	batch_counts *counts = static_cast<batch_counts *>(context);
+	counts->transactions++;
+	counts->commands[transaction.command & 0xF]++;
+	counts->terminations[transaction.termination]++;
+}
+
+static void decode_file(const unsigned char *data, size_t size, batch_result *result)
+{
+	framing_report framing;
+	decode_buffer(data, size, count_transaction, &result->counts, &framing, &result->counts.samples);
+	result->counts.dropped_bytes = framing.dropped_bytes;
+	result->ok = true;
+}
+
+struct batch_job
+{
+	const std::vector<std::string> *files;
+	std::vector<batch_result> *results;
+	unsigned int threads;
+};
+
+// One file after the other, with plain reads
+static void read_files(batch_job *job, size_t first)
+{
+	std::vector<unsigned char> data;
+	for (size_t f = first; f < job->files->size(); f += job->threads) {
+		if ((*job->results)[f].ok)
+			continue;
+		FILE *file = fopen((*job->files)[f].c_str(), "rb");
+		if (file == NULL)
+			continue;
+		size_t size = 0;
+		for (;;) {
+			if (data.size() < size + BATCH_READ_SIZE)
+				data.resize(size + BATCH_READ_SIZE);
+			size_t n = fread(&data[size], 1, BATCH_READ_SIZE, file);
+			size += n;
+			if (n < BATCH_READ_SIZE)
+				break;
+		}
+		bool ok = !ferror(file);
+		fclose(file);
+		if (ok)
+			decode_file(data.data(), size, &(*job->results)[f]);
+	}
+}
+
+#ifndef _WIN32
+
+enum batch_slot_state
+{
+	BATCH_SLOT_FREE,
+	BATCH_SLOT_OPENING,
+	BATCH_SLOT_READING,
+	BATCH_SLOT_CLOSING
+};
+
+struct batch_slot
+{
+	batch_slot_state state;
+	size_t file;
+	int fd;
+	std::vector<unsigned char> data;
+	size_t size;		// bytes read so far
+	unsigned int asked;	// bytes asked for by the read in flight
+};
+
+// An io_uring operation the kernel does not have (OPENAT and READ came in 5.6)
+static bool unsupported(int result)
+{
+	return result == -EINVAL || result == -EOPNOTSUPP;
+}
+
+// Up to BATCH_QUEUE_DEPTH files at once, every one a chain of openat, reads
+// and close on io_uring; a file is decoded as soon as it is all read.
+// False if the ring stopped working or lacks an operation, with the files
+// it could not read left for read_files().
+static bool ring_files(io_ring &ring, batch_job *job, size_t first)
+{
+	std::vector<batch_slot> slots(BATCH_QUEUE_DEPTH);
+	for (size_t s = 0; s < slots.size(); s++)
+		slots[s].state = BATCH_SLOT_FREE;
+	size_t next = first;
+	size_t busy = 0;
+	bool fall_back = false;		// stop opening, read_files() does the rest
+
+	for (;;) {
+		for (size_t s = 0; s < slots.size() && next < job->files->size() && !fall_back; s++) {
+			if (slots[s].state != BATCH_SLOT_FREE)
+				continue;
+			if (!ring.prepare_openat((*job->files)[next].c_str(), O_RDONLY, 0, s))
+				break;
+			slots[s].state = BATCH_SLOT_OPENING;
+			slots[s].file = next;
+			next += job->threads;
+			busy++;
+		}
+		if (busy == 0)
+			return !fall_back;
+		if (!ring.submit(1)) {
+			for (size_t s = 0; s < slots.size(); s++)
+				if (slots[s].state == BATCH_SLOT_READING)
+					::close(slots[s].fd);
+			return false;
+		}
+
+		uint64_t user;
+		int result;
+		while (ring.next_completion(&user, &result)) {
+			batch_slot &slot = slots[user];
+			switch (slot.state) {
+			case BATCH_SLOT_OPENING:
+				if (result < 0) {
+					// left as not ok; tried again by read_files() if io_uring was the problem
+					if (unsupported(result))
+						fall_back = true;
+					break;
+				}
+				slot.fd = result;
+				slot.size = 0;
+				slot.asked = BATCH_READ_SIZE;
+				if (slot.data.size() < BATCH_READ_SIZE)
+					slot.data.resize(BATCH_READ_SIZE);
+				slot.state = BATCH_SLOT_READING;
+				if (ring.prepare_read(slot.fd, slot.data.data(), slot.asked, 0, user))
+					continue;
+				::close(slot.fd);
+				fall_back = true;
+				break;
+			case BATCH_SLOT_READING:
+				if (result > 0)
+					slot.size += (size_t)result;
+				if (result == (int)slot.asked) {
+					// maybe more: read on into a bigger buffer
+					if (slot.data.size() < slot.size + BATCH_READ_SIZE)
+						slot.data.resize(slot.data.size() * 2);
+					slot.asked = (unsigned int)std::min<size_t>(slot.data.size() - slot.size, 0x40000000);
+					if (ring.prepare_read(slot.fd, &slot.data[slot.size], slot.asked, slot.size, user))
+						continue;
+					result = -EAGAIN;
+					fall_back = true;
+				}
+				if (result >= 0)
+					decode_file(slot.data.data(), slot.size, &(*job->results)[slot.file]);
+				else if (unsupported(result))
+					fall_back = true;
+				slot.state = BATCH_SLOT_CLOSING;
+				if (ring.prepare_close(slot.fd, user))
+					continue;
+				::close(slot.fd);
+				break;
+			default:
+				break;
+			}
+			slot.state = BATCH_SLOT_FREE;
+			busy--;
+		}
+	}
+}
+
+#endif
+
+static void batch_worker(size_t item, void *context)
+{
+	batch_job *job = static_cast<batch_job *>(context);
+#ifndef _WIN32
+	// a queue per thread: the rings share nothing
+	io_ring ring;
+	if (ring.open(BATCH_QUEUE_DEPTH)) {
+		if (ring_files(ring, job, item))
+			return;
+		// the files decoded so far stand; read_files() does the rest
+	}
+#endif
+	read_files(job, item);
+}
+
+batch_counts analyze_batch(const std::vector<std::string> &files, unsigned int threads, std::vector<batch_result> *results)
+{
+	results->assign(files.size(), batch_result());
+	for (size_t f = 0; f < files.size(); f++) {
+		(*results)[f].filename = files[f];
+		(*results)[f].ok = false;
+	}
+
+	if (threads < 1)
+		threads = 1;
+	if (threads > files.size())
+		threads = (unsigned int)std::max<size_t>(files.size(), 1);
+
+	// thread t takes files t, t + threads, ...
+	batch_job job = { &files, results, threads };
+	run_workers(threads, threads, batch_worker, &job);
+
+	batch_counts totals;
+	for (size_t f = 0; f < results->size(); f++)
+		if ((*results)[f].ok)
+			totals.add((*results)[f].counts);
+	return totals;
+}
@@ -0,0 +1,47 @@
+#pragma once
+
+// Batch analysis of many small captures (the 16KB .pciacq dumps).
+// With that many files, opening and reading them costs more than decoding,
+// so on Linux each worker thread keeps BATCH_QUEUE_DEPTH files moving
+// through io_uring at once (open, read, close) and decodes every file as
+// soon as its last read completes. Elsewhere, or when io_uring is not
+// available, the workers read the files one at a time with plain calls.
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+#include "transaction_decoder.h"
+
+#define BATCH_QUEUE_DEPTH 64
+#define BATCH_READ_SIZE (64*1024)
+#define BATCH_TERMINATIONS (PCI_TERM_INCOMPLETE + 1)
+
+struct batch_counts
+{
+	uint64_t samples;
+	uint64_t transactions;
+	uint64_t dropped_bytes;		// bad framing
+	uint64_t commands[16];		// transactions by command
+	uint64_t terminations[BATCH_TERMINATIONS];
+
+	batch_counts();
+	void add(const batch_counts &other);
+};
+
+struct batch_result
+{
+	std::string filename;
+	bool ok;			// the file could be read
+	batch_counts counts;
+};
+
+// The captures in a directory, named with .pciacq anywhere in the name but
+// without the side files (.pciidx, ...) made for them, or the lines of a
+// list file. The other files of the directory go to *skipped, if not NULL.
+bool list_capture_files(const char *path, std::vector<std::string> *files,
+	std::vector<std::string> *skipped = NULL);
+
+// Decode every file on up to threads threads; results are in files order.
+// Returns the totals over the files that could be read.
+batch_counts analyze_batch(const std::vector<std::string> &files, unsigned int threads, std::vector<batch_result> *results);
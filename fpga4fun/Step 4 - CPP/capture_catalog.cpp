@@ -0,0 +1,180 @@
+#include <algorithm>
+
+#include "capture_catalog.h"
+#include "batch_analyze.h"
+#include "parallel_decoder.h"
+
+capture_catalog::capture_catalog()
+	: total_transactions(0), total_samples(0), uses(0)
+{
+	for (int i = 0; i < CATALOG_OPEN_INDEXES; i++) {
+		index_file[i] = (size_t)-1;
+		index_used[i] = 0;
+	}
+}
+
+struct catalog_job
+{
+	std::vector<catalog_file> *catalog;
+	unsigned int threads;	// per file
+};
+
+static void index_file_worker(size_t item, void *context)
+{
+	catalog_job *job = static_cast<catalog_job *>(context);
+	catalog_file &file = (*job->catalog)[item];
+
+	capture_index index;
+	file.ok = index.open(file.filename.c_str(), job->threads);
+	if (file.ok) {
+		file.samples = index.samples();
+		file.transactions = index.size();
+	}
+}
+
+bool capture_catalog::open(const char *path, unsigned int threads)
+{
+	close();
+
+	std::vector<std::string> filenames;
+	if (!list_capture_files(path, &filenames, &skipped_files))
+		return false;
+
+	catalog.resize(filenames.size());
+	for (size_t f = 0; f < filenames.size(); f++) {
+		catalog[f].filename = filenames[f];
+		catalog[f].ok = false;
+		catalog[f].samples = 0;
+		catalog[f].transactions = 0;
+	}
+
+	// a file per thread; with fewer files than threads, each file is
+	// decoded on several
+	if (threads < 1)
+		threads = 1;
+	catalog_job job = { &catalog, 1 };
+	if (!catalog.empty() && catalog.size() < threads)
+		job.threads = threads / (unsigned int)catalog.size();
+	run_workers(threads, catalog.size(), index_file_worker, &job);
+
+	for (size_t f = 0; f < catalog.size(); f++) {
+		catalog[f].first_sample = total_samples;
+		catalog[f].first_transaction = total_transactions;
+		total_samples += catalog[f].samples;
+		total_transactions += catalog[f].transactions;
+	}
+	return true;
+}
+
+void capture_catalog::close()
+{
+	for (int i = 0; i < CATALOG_OPEN_INDEXES; i++) {
+		indexes[i].close();
+		index_file[i] = (size_t)-1;
+		index_used[i] = 0;
+	}
+	catalog.clear();
+	skipped_files.clear();
+	total_transactions = 0;
+	total_samples = 0;
+	uses = 0;
+}
+
+// The file holding a timeline position below size()
+size_t capture_catalog::file_of_transaction(uint64_t position) const
+{
+	// last file starting at or before position; empty files start where
+	// the next one does, and are skipped
+	size_t low = 0, high = catalog.size();
+	while (low < high) {
+		size_t middle = low + (high - low) / 2;
+		if (catalog[middle].first_transaction <= position)
+			low = middle + 1;
+		else
+			high = middle;
+	}
+	return low - 1;
+}
+
+const capture_index *capture_catalog::index_of(size_t f)
+{
+	uses++;
+	int slot = 0;
+	for (int i = 0; i < CATALOG_OPEN_INDEXES; i++) {
+		if (index_file[i] == f) {
+			index_used[i] = uses;
+			return &indexes[i];
+		}
+		if (index_used[i] < index_used[slot])
+			slot = i;
+	}
+
+	indexes[slot].close();
+	index_file[slot] = (size_t)-1;
+	index_used[slot] = 0;
+	// an index that had to be rebuilt belongs to a capture changed since
+	// open(), which no longer matches the catalog
+	if (!indexes[slot].open(catalog[f].filename.c_str(), 1) || indexes[slot].rebuilt()
+		|| indexes[slot].size() != catalog[f].transactions) {
+		indexes[slot].close();
+		return NULL;
+	}
+	index_file[slot] = f;
+	index_used[slot] = uses;
+	return &indexes[slot];
+}
+
+size_t capture_catalog::read(uint64_t first, size_t count, std::vector<catalog_transaction> *page)
+{
+	page->clear();
+	if (first >= total_transactions)
+		return 0;
+	if (count > total_transactions - first)
+		count = (size_t)(total_transactions - first);
+
+	size_t f = file_of_transaction(first);
+	uint64_t i = first - catalog[f].first_transaction;
+	while (page->size() < count) {
+		if (i == catalog[f].transactions) {
+			f++;
+			i = 0;
+			continue;
+		}
+		const capture_index *index = index_of(f);
+		if (index == NULL)
+			break;
+		for (; i < catalog[f].transactions && page->size() < count; i++) {
+			catalog_transaction t;
+			t.entry = (*index)[(size_t)i];
+			t.position = catalog[f].first_transaction + i;
+			t.file = (uint32_t)f;
+			t.index = i;
+			t.sample = catalog[f].first_sample + t.entry.start;
+			page->push_back(t);
+		}
+	}
+	return page->size();
+}
+
+static bool entry_before(const pciidx_entry &entry, uint64_t start)
+{
+	return entry.start < start;
+}
+
+uint64_t capture_catalog::find_sample(uint64_t sample)
+{
+	for (size_t f = 0; f < catalog.size(); f++) {
+		if (sample >= catalog[f].first_sample + catalog[f].samples || catalog[f].transactions == 0)
+			continue;
+		uint64_t start = sample > catalog[f].first_sample ? sample - catalog[f].first_sample : 0;
+		const capture_index *index = index_of(f);
+		if (index == NULL)
+			return catalog[f].first_transaction;
+		const pciidx_entry *begin = index->entries();
+		const pciidx_entry *end = begin + index->size();
+		const pciidx_entry *found = std::lower_bound(begin, end, start, entry_before);
+		if (found != end)
+			return catalog[f].first_transaction + (uint64_t)(found - begin);
+	}
+	return total_transactions;
+}
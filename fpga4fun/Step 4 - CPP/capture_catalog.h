@@ -0,0 +1,77 @@
+#pragma once
+
+// Catalog of many captures seen as one timeline.
+// open() indexes every capture of a directory (or list file) in parallel,
+// building the .pciidx files that are missing or stale, and keeps only the
+// transaction and sample counts of each. The merged timeline is the files in
+// name order (so "capture.00000000.pciacq", "capture.00000001.pciacq", ...
+// follow each other), each in sample order. Pages of it are read straight from the
+// index files, with only the last CATALOG_OPEN_INDEXES of them mapped, so a
+// catalog of hundreds of millions of transactions costs a few counts per
+// file in memory.
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+#include "capture_index.h"
+
+#define CATALOG_OPEN_INDEXES 8
+
+struct catalog_file
+{
+	std::string filename;
+	bool ok;			// indexed; a file that is not stays in the catalog, empty
+	uint64_t samples;
+	uint64_t transactions;
+	uint64_t first_sample;		// timeline position of its first sample
+	uint64_t first_transaction;	// and of its first transaction
+};
+
+struct catalog_transaction
+{
+	uint64_t position;		// in the timeline
+	uint32_t file;			// provenance: catalog file and
+	uint64_t index;			// transaction number within it
+	uint64_t sample;		// timeline sample of the address phase
+	pciidx_entry entry;		// entry.start is the sample within the file
+};
+
+class capture_catalog
+{
+public:
+	capture_catalog();
+
+	bool open(const char *path, unsigned int threads = 1);
+	void close();
+
+	size_t files() const { return catalog.size(); }
+	const catalog_file &file(size_t f) const { return catalog[f]; }
+	// The other files of the directory, left out of the catalog
+	const std::vector<std::string> &skipped() const { return skipped_files; }
+	uint64_t size() const { return total_transactions; }
+	uint64_t samples() const { return total_samples; }
+
+	// Copy up to count transactions from timeline position first into *page;
+	// returns how many. Fewer than asked also when an index cannot be
+	// reopened, e.g. because its capture changed since open().
+	size_t read(uint64_t first, size_t count, std::vector<catalog_transaction> *page);
+	// Timeline position of the first transaction at or after a timeline sample
+	uint64_t find_sample(uint64_t sample);
+
+private:
+	size_t file_of_transaction(uint64_t position) const;
+	const capture_index *index_of(size_t f);
+
+	std::vector<catalog_file> catalog;
+	std::vector<std::string> skipped_files;
+	uint64_t total_transactions;
+	uint64_t total_samples;
+
+	// the mapped indexes, least recently used first out
+	capture_index indexes[CATALOG_OPEN_INDEXES];
+	size_t index_file[CATALOG_OPEN_INDEXES];
+	uint64_t index_used[CATALOG_OPEN_INDEXES];
+	uint64_t uses;
+};
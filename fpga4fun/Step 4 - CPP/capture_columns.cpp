@@ -0,0 +1,311 @@
+#include <string.h>
+
+#include "capture_columns.h"
+#include "pci_capture.h"
+#include "framing_check.h"
+#include "capture_stream.h"
+#include "sample_predicate.h"
+
+// Records written per fwrite when converting back to .pciacq
+#define PCICOL_EXPAND_BATCH 4096
+
+// Bytes of a chunk's columns, padded so the next AD column stays aligned
+static uint64_t chunk_bytes(uint32_t samples)
+{
+	uint64_t bytes = (uint64_t)samples * (sizeof(uint32_t) + sizeof(uint16_t) + sizeof(uint8_t));
+	return (bytes + 7) & ~(uint64_t)7;
+}
+
+static bool address_phase(uint16_t prev, uint16_t ctrl)
+{
+	return (prev & PCI_CTRL_FRAMEn) && !(ctrl & PCI_CTRL_FRAMEn);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+col_writer::col_writer()
+	: F(NULL), failed(false), prev_ctrl(PCI_CTRL_UNKNOWN)
+{
+	memset(&header, 0, sizeof(header));
+}
+
+col_writer::~col_writer()
+{
+	if (F != NULL)
+		close();
+}
+
+bool col_writer::open(const char *filename)
+{
+	F = fopen(filename, "wb");
+	if (F == NULL)
+		return false;
+
+	memset(&header, 0, sizeof(header));
+	memcpy(header.magic, PCICOL_MAGIC, sizeof(header.magic));
+	header.version = PCICOL_VERSION;
+	header.chunk_samples = PCICOL_CHUNK_SAMPLES;
+	header.directory_offset = sizeof(header);
+	directory.clear();
+	ad.clear();
+	cbe.clear();
+	ctrl.clear();
+	ad.reserve(PCICOL_CHUNK_SAMPLES);
+	cbe.reserve(PCICOL_CHUNK_SAMPLES);
+	ctrl.reserve(PCICOL_CHUNK_SAMPLES);
+	prev_ctrl = PCI_CTRL_UNKNOWN;
+
+	// the real header is written by close()
+	failed = fwrite(&header, sizeof(header), 1, F) != 1;
+	return !failed;
+}
+
+void col_writer::push(const uint32_t *ad_in, const uint8_t *cbe_in, const uint16_t *ctrl_in, size_t count)
+{
+	while (count > 0) {
+		size_t n = PCICOL_CHUNK_SAMPLES - ad.size();
+		if (n > count)
+			n = count;
+		ad.insert(ad.end(), ad_in, ad_in + n);
+		cbe.insert(cbe.end(), cbe_in, cbe_in + n);
+		ctrl.insert(ctrl.end(), ctrl_in, ctrl_in + n);
+		ad_in += n;
+		cbe_in += n;
+		ctrl_in += n;
+		count -= n;
+		header.samples += n;
+
+		if (ad.size() == PCICOL_CHUNK_SAMPLES)
+			end_chunk();
+	}
+}
+
+void col_writer::end_chunk()
+{
+	if (ad.empty())
+		return;
+
+	pcicol_chunk_header chunk;
+	memset(&chunk, 0, sizeof(chunk));
+	chunk.offset = header.directory_offset;
+	chunk.first_sample = header.samples - ad.size();
+	chunk.samples = (uint32_t)ad.size();
+	chunk.ad_min = 0xFFFFFFFF;
+	chunk.address_min = 0xFFFFFFFF;
+
+	uint16_t prev = prev_ctrl;
+	for (size_t i = 0; i < ad.size(); i++) {
+		if (ad[i] < chunk.ad_min)
+			chunk.ad_min = ad[i];
+		if (ad[i] > chunk.ad_max)
+			chunk.ad_max = ad[i];
+		chunk.cbe_seen |= (uint16_t)(1 << (cbe[i] & 0x0F));
+		if (!(ctrl[i] & PCI_CTRL_FRAMEn))
+			chunk.frame_asserted = 1;
+		if (address_phase(prev, ctrl[i])) {
+			if (ad[i] < chunk.address_min)
+				chunk.address_min = ad[i];
+			if (ad[i] > chunk.address_max)
+				chunk.address_max = ad[i];
+			chunk.commands_seen |= (uint16_t)(1 << (cbe[i] & 0x0F));
+		}
+		prev = ctrl[i];
+	}
+	prev_ctrl = prev;
+	directory.push_back(chunk);
+
+	static const unsigned char padding[8] = { 0 };
+	size_t written = ad.size() * (sizeof(uint32_t) + sizeof(uint16_t) + sizeof(uint8_t));
+	size_t pad = (size_t)(chunk_bytes(chunk.samples) - written);
+	if (fwrite(&ad[0], sizeof(uint32_t), ad.size(), F) != ad.size()
+		|| fwrite(&ctrl[0], sizeof(uint16_t), ctrl.size(), F) != ctrl.size()
+		|| fwrite(&cbe[0], sizeof(uint8_t), cbe.size(), F) != cbe.size()
+		|| (pad > 0 && fwrite(padding, 1, pad, F) != pad))
+		failed = true;
+	header.directory_offset += chunk_bytes(chunk.samples);
+
+	ad.clear();
+	cbe.clear();
+	ctrl.clear();
+}
+
+bool col_writer::close()
+{
+	end_chunk();
+
+	header.chunks = directory.size();
+	if (!directory.empty() && fwrite(&directory[0], sizeof(pcicol_chunk_header), directory.size(), F) != directory.size())
+		failed = true;
+	if (fseek(F, 0, SEEK_SET) != 0 || fwrite(&header, sizeof(header), 1, F) != 1)
+		failed = true;
+	if (fclose(F) != 0)
+		failed = true;
+	F = NULL;
+	return !failed;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+bool col_capture::open(const char *filename)
+{
+	if (!file.open(filename))
+		return false;
+
+	const pcicol_header *h = header();
+	if (file.size() < sizeof(pcicol_header) || memcmp(h->magic, PCICOL_MAGIC, sizeof(h->magic)) != 0
+		|| h->version != PCICOL_VERSION || h->chunk_samples == 0
+		|| h->directory_offset > file.size()
+		|| (file.size() - h->directory_offset) / sizeof(pcicol_chunk_header) < h->chunks) {
+		file.close();
+		return false;
+	}
+	for (size_t c = 0; c < chunks(); c++) {
+		if (chunk(c).samples > h->chunk_samples || (chunk(c).offset & 7) != 0
+			|| chunk(c).offset + chunk_bytes(chunk(c).samples) > h->directory_offset) {
+			file.close();
+			return false;
+		}
+	}
+	return true;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+void query_address_phases(const col_capture &capture, const pcicol_query &query, std::vector<uint64_t> *found,
+	pcicol_query_stats *stats)
+{
+	// every matching address lies in [address_value, address_value | ~address_mask]
+	uint32_t low = query.address_value & query.address_mask;
+	uint32_t high = low | ~query.address_mask;
+	memset(stats, 0, sizeof(*stats));
+
+	for (size_t c = 0; c < capture.chunks(); c++) {
+		const pcicol_chunk_header &chunk = capture.chunk(c);
+		// an idle chunk first, then one without the commands or addresses
+		if (!chunk.frame_asserted || (chunk.commands_seen & query.commands) == 0
+			|| chunk.address_max < low || chunk.address_min > high) {
+			stats->chunks_skipped++;
+			continue;
+		}
+		stats->chunks_scanned++;
+
+		const uint32_t *ad = capture.ad(c);
+		const uint8_t *cbe = capture.cbe(c);
+		const uint16_t *ctrl = capture.control(c);
+		uint16_t prev = c > 0 && capture.chunk(c - 1).samples > 0 ? capture.control(c - 1)[capture.chunk(c - 1).samples - 1] : PCI_CTRL_UNKNOWN;
+		size_t before = found->size();
+		find_samples(falls(PCI_CTRL_FRAMEn) & commands(query.commands) & AD_mask(query.address_mask, low),
+			sample_columns(ad, cbe, ctrl, prev), chunk.samples, chunk.first_sample, found);
+		stats->matches += found->size() - before;
+	}
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+bool is_col_capture(const char *filename)
+{
+	char magic[8];
+	FILE *F = fopen(filename, "rb");
+	if (F == NULL)
+		return false;
+	bool col = fread(magic, 1, sizeof(magic), F) == sizeof(magic) && memcmp(magic, PCICOL_MAGIC, sizeof(magic)) == 0;
+	fclose(F);
+	return col;
+}
+
+static void push_col_samples(const pci_capture &samples, void *context)
+{
+	static_cast<col_writer *>(context)->push(samples.ad_column(), samples.cbe_column(), samples.control_column(), samples.size());
+}
+
+bool convert_to_columns(const char *capture_filename, const char *col_filename)
+{
+	col_writer writer;
+	if (is_stream_capture(capture_filename)) {
+		// runs and timed samples, not 0x01 0x02 records
+		stream_report report;
+		if (!writer.open(col_filename))
+			return false;
+		if (!expand_stream_capture(capture_filename, push_col_samples, &writer, &report)) {
+			writer.close();
+			return false;
+		}
+		return writer.close();
+	}
+
+	capture_file capture;
+	if (!capture.open(capture_filename))
+		return false;
+	if (!writer.open(col_filename))
+		return false;
+
+	framing_report framing;
+	pci_capture samples;
+	uint64_t offset = 0;
+	const unsigned char *records;
+	size_t count;
+	while ((count = capture.next(&records)) > 0) {
+		framing.runs.clear();
+		check_framing(records, count * PCI_RECORD_SIZE, offset, &framing);
+		samples.clear();
+		for (size_t r = 0; r < framing.runs.size(); r++)
+			samples.append_records(records + (framing.runs[r].offset - offset), (size_t)(framing.runs[r].length / PCI_RECORD_SIZE));
+		if (samples.size() > 0)
+			writer.push(samples.ad_column(), samples.cbe_column(), samples.control_column(), samples.size());
+		offset += count * PCI_RECORD_SIZE;
+	}
+	if (capture.failed()) {
+		writer.close();
+		return false;
+	}
+	return writer.close();
+}
+
+bool convert_from_columns(const char *col_filename, const char *capture_filename)
+{
+	col_capture col;
+	if (!col.open(col_filename))
+		return false;
+
+	FILE *F = fopen(capture_filename, "wb");
+	if (F == NULL)
+		return false;
+
+	bool ok = true;
+	std::vector<unsigned char> out;
+	out.reserve(PCICOL_EXPAND_BATCH * PCI_RECORD_SIZE);
+	for (size_t c = 0; c < col.chunks() && ok; c++) {
+		const uint32_t *ad = col.ad(c);
+		const uint8_t *cbe = col.cbe(c);
+		const uint16_t *ctrl = col.control(c);
+		for (uint32_t i = 0; i < col.chunk(c).samples && ok; i++) {
+			unsigned char record[PCI_RECORD_SIZE] = {
+				(unsigned char)ctrl[i], (unsigned char)(((cbe[i] & 0x0F) << 4) | ((ctrl[i] >> 8) & 0x0F)),
+				(unsigned char)ad[i], (unsigned char)(ad[i] >> 8), (unsigned char)(ad[i] >> 16), (unsigned char)(ad[i] >> 24),
+				0x01, 0x02 };
+			out.insert(out.end(), record, record + PCI_RECORD_SIZE);
+			if (out.size() >= PCICOL_EXPAND_BATCH * PCI_RECORD_SIZE) {
+				ok = fwrite(&out[0], 1, out.size(), F) == out.size();
+				out.clear();
+			}
+		}
+	}
+	if (ok && !out.empty())
+		ok = fwrite(&out[0], 1, out.size(), F) == out.size();
+	return (fclose(F) == 0) && ok;
+}
+
+bool decode_col_capture(const char *col_filename, transaction_callback callback, void *context, uint64_t *samples)
+{
+	col_capture col;
+	if (!col.open(col_filename))
+		return false;
+
+	transaction_decoder decoder(callback, context);
+	for (size_t c = 0; c < col.chunks(); c++)
+		decoder.push(col.ad(c), col.cbe(c), col.control(c), col.chunk(c).samples);
+	decoder.flush();
+
+	*samples = decoder.samples();
+	return true;
+}
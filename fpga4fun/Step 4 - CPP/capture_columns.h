@@ -0,0 +1,121 @@
+#pragma once
+
+// Columnar chunked capture format (.pcicol).
+// Samples are stored in chunks of PCICOL_CHUNK_SAMPLES, each chunk holding
+// its AD, control and CBE columns back to back. A directory at the end of
+// the file has one header per chunk with zone-map statistics, so a query can
+// skip whole chunks without touching their columns.
+// It sits next to the raw 8-byte .pciacq layout; convert_to_columns() and
+// convert_from_columns() go between the two.
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <vector>
+
+#include "capture_file.h"
+#include "transaction_decoder.h"
+
+#define PCICOL_MAGIC "PCICOL01"
+#define PCICOL_VERSION 1
+#define PCICOL_CHUNK_SAMPLES 65536
+
+struct pcicol_header
+{
+	char magic[8];
+	uint32_t version;
+	uint32_t chunk_samples;
+	uint64_t samples;
+	uint64_t chunks;
+	uint64_t directory_offset;
+};
+
+struct pcicol_chunk_header
+{
+	uint64_t offset;	// file offset of the AD column; control and CBE follow
+	uint64_t first_sample;
+	uint32_t samples;
+	uint32_t ad_min;	// AD over all cycles
+	uint32_t ad_max;
+	uint32_t address_min;	// AD in address phases only (FRAMEn falling)
+	uint32_t address_max;
+	uint16_t cbe_seen;	// bit n set: C/BE == n on some cycle
+	uint16_t commands_seen;	// bit n set: command n in some address phase
+	uint8_t frame_asserted;	// FRAMEn low on some cycle, else the bus was idle
+	uint8_t reserved[3];
+};
+
+class col_writer
+{
+public:
+	col_writer();
+	~col_writer();
+
+	bool open(const char *filename);
+	void push(const uint32_t *ad, const uint8_t *cbe, const uint16_t *ctrl, size_t count);
+	// Write the last chunk and the directory
+	bool close();
+
+private:
+	void end_chunk();
+
+	FILE *F;
+	bool failed;
+	pcicol_header header;
+	std::vector<pcicol_chunk_header> directory;
+	std::vector<uint32_t> ad;
+	std::vector<uint8_t> cbe;
+	std::vector<uint16_t> ctrl;
+	uint16_t prev_ctrl;	// last control word of the previous chunk
+};
+
+class col_capture
+{
+public:
+	bool open(const char *filename);
+	void close() { file.close(); }
+
+	uint64_t samples() const { return header()->samples; }
+	size_t chunks() const { return (size_t)header()->chunks; }
+	const pcicol_chunk_header &chunk(size_t c) const { return directory()[c]; }
+
+	// Columns of a chunk, straight from the mapping
+	const uint32_t *ad(size_t c) const { return (const uint32_t *)(file.data() + chunk(c).offset); }
+	const uint16_t *control(size_t c) const { return (const uint16_t *)(ad(c) + chunk(c).samples); }
+	const uint8_t *cbe(size_t c) const { return (const uint8_t *)(control(c) + chunk(c).samples); }
+
+private:
+	const pcicol_header *header() const { return (const pcicol_header *)file.data(); }
+	const pcicol_chunk_header *directory() const { return (const pcicol_chunk_header *)(file.data() + header()->directory_offset); }
+
+	mapped_file file;
+};
+
+// Address phases matching (address & address_mask) == address_value with a
+// command in commands (bit n for command n)
+struct pcicol_query
+{
+	uint16_t commands;
+	uint32_t address_mask;
+	uint32_t address_value;
+};
+
+struct pcicol_query_stats
+{
+	uint64_t chunks_scanned;
+	uint64_t chunks_skipped;
+	uint64_t matches;
+};
+
+// Append to *found the sample index of every matching address phase
+void query_address_phases(const col_capture &capture, const pcicol_query &query, std::vector<uint64_t> *found,
+	pcicol_query_stats *stats);
+
+bool is_col_capture(const char *filename);
+
+// Same input as compress_capture()
+bool convert_to_columns(const char *capture_filename, const char *col_filename);
+bool convert_from_columns(const char *col_filename, const char *capture_filename);
+
+// Decode the transactions of a .pcicol file, a chunk at a time
+bool decode_col_capture(const char *col_filename, transaction_callback callback, void *context, uint64_t *samples);
@@ -0,0 +1,175 @@
+#include "capture_decode.h"
+#include "capture_file.h"
+#include "pci_capture.h"
+#include "parallel_decoder.h"
+#include "capture_rle.h"
+#include "capture_columns.h"
+#include "capture_stream.h"
+#include "record_ring.h"
+
+bool decode_capture(const char *filename, unsigned int threads, transaction_callback callback, void *context,
+	framing_report *framing, uint64_t *samples_read)
+{
+	// compressed captures are decoded run by run, without expanding them
+	if (is_rle_capture(filename))
+		return decode_rle_capture(filename, callback, context, samples_read);
+	if (is_col_capture(filename))
+		return decode_col_capture(filename, callback, context, samples_read);
+	if (is_stream_capture(filename)) {
+		stream_report report;
+		if (!decode_stream_capture(filename, callback, context, &report, samples_read))
+			return false;
+		framing->dropped_bytes += report.dropped_bytes;
+		return true;
+	}
+
+	capture_file capture;
+	if (!capture.open(filename))
+		return false;
+
+	// the capture is decoded one window at a time, only the transaction
+	// in progress is kept between windows
+	transaction_decoder decoder(callback, context);
+	pci_capture samples;
+
+	// with several threads, the samples after the last sync point are
+	// kept and decoded again with the next window
+	uint64_t first = 0;
+	uint16_t prev_ctrl = PCI_CTRL_UNKNOWN;
+
+	// only decode the well-framed runs, a short USB read shifts everything after it
+	uint64_t offset = 0;
+	const unsigned char *records;
+	size_t count;
+	while ((count = capture.next(&records)) > 0) {
+		framing->runs.clear();
+		check_framing(records, count * PCI_RECORD_SIZE, offset, framing);
+		for (size_t r = 0; r < framing->runs.size(); r++)
+			samples.append_records(records + (framing->runs[r].offset - offset), (size_t)(framing->runs[r].length / PCI_RECORD_SIZE));
+
+		if (threads > 1) {
+			size_t done = decode_transactions_parallel(samples, first, prev_ctrl, false, threads, callback, context);
+			if (done > 0) {
+				prev_ctrl = samples.control(done - 1);
+				first += done;
+				samples.erase_front(done);
+			}
+		} else {
+			decoder.push(samples, 0, samples.size());
+			first += samples.size();
+			samples.clear();
+		}
+		offset += count * PCI_RECORD_SIZE;
+	}
+	framing->runs.clear();
+	if (capture.failed())
+		return false;
+	capture.report_tail(framing);
+
+	if (threads > 1) {
+		decode_transactions_parallel(samples, first, prev_ctrl, true, threads, callback, context);
+		first += samples.size();
+	} else {
+		decoder.flush();
+	}
+
+	capture.close();
+	*samples_read = first;
+	return true;
+}
+
+// Records from decode_ring(), in one format or the other
+struct ring_decoder
+{
+	transaction_decoder decoder;
+	stream_decoder stream;
+	pci_capture samples;
+	uint64_t offset;
+	bool is_stream;
+
+	ring_decoder(transaction_callback callback, void *context)
+		: decoder(callback, context), stream(callback, context), offset(0), is_stream(false) {}
+
+	void push(const unsigned char *records, size_t size, framing_report *framing)
+	{
+		if (is_stream) {
+			stream.push(records, size);
+			return;
+		}
+		framing->runs.clear();
+		check_framing(records, size, offset, framing);
+		samples.clear();
+		for (size_t r = 0; r < framing->runs.size(); r++)
+			samples.append_records(records + (framing->runs[r].offset - offset), (size_t)(framing->runs[r].length / PCI_RECORD_SIZE));
+		decoder.push(samples, 0, samples.size());
+		offset += size;
+	}
+};
+
+void decode_ring(record_ring *ring, transaction_callback callback, void *context,
+	framing_report *framing, uint64_t *samples_read)
+{
+	ring_decoder ring_records(callback, context);
+
+	// the first records tell the stream and timed records from 0x01 0x02
+	// ones; they are kept until there are enough of them
+	std::vector<unsigned char> first;
+	bool started = false;
+
+	while (ring->wait_readable()) {
+		const unsigned char *records;
+		size_t count = ring->begin_read(&records);
+		if (!started) {
+			first.insert(first.end(), records, records + count * PCI_RECORD_SIZE);
+			ring->consume(count);
+			if (first.size() < FRAMING_LOCK_RECORDS * PCI_RECORD_SIZE)
+				continue;
+			started = true;
+			size_t skip = 0;	// the .pcistr magic, in a replayed file
+			ring_records.is_stream = is_stream_data(&first[0], first.size(), &skip);
+			ring_records.push(&first[0] + skip, first.size() - skip, framing);
+			continue;
+		}
+		ring_records.push(records, count * PCI_RECORD_SIZE, framing);
+		ring->consume(count);
+	}
+	if (!started && !first.empty())
+		ring_records.push(&first[0], first.size(), framing);
+	framing->runs.clear();
+
+	if (ring_records.is_stream) {
+		ring_records.stream.finish();
+		framing->dropped_bytes += ring_records.stream.report().dropped_bytes;
+		*samples_read = ring_records.stream.samples();
+	} else {
+		ring_records.decoder.flush();
+		*samples_read = ring_records.decoder.samples();
+	}
+}
+
+void decode_buffer(const unsigned char *data, size_t size, transaction_callback callback, void *context,
+	framing_report *framing, uint64_t *samples_read)
+{
+	size_t offset;
+	if (is_stream_data(data, size, &offset)) {
+		stream_decoder decoder(callback, context);
+		decoder.push(data + offset, size - offset);
+		decoder.finish();
+		framing->dropped_bytes += decoder.report().dropped_bytes;
+		*samples_read = decoder.samples();
+		return;
+	}
+
+	transaction_decoder decoder(callback, context);
+	pci_capture samples;
+
+	framing->runs.clear();
+	check_framing(data, size, 0, framing);
+	for (size_t r = 0; r < framing->runs.size(); r++)
+		samples.append_records(data + framing->runs[r].offset, (size_t)(framing->runs[r].length / PCI_RECORD_SIZE));
+	framing->runs.clear();
+
+	decoder.push(samples, 0, samples.size());
+	decoder.flush();
+	*samples_read = decoder.samples();
+}
@@ -0,0 +1,32 @@
+#pragma once
+
+// Whole-capture decoding: read a .pciacq file window by window, check the
+// record framing, and run the transaction decoder over the good records.
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "framing_check.h"
+#include "transaction_decoder.h"
+
+class record_ring;
+
+// Decode every transaction in filename, in capture order, on threads threads
+// (see decode_transactions_parallel). The byte ranges dropped because of bad
+// framing are added to framing->dropped, and the number of samples decoded
+// is stored in *samples, as are the bytes of a partial record at the end of
+// the file. Returns false if the file cannot be opened or read.
+// .pcirle, .pcicol and .pcistr files are recognised by their magic and
+// decoded on one thread.
+bool decode_capture(const char *filename, unsigned int threads, transaction_callback callback, void *context,
+	framing_report *framing, uint64_t *samples);
+
+// Same, for records arriving through ring until it is closed, decoded on the
+// calling thread as they are published. The first records tell stream and
+// timed records (capture_stream.h) from 0x01 0x02 ones.
+void decode_ring(record_ring *ring, transaction_callback callback, void *context,
+	framing_report *framing, uint64_t *samples);
+
+// Same, for a whole capture already in memory
+void decode_buffer(const unsigned char *data, size_t size, transaction_callback callback, void *context,
+	framing_report *framing, uint64_t *samples);
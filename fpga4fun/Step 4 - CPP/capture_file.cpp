@@ -0,0 +1,339 @@
+#include <string.h>
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#ifndef _WIN32
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#endif
+
+#include "capture_file.h"
+#include "framing_check.h"
+
+capture_file::capture_file()
+	: mapped(false), file_size(0), offset(0), error(false), tail(0), window(NULL), window_size(0),
+#ifdef _WIN32
+	file_handle(INVALID_HANDLE_VALUE), mapping_handle(NULL),
+#else
+	fd(-1),
+#endif
+	stream(NULL), buffer(NULL), buffered(0), consumed(0)
+{
+}
+
+capture_file::~capture_file()
+{
+	close();
+}
+
+bool capture_file::open(const char *filename)
+{
+	close();
+
+	if (strcmp(filename, "-") != 0 && map_open(filename))
+		return true;
+
+	// not a regular file (or mapping failed), use plain reads
+	if (strcmp(filename, "-") == 0)
+		stream = stdin;
+	else
+		stream = fopen(filename, "rb");
+	if (stream == NULL)
+		return false;
+
+	buffer = new unsigned char[CAPTURE_BUFFER_SIZE];
+	return true;
+}
+
+void capture_file::close()
+{
+	unmap_window();
+#ifdef _WIN32
+	if (mapping_handle != NULL) CloseHandle(mapping_handle);
+	if (file_handle != INVALID_HANDLE_VALUE) CloseHandle(file_handle);
+	mapping_handle = NULL;
+	file_handle = INVALID_HANDLE_VALUE;
+#else
+	if (fd >= 0) ::close(fd);
+	fd = -1;
+#endif
+	if (stream != NULL && stream != stdin) fclose(stream);
+	stream = NULL;
+	delete[] buffer;
+	buffer = NULL;
+	buffered = 0;
+	consumed = 0;
+
+	mapped = false;
+	file_size = 0;
+	offset = 0;
+	error = false;
+	tail = 0;
+}
+
+size_t capture_file::next(const unsigned char **records)
+{
+	if (mapped)
+		return next_mapped(records);
+	if (stream != NULL)
+		return next_buffered(records);
+	return 0;
+}
+
+void capture_file::report_tail(framing_report *report) const
+{
+	if (tail == 0)
+		return;
+	// offset is past the records handed out when mapped, past the bytes read otherwise
+	framing_range range = { mapped ? offset : offset - tail, tail };
+	report->dropped.push_back(range);
+	report->dropped_bytes += tail;
+}
+
+#ifdef _WIN32
+
+bool capture_file::map_open(const char *filename)
+{
+	file_handle = CreateFileA(filename, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+	if (file_handle == INVALID_HANDLE_VALUE)
+		return false;
+
+	LARGE_INTEGER size;
+	if (GetFileType(file_handle) != FILE_TYPE_DISK || !GetFileSizeEx(file_handle, &size)) {
+		close();
+		return false;
+	}
+	file_size = size.QuadPart;
+	mapped = true;
+
+	// an empty file cannot be mapped, but it is a valid (empty) capture
+	if (file_size == 0)
+		return true;
+
+	mapping_handle = CreateFileMapping(file_handle, NULL, PAGE_READONLY, 0, 0, NULL);
+	if (mapping_handle == NULL) {
+		close();
+		return false;
+	}
+	return true;
+}
+
+void capture_file::unmap_window()
+{
+	if (window != NULL) UnmapViewOfFile(window);
+	window = NULL;
+	window_size = 0;
+}
+
+size_t capture_file::next_mapped(const unsigned char **records)
+{
+	unmap_window();
+
+	uint64_t remaining = file_size - offset;
+	remaining -= remaining % PCI_RECORD_SIZE;
+	if (remaining == 0) {
+		tail = file_size - offset;
+		return 0;
+	}
+
+	size_t length = remaining < CAPTURE_WINDOW_SIZE ? (size_t)remaining : CAPTURE_WINDOW_SIZE;
+	window = MapViewOfFile(mapping_handle, FILE_MAP_READ, (DWORD)(offset >> 32), (DWORD)offset, length);
+	if (window == NULL) {
+		error = true;
+		return 0;
+	}
+	window_size = length;
+	offset += length;
+
+	*records = (const unsigned char *)window;
+	return length / PCI_RECORD_SIZE;
+}
+
+#else
+
+bool capture_file::map_open(const char *filename)
+{
+	fd = ::open(filename, O_RDONLY);
+	if (fd < 0)
+		return false;
+
+	struct stat st;
+	if (fstat(fd, &st) != 0 || !S_ISREG(st.st_mode)) {
+		close();
+		return false;
+	}
+	file_size = st.st_size;
+	mapped = true;
+	return true;
+}
+
+void capture_file::unmap_window()
+{
+	if (window != NULL) munmap(window, window_size);
+	window = NULL;
+	window_size = 0;
+}
+
+size_t capture_file::next_mapped(const unsigned char **records)
+{
+	unmap_window();
+
+	uint64_t remaining = file_size - offset;
+	remaining -= remaining % PCI_RECORD_SIZE;
+	if (remaining == 0) {
+		tail = file_size - offset;
+		return 0;
+	}
+
+	size_t length = remaining < CAPTURE_WINDOW_SIZE ? (size_t)remaining : CAPTURE_WINDOW_SIZE;
+	void *p = mmap(NULL, length, PROT_READ, MAP_SHARED, fd, (off_t)offset);
+	if (p == MAP_FAILED) {
+		error = true;
+		return 0;
+	}
+	madvise(p, length, MADV_SEQUENTIAL);
+	window = p;
+	window_size = length;
+	offset += length;
+
+	*records = (const unsigned char *)window;
+	return length / PCI_RECORD_SIZE;
+}
+
+#endif
+
+size_t capture_file::next_buffered(const unsigned char **records)
+{
+	// move any partial record left from the previous read to the front
+	size_t length = buffered - consumed;
+	memmove(buffer, buffer + consumed, length);
+	while (length < CAPTURE_BUFFER_SIZE) {
+		size_t n = fread(buffer + length, 1, CAPTURE_BUFFER_SIZE - length, stream);
+		if (n == 0)
+			break;
+		length += n;
+	}
+	offset += length - (buffered - consumed);
+
+	buffered = length;
+	consumed = length - length % PCI_RECORD_SIZE;
+	if (consumed == 0) {
+		// only a partial record left: the end of the input, or an error
+		if (ferror(stream))
+			error = true;
+		else
+			tail = length;
+	}
+	*records = buffer;
+	return consumed / PCI_RECORD_SIZE;
+}
+
+mapped_file::mapped_file()
+	: view(NULL), view_size(0)
+#ifdef _WIN32
+	, file_handle(INVALID_HANDLE_VALUE), mapping_handle(NULL)
+#endif
+{
+}
+
+mapped_file::~mapped_file()
+{
+	close();
+}
+
+#ifdef _WIN32
+
+bool mapped_file::open(const char *filename)
+{
+	close();
+	file_handle = CreateFileA(filename, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, 0, NULL);
+	if (file_handle == INVALID_HANDLE_VALUE)
+		return false;
+
+	LARGE_INTEGER size;
+	if (!GetFileSizeEx(file_handle, &size) || (uint64_t)size.QuadPart > (size_t)-1) {
+		close();
+		return false;
+	}
+	view_size = (size_t)size.QuadPart;
+	if (view_size == 0)
+		return true;
+
+	mapping_handle = CreateFileMapping(file_handle, NULL, PAGE_READONLY, 0, 0, NULL);
+	if (mapping_handle != NULL)
+		view = MapViewOfFile(mapping_handle, FILE_MAP_READ, 0, 0, 0);
+	if (view == NULL) {
+		close();
+		return false;
+	}
+	return true;
+}
+
+void mapped_file::close()
+{
+	if (view != NULL) UnmapViewOfFile(view);
+	if (mapping_handle != NULL) CloseHandle(mapping_handle);
+	if (file_handle != INVALID_HANDLE_VALUE) CloseHandle(file_handle);
+	view = NULL;
+	view_size = 0;
+	mapping_handle = NULL;
+	file_handle = INVALID_HANDLE_VALUE;
+}
+
+bool file_info(const char *filename, uint64_t *size, int64_t *mtime)
+{
+	struct _stat64 st;
+	if (_stat64(filename, &st) != 0)
+		return false;
+	*size = st.st_size;
+	*mtime = st.st_mtime;
+	return true;
+}
+
+#else
+
+bool mapped_file::open(const char *filename)
+{
+	close();
+	int fd = ::open(filename, O_RDONLY);
+	if (fd < 0)
+		return false;
+
+	struct stat st;
+	if (fstat(fd, &st) != 0 || (uint64_t)st.st_size > (size_t)-1) {
+		::close(fd);
+		return false;
+	}
+	view_size = (size_t)st.st_size;
+	if (view_size > 0) {
+		void *p = mmap(NULL, view_size, PROT_READ, MAP_SHARED, fd, 0);
+		if (p == MAP_FAILED) {
+			::close(fd);
+			view_size = 0;
+			return false;
+		}
+		view = p;
+	}
+	::close(fd);
+	return true;
+}
+
+void mapped_file::close()
+{
+	if (view != NULL) munmap(view, view_size);
+	view = NULL;
+	view_size = 0;
+}
+
+bool file_info(const char *filename, uint64_t *size, int64_t *mtime)
+{
+	struct stat st;
+	if (stat(filename, &st) != 0)
+		return false;
+	*size = st.st_size;
+	*mtime = st.st_mtime;
+	return true;
+}
+
+#endif
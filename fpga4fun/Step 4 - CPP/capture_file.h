@@ -0,0 +1,108 @@
+#pragma once
+
+// Read-only access to .pciacq capture files.
+// A capture is a sequence of 8-byte records, as streamed by PCI_LogicAnalyzer.v:
+// 6 bytes of PCI signals followed by the constant bytes 0x01 0x02.
+//
+// Regular files are memory-mapped a window at a time, so captures larger than
+// RAM (or than the 32-bit address space) can be walked without copying.
+// Pipes and other non-seekable inputs fall back to buffered reads.
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#ifdef _WIN32
+#include <windows.h>
+#endif
+
+#define PCI_RECORD_SIZE 8
+
+struct framing_report;
+
+// Mapping window size, a multiple of the Windows allocation granularity (64KB)
+#define CAPTURE_WINDOW_SIZE (64*1024*1024)
+// Read buffer size used when the input cannot be mapped
+#define CAPTURE_BUFFER_SIZE (1024*1024)
+
+class capture_file
+{
+public:
+	capture_file();
+	~capture_file();
+
+	// "-" reads the capture from stdin
+	bool open(const char *filename);
+	void close();
+
+	// Get the next run of whole records. Returns the number of records
+	// available at *records, 0 at end of file. The pointer stays valid
+	// until the next call to next() or close().
+	size_t next(const unsigned char **records);
+
+	// Once next() returned 0: true if it stopped on a read or mapping
+	// error, not at the end of the file
+	bool failed() const { return error; }
+	// Once next() returned 0: the bytes at the end of the file that do not
+	// make a whole record, and were not handed out
+	uint64_t tail_bytes() const { return tail; }
+	// Same, as the dropped range of a framing report
+	void report_tail(framing_report *report) const;
+
+	// Size of the capture in bytes, 0 when reading from a stream
+	uint64_t size() const { return file_size; }
+	bool is_mapped() const { return mapped; }
+
+private:
+	bool map_open(const char *filename);
+	void unmap_window();
+	size_t next_mapped(const unsigned char **records);
+	size_t next_buffered(const unsigned char **records);
+
+	bool mapped;
+	uint64_t file_size;
+	uint64_t offset;
+	bool error;
+	uint64_t tail;
+
+	// mapped input
+	void *window;
+	size_t window_size;
+#ifdef _WIN32
+	HANDLE file_handle;
+	HANDLE mapping_handle;
+#else
+	int fd;
+#endif
+
+	// buffered input
+	FILE *stream;
+	unsigned char *buffer;
+	size_t buffered;	// bytes in buffer
+	size_t consumed;	// bytes already handed out as whole records
+};
+
+// A whole file mapped read-only, for small side files such as the .pciidx index
+class mapped_file
+{
+public:
+	mapped_file();
+	~mapped_file();
+
+	bool open(const char *filename);
+	void close();
+
+	const unsigned char *data() const { return (const unsigned char *)view; }
+	size_t size() const { return view_size; }
+
+private:
+	void *view;
+	size_t view_size;
+#ifdef _WIN32
+	HANDLE file_handle;
+	HANDLE mapping_handle;
+#endif
+};
+
+// Size and modification time of a file; returns false if it does not exist
+bool file_info(const char *filename, uint64_t *size, int64_t *mtime);
@@ -0,0 +1,171 @@
+#include <stdio.h>
+#include <string.h>
+#include <vector>
+
+#include "capture_index.h"
+#include "capture_decode.h"
+
+// Entries are written out in batches of this many
+#define PCIIDX_WRITE_BATCH 4096
+
+std::string capture_sidecar_filename(const char *capture_filename, const char *extension)
+{
+	// appended to the whole name: x.pciacq and x.pcistr, or
+	// PCI_LA.pciacq.FIFO-Write-100-103 and ...-104, keep apart
+	return std::string(capture_filename) + extension;
+}
+
+std::string capture_index_filename(const char *capture_filename)
+{
+	return capture_sidecar_filename(capture_filename, ".pciidx");
+}
+
+bool hash_capture_file(const char *filename, uint64_t *hash)
+{
+	capture_file capture;
+	if (!capture.open(filename))
+		return false;
+
+	// one multiply-rotate step per 8-byte record
+	uint64_t h = 0x9E3779B97F4A7C15ULL;
+	const unsigned char *records;
+	size_t count;
+	while ((count = capture.next(&records)) > 0) {
+		for (size_t n = 0; n < count; n++) {
+			uint64_t word;
+			memcpy(&word, records + n * PCI_RECORD_SIZE, sizeof(word));
+			h ^= word * 0xC2B2AE3D27D4EB4FULL;
+			h = ((h << 31) | (h >> 33)) * 0x9E3779B185EBCA87ULL;
+		}
+	}
+	if (capture.failed())
+		return false;
+	h ^= h >> 29;
+	*hash = h;
+	return true;
+}
+
+struct index_writer
+{
+	FILE *F;
+	std::vector<pciidx_entry> batch;
+	uint64_t entries;
+	bool failed;
+};
+
+static void flush_entries(index_writer *writer)
+{
+	if (!writer->batch.empty() && fwrite(&writer->batch[0], sizeof(pciidx_entry), writer->batch.size(), writer->F) != writer->batch.size())
+		writer->failed = true;
+	writer->batch.clear();
+}
+
+static void index_transaction(const pci_transaction &transaction, void *context)
+{
+	index_writer *writer = static_cast<index_writer *>(context);
+
+	pciidx_entry entry;
+	entry.start = transaction.start;
+	entry.address = transaction.address;
+	entry.data_phases = transaction.data_phases;
+	entry.wait_states = transaction.wait_states;
+	entry.command = transaction.command;
+	entry.termination = (uint8_t)transaction.termination;
+	entry.reserved = 0;
+	writer->batch.push_back(entry);
+	writer->entries++;
+
+	if (writer->batch.size() >= PCIIDX_WRITE_BATCH)
+		flush_entries(writer);
+}
+
+bool build_capture_index(const char *capture_filename, unsigned int threads)
+{
+	pciidx_header header;
+	memset(&header, 0, sizeof(header));
+	memcpy(header.magic, PCIIDX_MAGIC, sizeof(header.magic));
+	header.version = PCIIDX_VERSION;
+	header.entry_size = sizeof(pciidx_entry);
+	if (!file_info(capture_filename, &header.capture_size, &header.capture_mtime))
+		return false;
+	if (!hash_capture_file(capture_filename, &header.capture_hash))
+		return false;
+
+	// write to a temporary file, so a reader never sees a half-built index
+	std::string index_filename = capture_index_filename(capture_filename);
+	std::string temp_filename = index_filename + ".tmp";
+
+	index_writer writer;
+	writer.F = fopen(temp_filename.c_str(), "wb");
+	if (writer.F == NULL)
+		return false;
+	writer.entries = 0;
+	writer.failed = fwrite(&header, sizeof(header), 1, writer.F) != 1;
+
+	framing_report framing;
+	bool ok = decode_capture(capture_filename, threads, index_transaction, &writer, &framing, &header.samples);
+	flush_entries(&writer);
+	header.entries = writer.entries;
+
+	ok = ok && !writer.failed;
+	ok = ok && fseek(writer.F, 0, SEEK_SET) == 0 && fwrite(&header, sizeof(header), 1, writer.F) == 1;
+	ok = (fclose(writer.F) == 0) && ok;
+	if (ok) {
+		remove(index_filename.c_str());
+		ok = rename(temp_filename.c_str(), index_filename.c_str()) == 0;
+	}
+	if (!ok)
+		remove(temp_filename.c_str());
+	return ok;
+}
+
+bool capture_index::valid(const char *capture_filename)
+{
+	if (file.size() < sizeof(pciidx_header))
+		return false;
+
+	const pciidx_header *h = header();
+	if (memcmp(h->magic, PCIIDX_MAGIC, sizeof(h->magic)) != 0 || h->version != PCIIDX_VERSION
+		|| h->entry_size != sizeof(pciidx_entry)
+		|| file.size() != sizeof(pciidx_header) + h->entries * sizeof(pciidx_entry))
+		return false;
+
+	uint64_t size;
+	int64_t mtime;
+	if (!file_info(capture_filename, &size, &mtime) || size != h->capture_size)
+		return false;
+	if (mtime == h->capture_mtime)
+		return true;
+
+	// the capture was touched: only its contents matter
+	uint64_t hash;
+	if (!hash_capture_file(capture_filename, &hash) || hash != h->capture_hash)
+		return false;
+
+	// remember the new time, so the hash is not checked again next time
+	pciidx_header updated = *h;
+	updated.capture_mtime = mtime;
+	std::string index_filename = capture_index_filename(capture_filename);
+	file.close();
+	FILE *F = fopen(index_filename.c_str(), "r+b");
+	if (F != NULL) {
+		fwrite(&updated, sizeof(updated), 1, F);
+		fclose(F);
+	}
+	return file.open(index_filename.c_str());
+}
+
+bool capture_index::open(const char *capture_filename, unsigned int threads)
+{
+	std::string index_filename = capture_index_filename(capture_filename);
+	was_rebuilt = false;
+
+	if (file.open(index_filename.c_str()) && valid(capture_filename))
+		return true;
+	file.close();
+
+	if (!build_capture_index(capture_filename, threads))
+		return false;
+	was_rebuilt = true;
+	return file.open(index_filename.c_str()) && valid(capture_filename);
+}
@@ -0,0 +1,75 @@
+#pragma once
+
+// Transaction index (.pciidx), kept next to each .pciacq capture.
+// One fixed-size entry per transaction, so reopening a capture only needs a
+// mapping of the index instead of decoding every sample again.
+// The header records the size, modification time and hash of the capture
+// it was built from; a stale or damaged index is rebuilt automatically.
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string>
+
+#include "capture_file.h"
+
+#define PCIIDX_MAGIC "PCIIDX01"
+#define PCIIDX_VERSION 1
+
+struct pciidx_header
+{
+	char magic[8];
+	uint32_t version;
+	uint32_t entry_size;
+	uint64_t capture_size;
+	int64_t capture_mtime;
+	uint64_t capture_hash;
+	uint64_t samples;
+	uint64_t entries;
+};
+
+struct pciidx_entry
+{
+	uint64_t start;		// sample index of the address phase
+	uint32_t address;
+	uint32_t data_phases;
+	uint32_t wait_states;
+	uint8_t command;	// see getMessageType()
+	uint8_t termination;	// pci_termination
+	uint16_t reserved;
+};
+
+class capture_index
+{
+public:
+	capture_index() : was_rebuilt(false) {}
+
+	// Map the index of capture_filename, (re)building it first if needed
+	bool open(const char *capture_filename, unsigned int threads = 1);
+	void close() { file.close(); }
+
+	uint64_t size() const { return header()->entries; }
+	uint64_t samples() const { return header()->samples; }
+	uint64_t capture_hash() const { return header()->capture_hash; }
+	const pciidx_entry *entries() const { return (const pciidx_entry *)(file.data() + sizeof(pciidx_header)); }
+	const pciidx_entry &operator[](size_t i) const { return entries()[i]; }
+
+	// true if open() had to build the index
+	bool rebuilt() const { return was_rebuilt; }
+
+private:
+	const pciidx_header *header() const { return (const pciidx_header *)file.data(); }
+	bool valid(const char *capture_filename);
+
+	mapped_file file;
+	bool was_rebuilt;
+};
+
+// "capture.pciacq" -> "capture.pciacq.pciidx"
+std::string capture_index_filename(const char *capture_filename);
+// "capture.pciacq", ".ext" -> "capture.pciacq.ext"
+std::string capture_sidecar_filename(const char *capture_filename, const char *extension);
+
+bool build_capture_index(const char *capture_filename, unsigned int threads);
+
+// Hash of all whole records of a capture
+bool hash_capture_file(const char *filename, uint64_t *hash);
@@ -0,0 +1,390 @@
+#include <string.h>
+
+#include "capture_rle.h"
+#include "pci_capture.h"
+#include "framing_check.h"
+#include "capture_stream.h"
+
+#define RLE_AD_SAME	0
+#define RLE_AD_DELTA	1
+#define RLE_AD_RAW	2
+#define RLE_WORD	0x04
+#define RLE_COUNT_SHIFT	3
+#define RLE_COUNT_VARINT 31
+
+// Records written per fwrite when expanding
+#define RLE_EXPAND_BATCH 4096
+
+static void put_varint(std::vector<unsigned char> &out, uint32_t value)
+{
+	while (value >= 0x80) {
+		out.push_back((unsigned char)(value | 0x80));
+		value >>= 7;
+	}
+	out.push_back((unsigned char)value);
+}
+
+static const unsigned char *get_varint(const unsigned char *p, const unsigned char *end, uint32_t *value)
+{
+	uint32_t v = 0;
+	for (int shift = 0; p < end && shift < 35; shift += 7) {
+		unsigned char b = *p++;
+		v |= (uint32_t)(b & 0x7F) << shift;
+		if ((b & 0x80) == 0) {
+			*value = v;
+			return p;
+		}
+	}
+	return NULL;
+}
+
+static uint16_t sample_word(uint8_t cbe, uint16_t ctrl)
+{
+	return (uint16_t)((cbe << 12) | (ctrl & PCI_CTRL_MASK));
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+rle_writer::rle_writer()
+	: F(NULL), failed(false), block_samples(0), last_word(PCI_CTRL_IDLE), last_ad(0)
+{
+	memset(&header, 0, sizeof(header));
+	run.count = 0;
+}
+
+rle_writer::~rle_writer()
+{
+	if (F != NULL)
+		close();
+}
+
+bool rle_writer::open(const char *filename)
+{
+	F = fopen(filename, "wb");
+	if (F == NULL)
+		return false;
+
+	memset(&header, 0, sizeof(header));
+	memcpy(header.magic, PCIRLE_MAGIC, sizeof(header.magic));
+	header.version = PCIRLE_VERSION;
+	header.block_samples = PCIRLE_BLOCK_SAMPLES;
+	header.directory_offset = sizeof(header);
+	directory.clear();
+	block.clear();
+	block_samples = 0;
+	last_word = PCI_CTRL_IDLE;
+	last_ad = 0;
+	run.count = 0;
+
+	// the real header is written by close()
+	failed = fwrite(&header, sizeof(header), 1, F) != 1;
+	return !failed;
+}
+
+void rle_writer::push(const uint32_t *ad, const uint8_t *cbe, const uint16_t *ctrl, size_t count)
+{
+	for (size_t i = 0; i < count; i++) {
+		if (run.count > 0 && run.AD == ad[i] && run.CBE == cbe[i] && run.control == ctrl[i]) {
+			run.count++;
+		} else {
+			end_run();
+			run.AD = ad[i];
+			run.CBE = cbe[i];
+			run.control = ctrl[i];
+			run.count = 1;
+		}
+
+		if (++block_samples == PCIRLE_BLOCK_SAMPLES) {
+			end_run();
+			end_block();
+		}
+	}
+	header.samples += count;
+}
+
+void rle_writer::end_run()
+{
+	if (run.count == 0)
+		return;
+
+	uint16_t word = sample_word(run.CBE, run.control);
+	uint32_t delta = run.AD - last_ad;
+	uint32_t zigzag = (delta << 1) ^ (uint32_t)((int32_t)delta >> 31);
+
+	unsigned char tag = 0;
+	if (run.AD != last_ad)
+		tag = zigzag < (1 << 21) ? RLE_AD_DELTA : RLE_AD_RAW;
+	if (word != last_word)
+		tag |= RLE_WORD;
+	uint32_t length = run.count - 1;
+	tag |= (length < RLE_COUNT_VARINT ? length : RLE_COUNT_VARINT) << RLE_COUNT_SHIFT;
+	block.push_back(tag);
+
+	if (tag & RLE_WORD) {
+		block.push_back((unsigned char)word);
+		block.push_back((unsigned char)(word >> 8));
+	}
+	if ((tag & 3) == RLE_AD_DELTA) {
+		put_varint(block, zigzag);
+	} else if ((tag & 3) == RLE_AD_RAW) {
+		for (int b = 0; b < 4; b++)
+			block.push_back((unsigned char)(run.AD >> (8 * b)));
+	}
+	if (length >= RLE_COUNT_VARINT)
+		put_varint(block, length - RLE_COUNT_VARINT);
+
+	last_word = word;
+	last_ad = run.AD;
+	run.count = 0;
+}
+
+void rle_writer::end_block()
+{
+	if (block_samples == 0)
+		return;
+
+	pcirle_block entry;
+	entry.offset = header.directory_offset;
+	entry.bytes = (uint32_t)block.size();
+	entry.samples = block_samples;
+	directory.push_back(entry);
+
+	if (!block.empty() && fwrite(&block[0], 1, block.size(), F) != block.size())
+		failed = true;
+	header.directory_offset += block.size();
+
+	// every block starts from the same state, for random access
+	block.clear();
+	block_samples = 0;
+	last_word = PCI_CTRL_IDLE;
+	last_ad = 0;
+}
+
+bool rle_writer::close()
+{
+	end_run();
+	end_block();
+
+	header.blocks = directory.size();
+	if (!directory.empty() && fwrite(&directory[0], sizeof(pcirle_block), directory.size(), F) != directory.size())
+		failed = true;
+	if (fseek(F, 0, SEEK_SET) != 0 || fwrite(&header, sizeof(header), 1, F) != 1)
+		failed = true;
+	if (fclose(F) != 0)
+		failed = true;
+	F = NULL;
+	return !failed;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+rle_block_reader::rle_block_reader(const unsigned char *data, size_t bytes)
+	: p(data), end(data + bytes), last_word(PCI_CTRL_IDLE), last_ad(0)
+{
+}
+
+bool rle_block_reader::next(pci_run *run)
+{
+	if (p == NULL || p >= end)
+		return false;
+
+	unsigned char tag = *p++;
+	if (tag & RLE_WORD) {
+		if (end - p < 2)
+			return false;
+		last_word = (uint16_t)(p[0] | (p[1] << 8));
+		p += 2;
+	}
+	if ((tag & 3) == RLE_AD_DELTA) {
+		uint32_t zigzag;
+		if ((p = get_varint(p, end, &zigzag)) == NULL)
+			return false;
+		last_ad += (zigzag >> 1) ^ (0 - (zigzag & 1));
+	} else if ((tag & 3) == RLE_AD_RAW) {
+		if (end - p < 4)
+			return false;
+		last_ad = (uint32_t)p[0] | ((uint32_t)p[1] << 8) | ((uint32_t)p[2] << 16) | ((uint32_t)p[3] << 24);
+		p += 4;
+	}
+	uint32_t length = tag >> RLE_COUNT_SHIFT;
+	if (length == RLE_COUNT_VARINT) {
+		uint32_t extra;
+		if ((p = get_varint(p, end, &extra)) == NULL)
+			return false;
+		length += extra;
+	}
+
+	run->AD = last_ad;
+	run->CBE = (uint8_t)(last_word >> 12);
+	run->control = last_word & PCI_CTRL_MASK;
+	run->count = length + 1;
+	return true;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+bool rle_capture::open(const char *filename)
+{
+	if (!file.open(filename))
+		return false;
+
+	const pcirle_header *h = header();
+	if (file.size() < sizeof(pcirle_header) || memcmp(h->magic, PCIRLE_MAGIC, sizeof(h->magic)) != 0
+		|| h->version != PCIRLE_VERSION || h->block_samples == 0
+		|| h->directory_offset > file.size()
+		|| (file.size() - h->directory_offset) / sizeof(pcirle_block) < h->blocks) {
+		file.close();
+		return false;
+	}
+	for (size_t b = 0; b < blocks(); b++) {
+		if (block(b).offset + block(b).bytes > h->directory_offset) {
+			file.close();
+			return false;
+		}
+	}
+	return true;
+}
+
+rle_block_reader rle_capture::block_reader(size_t b) const
+{
+	return rle_block_reader(file.data() + block(b).offset, block(b).bytes);
+}
+
+void rle_capture::read(uint64_t first, size_t count, pci_capture *out) const
+{
+	uint64_t position = block_first_sample(find_block(first));
+	for (size_t b = find_block(first); b < blocks() && count > 0; b++) {
+		rle_block_reader reader = block_reader(b);
+		pci_run run;
+		while (count > 0 && reader.next(&run)) {
+			uint64_t run_end = position + run.count;
+			if (run_end > first) {
+				uint64_t from = position > first ? position : first;
+				uint64_t n = run_end - from;
+				if (n > count)
+					n = count;
+				for (uint64_t i = 0; i < n; i++)
+					out->push_back(run.AD, run.CBE, run.control);
+				first += n;
+				count -= (size_t)n;
+			}
+			position = run_end;
+		}
+	}
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+bool is_rle_capture(const char *filename)
+{
+	char magic[8];
+	FILE *F = fopen(filename, "rb");
+	if (F == NULL)
+		return false;
+	bool rle = fread(magic, 1, sizeof(magic), F) == sizeof(magic) && memcmp(magic, PCIRLE_MAGIC, sizeof(magic)) == 0;
+	fclose(F);
+	return rle;
+}
+
+static void push_rle_samples(const pci_capture &samples, void *context)
+{
+	static_cast<rle_writer *>(context)->push(samples.ad_column(), samples.cbe_column(), samples.control_column(), samples.size());
+}
+
+bool compress_capture(const char *capture_filename, const char *rle_filename)
+{
+	rle_writer writer;
+	if (is_stream_capture(capture_filename)) {
+		// runs and timed samples, not 0x01 0x02 records
+		stream_report report;
+		if (!writer.open(rle_filename))
+			return false;
+		if (!expand_stream_capture(capture_filename, push_rle_samples, &writer, &report)) {
+			writer.close();
+			return false;
+		}
+		return writer.close();
+	}
+
+	capture_file capture;
+	if (!capture.open(capture_filename))
+		return false;
+	if (!writer.open(rle_filename))
+		return false;
+
+	framing_report framing;
+	pci_capture samples;
+	uint64_t offset = 0;
+	const unsigned char *records;
+	size_t count;
+	while ((count = capture.next(&records)) > 0) {
+		framing.runs.clear();
+		check_framing(records, count * PCI_RECORD_SIZE, offset, &framing);
+		samples.clear();
+		for (size_t r = 0; r < framing.runs.size(); r++)
+			samples.append_records(records + (framing.runs[r].offset - offset), (size_t)(framing.runs[r].length / PCI_RECORD_SIZE));
+		if (samples.size() > 0)
+			writer.push(samples.ad_column(), samples.cbe_column(), samples.control_column(), samples.size());
+		offset += count * PCI_RECORD_SIZE;
+	}
+	if (capture.failed()) {
+		writer.close();
+		return false;
+	}
+	return writer.close();
+}
+
+bool expand_capture(const char *rle_filename, const char *capture_filename)
+{
+	rle_capture rle;
+	if (!rle.open(rle_filename))
+		return false;
+
+	FILE *F = fopen(capture_filename, "wb");
+	if (F == NULL)
+		return false;
+
+	bool ok = true;
+	std::vector<unsigned char> out;
+	out.reserve(RLE_EXPAND_BATCH * PCI_RECORD_SIZE);
+	for (size_t b = 0; b < rle.blocks() && ok; b++) {
+		rle_block_reader reader = rle.block_reader(b);
+		pci_run run;
+		while (reader.next(&run) && ok) {
+			uint16_t word = sample_word(run.CBE, run.control);
+			unsigned char record[PCI_RECORD_SIZE] = {
+				(unsigned char)word, (unsigned char)(word >> 8),
+				(unsigned char)run.AD, (unsigned char)(run.AD >> 8), (unsigned char)(run.AD >> 16), (unsigned char)(run.AD >> 24),
+				0x01, 0x02 };
+			for (uint32_t i = 0; i < run.count; i++) {
+				out.insert(out.end(), record, record + PCI_RECORD_SIZE);
+				if (out.size() >= RLE_EXPAND_BATCH * PCI_RECORD_SIZE) {
+					ok = fwrite(&out[0], 1, out.size(), F) == out.size();
+					out.clear();
+				}
+			}
+		}
+	}
+	if (ok && !out.empty())
+		ok = fwrite(&out[0], 1, out.size(), F) == out.size();
+	return (fclose(F) == 0) && ok;
+}
+
+bool decode_rle_capture(const char *rle_filename, transaction_callback callback, void *context, uint64_t *samples)
+{
+	rle_capture rle;
+	if (!rle.open(rle_filename))
+		return false;
+
+	transaction_decoder decoder(callback, context);
+	for (size_t b = 0; b < rle.blocks(); b++) {
+		rle_block_reader reader = rle.block_reader(b);
+		pci_run run;
+		while (reader.next(&run))
+			decoder.push_run(run.AD, run.CBE, run.control, run.count);
+	}
+	decoder.flush();
+
+	*samples = decoder.samples();
+	return true;
+}
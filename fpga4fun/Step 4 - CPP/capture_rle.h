@@ -0,0 +1,132 @@
+#pragma once
+
+// Compressed capture storage (.pcirle).
+// Consecutive identical 48-bit samples are stored once with a repeat count,
+// and AD is stored as a delta from the previous run. Samples are grouped in
+// blocks of PCIRLE_BLOCK_SAMPLES that each start from a known state, and a
+// block directory at the end of the file gives random access to any sample.
+//
+// Block layout, one entry per run:
+//   tag byte: bits 1:0  AD: 0 = same as the previous run, 1 = zigzag varint
+//                       delta, 2 = 4 raw bytes
+//             bit 2     a new 16-bit control/CBE word follows
+//             bits 7:3  run length - 1, or 31 if a varint (length - 32) follows
+//   [control/CBE word] [AD] [run length]
+// The control/CBE word is the first two bytes of the USB record.
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <vector>
+
+#include "capture_file.h"
+#include "transaction_decoder.h"
+
+#define PCIRLE_MAGIC "PCIRLE01"
+#define PCIRLE_VERSION 1
+#define PCIRLE_BLOCK_SAMPLES 65536
+
+struct pcirle_header
+{
+	char magic[8];
+	uint32_t version;
+	uint32_t block_samples;
+	uint64_t samples;
+	uint64_t blocks;
+	uint64_t directory_offset;
+};
+
+struct pcirle_block
+{
+	uint64_t offset;	// file offset of the block data
+	uint32_t bytes;
+	uint32_t samples;
+};
+
+// A run of identical samples
+struct pci_run
+{
+	uint32_t AD;
+	uint8_t CBE;
+	uint16_t control;	// PCI_CTRL_ bits
+	uint32_t count;
+};
+
+class rle_writer
+{
+public:
+	rle_writer();
+	~rle_writer();
+
+	bool open(const char *filename);
+	void push(const uint32_t *ad, const uint8_t *cbe, const uint16_t *ctrl, size_t count);
+	// Write the last block and the directory
+	bool close();
+
+	uint64_t samples() const { return header.samples; }
+
+private:
+	void end_run();
+	void end_block();
+
+	FILE *F;
+	bool failed;
+	pcirle_header header;
+	std::vector<pcirle_block> directory;
+	std::vector<unsigned char> block;
+	uint32_t block_samples;
+
+	// run being built, and the state the next run is encoded against
+	pci_run run;
+	uint16_t last_word;
+	uint32_t last_ad;
+};
+
+// Walks the runs of one block without expanding them
+class rle_block_reader
+{
+public:
+	rle_block_reader(const unsigned char *data, size_t bytes);
+	bool next(pci_run *run);
+
+private:
+	const unsigned char *p;
+	const unsigned char *end;
+	uint16_t last_word;
+	uint32_t last_ad;
+};
+
+class rle_capture
+{
+public:
+	bool open(const char *filename);
+	void close() { file.close(); }
+
+	uint64_t samples() const { return header()->samples; }
+	size_t blocks() const { return (size_t)header()->blocks; }
+	const pcirle_block &block(size_t b) const { return directory()[b]; }
+	rle_block_reader block_reader(size_t b) const;
+	size_t find_block(uint64_t sample) const { return (size_t)(sample / header()->block_samples); }
+	uint64_t block_first_sample(size_t b) const { return (uint64_t)b * header()->block_samples; }
+
+	// Expand samples [first, first + count) and append them to *out
+	void read(uint64_t first, size_t count, pci_capture *out) const;
+
+private:
+	const pcirle_header *header() const { return (const pcirle_header *)file.data(); }
+	const pcirle_block *directory() const { return (const pcirle_block *)(file.data() + header()->directory_offset); }
+
+	mapped_file file;
+};
+
+// true if filename starts with the .pcirle magic
+bool is_rle_capture(const char *filename);
+
+// Compress a raw .pciacq capture (only its well-framed records), or a stream
+// capture or RAM_LA dump (see capture_stream.h), its gaps stored as an idle bus
+bool compress_capture(const char *capture_filename, const char *rle_filename);
+// Expand a .pcirle file back to raw 8-byte records
+bool expand_capture(const char *rle_filename, const char *capture_filename);
+
+// Decode the transactions of a .pcirle file straight from its runs
+bool decode_rle_capture(const char *rle_filename, transaction_callback callback, void *context, uint64_t *samples);
@@ -0,0 +1,493 @@
+#include <stdio.h>
+#include <string.h>
+#include <algorithm>
+
+#include "capture_stream.h"
+#include "capture_file.h"
+#include "capture_writer.h"
+#include "framing_check.h"
+#include "pci_capture.h"
+
+bool is_stream_record(const unsigned char *record)
+{
+	static const unsigned char empty[PCI_RECORD_SIZE] = { 0, 0, 0, 0, 0, 0, 0, STREAM_TAG_EMPTY << 4 };
+
+	if ((record[7] & STREAM_TIMED_MASK) == STREAM_TIMED)
+		return true;
+	switch (record[7] >> 4) {
+	case STREAM_TAG_SAMPLE:
+		return true;
+	case STREAM_TAG_STATUS:
+		return (record[7] & 0x0F) == 0 && record[6] <= STREAM_STATUS_SKIPPED;
+	case STREAM_TAG_EMPTY:
+		return memcmp(record, empty, sizeof(empty)) == 0;
+	}
+	return false;
+}
+
+static uint32_t le32(const unsigned char *p)
+{
+	return (uint32_t)p[0] | ((uint32_t)p[1] << 8) | ((uint32_t)p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+// Cycles a sample record lasted
+static uint32_t run_length(const unsigned char *r)
+{
+	return (((uint32_t)(r[7] & 0x0F) << 8) | r[6]) + 1;
+}
+
+uint32_t stream_clock::advance(const unsigned char *r)
+{
+	const uint16_t mask = (1 << STREAM_TIME_BITS) - 1;
+	uint16_t time = (uint16_t)(((r[7] << 8) | r[6]) & mask);
+	uint32_t clocks = (uint16_t)(time - last) & mask;
+	if (clocks == 0)
+		clocks = mask + 1;	// a whole turn, the best guess
+	if (!started)
+		clocks = 0;
+	started = true;
+	last = time;
+	return clocks;
+}
+
+static bool is_timed(const unsigned char *r)
+{
+	return (r[7] & STREAM_TIMED_MASK) == STREAM_TIMED;
+}
+
+uint32_t stream_record_clocks(const unsigned char *r)
+{
+	if (is_timed(r))
+		return 1;
+	switch (r[7] >> 4) {
+	case STREAM_TAG_SAMPLE:
+		return run_length(r);
+	case STREAM_TAG_STATUS:
+		return (r[6] & (STREAM_STATUS_OVERFLOW | STREAM_STATUS_SKIPPED)) ? le32(r) : 0;
+	}
+	return 0;
+}
+
+size_t stream_parser::parse(const unsigned char *data, size_t size, stream_record_callback callback, void *context)
+{
+	size_t i = 0;
+	while (size - i >= PCI_RECORD_SIZE) {
+		if (!locked) {
+			if (size - i < FRAMING_LOCK_RECORDS * PCI_RECORD_SIZE)
+				break;		// wait for more
+			int r = 0;
+			while (r < FRAMING_LOCK_RECORDS && is_stream_record(data + i + r * PCI_RECORD_SIZE))
+				r++;
+			if (r < FRAMING_LOCK_RECORDS) {
+				i++;
+				dropped++;
+				continue;
+			}
+			locked = true;
+		}
+		if (!is_stream_record(data + i)) {
+			locked = false;
+			continue;
+		}
+		callback(data + i, context);
+		i += PCI_RECORD_SIZE;
+	}
+	return i;
+}
+
+void stream_parser::feed(const unsigned char *data, size_t size, stream_record_callback callback, void *context)
+{
+	// records are parsed in place; only a tail too short to tell is copied
+	if (pending.empty()) {
+		size_t done = parse(data, size, callback, context);
+		pending.assign(data + done, data + size);
+	} else {
+		pending.insert(pending.end(), data, data + size);
+		size_t done = parse(&pending[0], pending.size(), callback, context);
+		pending.erase(pending.begin(), pending.begin() + done);
+	}
+}
+
+void stream_parser::finish()
+{
+	dropped += pending.size();
+	pending.clear();
+	locked = false;
+}
+
+stream_decoder::stream_decoder(transaction_callback callback, void *context)
+	: decoder(callback, context)
+{
+}
+
+static void decode_record(const unsigned char *record, void *context)
+{
+	static_cast<stream_decoder *>(context)->push_record(record);
+}
+
+void stream_decoder::push_record(const unsigned char *r)
+{
+	if (is_timed(r)) {
+		uint32_t clocks = clock.advance(r);
+		if (clocks > 1) {
+			// not captured: like an overflow gap
+			stream_gap gap = { decoder.samples(), clocks - 1 };
+			stats.gaps.push_back(gap);
+			stats.skipped_cycles += gap.lost;
+			decoder.flush();
+			decoder.reset(gap.sample + gap.lost, PCI_CTRL_UNKNOWN);
+		}
+	}
+
+	switch (is_timed(r) ? STREAM_TAG_SAMPLE : r[7] >> 4) {
+	case STREAM_TAG_SAMPLE: {
+		uint16_t ctrl = (uint16_t)(((r[1] & 0x0F) << 8) | r[0]);
+		uint8_t cbe = r[1] >> 4;
+		uint32_t ad = le32(r + 2);
+		uint32_t count = is_timed(r) ? 1 : run_length(r);
+		decoder.push_run(ad, cbe, ctrl, count);
+		stats.samples += count;
+		stats.records++;
+		break;
+	}
+	case STREAM_TAG_STATUS: {
+		uint32_t lost = le32(r);
+		stats.overflows = (uint16_t)(r[4] | (r[5] << 8));
+		stats.records++;
+		if (r[6] & (STREAM_STATUS_OVERFLOW | STREAM_STATUS_SKIPPED)) {
+			// what the bus did during the gap is unknown: end the
+			// transaction in progress there and start over after it
+			stream_gap gap = { decoder.samples(), lost };
+			stats.gaps.push_back(gap);
+			if (r[6] & STREAM_STATUS_OVERFLOW)
+				stats.lost_cycles += lost;
+			else
+				stats.skipped_cycles += lost;
+			decoder.flush();
+			decoder.reset(gap.sample + lost, PCI_CTRL_UNKNOWN);
+		}
+		break;
+	}
+	default:
+		stats.empty_records++;
+		break;
+	}
+}
+
+void stream_decoder::push(const unsigned char *data, size_t size)
+{
+	parser.feed(data, size, decode_record, this);
+	stats.dropped_bytes = parser.dropped_bytes();
+}
+
+void stream_decoder::finish()
+{
+	parser.finish();
+	stats.dropped_bytes = parser.dropped_bytes();
+	decoder.flush();
+}
+
+static void write_record(const unsigned char *r, void *context)
+{
+	stream_writer *w = static_cast<stream_writer *>(context);
+	switch (is_timed(r) ? STREAM_TAG_SAMPLE : r[7] >> 4) {
+	case STREAM_TAG_EMPTY:
+		w->report.empty_records++;
+		return;
+	case STREAM_TAG_SAMPLE:
+		w->report.samples += is_timed(r) ? 1 : run_length(r);
+		break;
+	case STREAM_TAG_STATUS:
+		w->report.overflows = (uint16_t)(r[4] | (r[5] << 8));
+		if (r[6] & (STREAM_STATUS_OVERFLOW | STREAM_STATUS_SKIPPED)) {
+			stream_gap gap = { w->report.samples + w->report.lost_cycles + w->report.skipped_cycles, le32(r) };
+			w->report.gaps.push_back(gap);
+			if (r[6] & STREAM_STATUS_OVERFLOW)
+				w->report.lost_cycles += gap.lost;
+			else
+				w->report.skipped_cycles += gap.lost;
+		}
+		break;
+	}
+	w->report.records++;
+	w->out.insert(w->out.end(), r, r + PCI_RECORD_SIZE);
+}
+
+bool stream_writer_sink(const unsigned char *buffer, size_t size, void *context)
+{
+	stream_writer *w = static_cast<stream_writer *>(context);
+	w->out.clear();
+	w->parser.feed(buffer, size, write_record, w);
+	w->report.dropped_bytes = w->parser.dropped_bytes();
+	if (!w->out.empty() && !(w->next != NULL ? w->next(&w->out[0], w->out.size(), w->next_context) :
+		w->writer->write(&w->out[0], w->out.size())))
+		w->failed = true;
+	return !w->failed;
+}
+
+bool is_stream_data(const unsigned char *data, size_t size, size_t *records_offset)
+{
+	if (size >= PCI_RECORD_SIZE && memcmp(data, PCISTR_MAGIC, PCI_RECORD_SIZE) == 0) {
+		if (records_offset != NULL)
+			*records_offset = PCI_RECORD_SIZE;
+		return true;
+	}
+	// a .pciacq record ends in 0x02, never a stream tag
+	if (size < FRAMING_LOCK_RECORDS * PCI_RECORD_SIZE)
+		return false;
+	for (int r = 0; r < FRAMING_LOCK_RECORDS; r++)
+		if (!is_stream_record(data + r * PCI_RECORD_SIZE))
+			return false;
+	if (records_offset != NULL)
+		*records_offset = 0;
+	return true;
+}
+
+bool is_stream_capture(const char *filename, uint64_t *records_offset)
+{
+	unsigned char start[FRAMING_LOCK_RECORDS * PCI_RECORD_SIZE];
+	FILE *F = fopen(filename, "rb");
+	if (F == NULL)
+		return false;
+	size_t size = fread(start, 1, sizeof(start), F);
+	fclose(F);
+
+	size_t offset;
+	if (!is_stream_data(start, size, &offset))
+		return false;
+	if (records_offset != NULL)
+		*records_offset = offset;
+	return true;
+}
+
+// Call callback for every record of a stream capture file
+static bool parse_stream_capture(const char *filename, stream_record_callback callback, void *context,
+	uint64_t *dropped_bytes)
+{
+	uint64_t skip;
+	capture_file capture;
+	if (!is_stream_capture(filename, &skip) || !capture.open(filename))
+		return false;
+
+	stream_parser parser;
+	const unsigned char *records;
+	size_t count;
+	while ((count = capture.next(&records)) > 0) {
+		if (skip > 0) {
+			// the magic takes the place of the first record
+			records += PCI_RECORD_SIZE;
+			count--;
+			skip = 0;
+		}
+		parser.feed(records, count * PCI_RECORD_SIZE, callback, context);
+	}
+	if (capture.failed())
+		return false;
+	parser.finish();
+	*dropped_bytes = parser.dropped_bytes() + capture.tail_bytes();
+	return true;
+}
+
+bool decode_stream_capture(const char *filename, transaction_callback callback, void *context,
+	stream_report *report, uint64_t *samples)
+{
+	stream_decoder decoder(callback, context);
+	if (!parse_stream_capture(filename, decode_record, &decoder, &report->dropped_bytes))
+		return false;
+	decoder.finish();
+
+	uint64_t dropped_bytes = report->dropped_bytes;
+	*report = decoder.report();
+	report->dropped_bytes = dropped_bytes;
+	*samples = decoder.samples();
+	return true;
+}
+
+void stream_runs::add(const pci_run &run)
+{
+	callback(run, context);
+	total += run.count;
+}
+
+void stream_runs::push_record(const unsigned char *r)
+{
+	pci_run next;
+	if (is_timed(r)) {
+		uint32_t clocks = clock.advance(r);
+		if (clocks > 1) {
+			// the clocks between capture windows read as an idle bus
+			pci_run idle = { 0, 0xF, PCI_CTRL_IDLE, clocks - 1 };
+			stream_gap gap = { total, idle.count };
+			stats.gaps.push_back(gap);
+			stats.skipped_cycles += idle.count;
+			add(idle);
+		}
+	}
+	switch (is_timed(r) ? STREAM_TAG_SAMPLE : r[7] >> 4) {
+	case STREAM_TAG_SAMPLE:
+		next.control = (uint16_t)(((r[1] & 0x0F) << 8) | r[0]);
+		next.CBE = r[1] >> 4;
+		next.AD = le32(r + 2);
+		next.count = is_timed(r) ? 1 : run_length(r);
+		stats.samples += next.count;
+		break;
+	case STREAM_TAG_STATUS:
+		// the gap, if any, becomes a run of idle cycles
+		next.control = PCI_CTRL_IDLE;
+		next.CBE = 0xF;
+		next.AD = 0;
+		next.count = stream_record_clocks(r);
+		stats.overflows = (uint16_t)(r[4] | (r[5] << 8));
+		if (r[6] & (STREAM_STATUS_OVERFLOW | STREAM_STATUS_SKIPPED)) {
+			stream_gap gap = { total, next.count };
+			stats.gaps.push_back(gap);
+			if (r[6] & STREAM_STATUS_OVERFLOW)
+				stats.lost_cycles += next.count;
+			else
+				stats.skipped_cycles += next.count;
+		}
+		break;
+	default:
+		stats.empty_records++;
+		return;
+	}
+	stats.records++;
+	if (next.count > 0)
+		add(next);
+}
+
+static void push_run_record(const unsigned char *record, void *context)
+{
+	static_cast<stream_runs *>(context)->push_record(record);
+}
+
+void stream_capture::add_run(const pci_run &r, void *context)
+{
+	stream_capture *c = static_cast<stream_capture *>(context);
+	c->run.push_back(r);
+	c->start.push_back(c->total);
+	c->total += r.count;
+}
+
+bool stream_capture::open(const char *filename)
+{
+	run.clear();
+	start.clear();
+	total = 0;
+	stream_runs runs(add_run, this);
+	uint64_t dropped_bytes = 0;
+	bool ok = parse_stream_capture(filename, push_run_record, &runs, &dropped_bytes);
+	stats = runs.report();
+	stats.dropped_bytes = dropped_bytes;
+	return ok;
+}
+
+// The run holding sample, which is below samples()
+size_t stream_capture::find_run(uint64_t sample) const
+{
+	return (size_t)(std::upper_bound(start.begin(), start.end(), sample) - start.begin()) - 1;
+}
+
+void stream_capture::read(uint64_t first, size_t count, pci_capture *out) const
+{
+	if (first >= total)
+		return;
+	for (size_t r = find_run(first); r < run.size() && count > 0; r++) {
+		uint64_t n = start[r] + run[r].count - first;
+		if (n > count)
+			n = count;
+		for (uint64_t i = 0; i < n; i++)
+			out->push_back(run[r].AD, run[r].CBE, run[r].control);
+		first += n;
+		count -= (size_t)n;
+	}
+}
+
+pci_frame stream_capture::frame(uint64_t sample) const
+{
+	pci_capture one;
+	read(sample, 1, &one);
+	return one.frame(0);
+}
+
+struct stream_expansion
+{
+	pci_capture samples;
+	stream_samples_callback callback;
+	void *context;
+};
+
+static void expand_run(const pci_run &run, void *context)
+{
+	stream_expansion *e = static_cast<stream_expansion *>(context);
+	uint32_t left = run.count;
+	while (left > 0) {
+		uint32_t n = std::min(left, (uint32_t)(STREAM_EXPAND_BATCH - e->samples.size()));
+		for (uint32_t i = 0; i < n; i++)
+			e->samples.push_back(run.AD, run.CBE, run.control);
+		left -= n;
+		if (e->samples.size() == STREAM_EXPAND_BATCH) {
+			e->callback(e->samples, e->context);
+			e->samples.clear();
+		}
+	}
+}
+
+bool expand_stream_capture(const char *filename, stream_samples_callback callback, void *context,
+	stream_report *report)
+{
+	stream_expansion expansion;
+	expansion.callback = callback;
+	expansion.context = context;
+	expansion.samples.reserve(STREAM_EXPAND_BATCH);
+	stream_runs runs(expand_run, &expansion);
+	uint64_t dropped_bytes = 0;
+	if (!parse_stream_capture(filename, push_run_record, &runs, &dropped_bytes))
+		return false;
+	if (expansion.samples.size() > 0)
+		callback(expansion.samples, context);
+
+	*report = runs.report();
+	report->dropped_bytes = dropped_bytes;
+	return true;
+}
+
+static void ignore_run(const pci_run &, void *)
+{
+}
+
+// Where record wanted starts, for stream_record_sample()
+struct record_position
+{
+	stream_runs runs;
+	uint64_t records;
+	uint64_t wanted;
+	bool found;
+	uint64_t sample;
+
+	record_position(uint64_t wanted) : runs(ignore_run, NULL), records(0), wanted(wanted), found(false), sample(0) {}
+};
+
+static void find_record(const unsigned char *record, void *context)
+{
+	record_position *p = static_cast<record_position *>(context);
+	if (p->found)
+		return;
+	// the gap before a timed record comes first, so its sample is where
+	// its own clock starts
+	p->runs.push_record(record);
+	if (p->records++ == p->wanted) {
+		p->sample = p->runs.samples() - stream_record_clocks(record);
+		p->found = true;
+	}
+}
+
+bool stream_record_sample(const char *filename, uint64_t n, uint64_t *sample)
+{
+	record_position position(n);
+	uint64_t dropped_bytes = 0;
+	if (!parse_stream_capture(filename, find_record, &position, &dropped_bytes) || !position.found)
+		return false;
+	*sample = position.sample;
+	return true;
+}
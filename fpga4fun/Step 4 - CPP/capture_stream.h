@@ -0,0 +1,223 @@
+#pragma once
+
+// FIFO stream captures (.pcistr), from PCI_LogicAnalyzer.v built with
+// STREAM_CAPTURE (see PCI_StreamCapture.v), and RAM_LA dumps, which are made
+// of the same kinds of records.
+// The board only sends a sample when one of the signals changes, with the
+// number of cycles it lasted, so the 8-byte records end in a tag instead of
+// 0x01 0x02:
+//   sample  bytes 0-5 as in a .pciacq record, bytes 6-7 {0xA, repeat[11:0]}:
+//           the sample lasted repeat + 1 cycles
+//   status  bytes 0-3 cycles lost while the FIFO was full, bytes 4-5
+//           overflows so far, byte 6 bit 0 overflow flag, byte 7 0xB0;
+//           with byte 6 bit 1 instead, bytes 0-3 are cycles the host's
+//           software trigger dropped between its windows (soft_trigger.h)
+//   empty   byte 7 0xE0, the rest 0: the FIFO had nothing to send
+//   timed   bytes 0-5 as in a .pciacq record, bytes 6-7 {2'b01, time[13:0]}:
+//           one sample and the PCI clock counter when it was taken (RAM_LA
+//           dumps of the default build; RLE_CAPTURE stores sample records)
+// Empty records are dropped on the way to disk, and the file starts with the
+// PCISTR_MAGIC record. Transactions are decoded from the runs without
+// expanding them; a gap left by an overflow ends the transaction in progress
+// as incomplete and moves the sample index on by the cycles lost. The same
+// happens for the cycles the software trigger skipped, and between timed
+// records that are not on consecutive clocks, so the sample index of a timed
+// capture counts PCI clocks: the counter wraps every 16384 clocks, and the
+// time is rebuilt as long as the samples are closer.
+
+#include <stddef.h>
+#include <stdint.h>
+#include <vector>
+
+#include "capture_rle.h"
+#include "transaction_decoder.h"
+
+#define PCISTR_MAGIC "PCISTR01"
+
+#define STREAM_TAG_SAMPLE 0xA
+#define STREAM_TAG_STATUS 0xB
+#define STREAM_TAG_EMPTY 0xE
+#define STREAM_MAX_REPEAT 4095
+#define STREAM_TIMED_MASK 0xC0	// byte 7 of a timed record
+#define STREAM_TIMED 0x40
+#define STREAM_TIME_BITS 14
+#define STREAM_STATUS_OVERFLOW 0x01	// byte 6 of a status record
+#define STREAM_STATUS_SKIPPED 0x02
+
+struct stream_gap
+{
+	uint64_t sample;	// sample index where cycles are missing
+	uint32_t lost;		// cycles missing
+};
+
+struct stream_report
+{
+	uint64_t records;		// sample and status records
+	uint64_t empty_records;
+	uint64_t samples;		// cycles captured
+	uint64_t lost_cycles;		// in overflows
+	uint64_t skipped_cycles;	// between timed records or software trigger windows
+	uint64_t dropped_bytes;		// not recognised as records
+	uint16_t overflows;		// the board's count, as of the last status record
+	std::vector<stream_gap> gaps;
+
+	stream_report() : records(0), empty_records(0), samples(0), lost_cycles(0), skipped_cycles(0), dropped_bytes(0), overflows(0) {}
+};
+
+typedef void (*stream_record_callback)(const unsigned char *record, void *context);
+
+// Cuts a byte stream into records, locking onto them after a slip the way
+// check_framing() does: FRAMING_LOCK_RECORDS valid records in a row
+class stream_parser
+{
+public:
+	stream_parser() : locked(false), dropped(0) {}
+
+	// Hand every record to callback; a partial record is kept for the next call
+	void feed(const unsigned char *data, size_t size, stream_record_callback callback, void *context);
+	// End of stream: what is left is not a record
+	void finish();
+
+	uint64_t dropped_bytes() const { return dropped; }
+
+private:
+	size_t parse(const unsigned char *data, size_t size, stream_record_callback callback, void *context);
+
+	std::vector<unsigned char> pending;
+	bool locked;
+	uint64_t dropped;
+};
+
+bool is_stream_record(const unsigned char *record);
+// PCI clocks a record stands for: the run of a sample record, 1 for a timed
+// record, the cycles lost or skipped for a status record, 0 for an empty one
+uint32_t stream_record_clocks(const unsigned char *record);
+
+// Rebuilds the time between timed records from their wrapping counter
+struct stream_clock
+{
+	bool started;
+	uint16_t last;
+
+	stream_clock() : started(false), last(0) {}
+	// Clocks since the previous timed record, 0 for the first one
+	uint32_t advance(const unsigned char *record);
+};
+
+// Decodes the transactions of a stream as it arrives
+class stream_decoder
+{
+public:
+	stream_decoder(transaction_callback callback, void *context);
+
+	void push(const unsigned char *data, size_t size);
+	// One record already cut out, e.g. by another stream_parser
+	void push_record(const unsigned char *record);
+	// End of stream: emit the transaction in progress as incomplete
+	void finish();
+
+	const stream_report &report() const { return stats; }
+	uint64_t samples() const { return decoder.samples(); }	// lost cycles included
+
+private:
+	stream_parser parser;
+	transaction_decoder decoder;
+	stream_clock clock;
+	stream_report stats;
+};
+
+// acquisition_sink for a board in stream mode: drops the empty records,
+// counts the overflows, and writes the rest to a capture_writer, or hands
+// them, cut into whole records, to next (e.g. soft_trigger_sink) when set
+class capture_writer;
+struct stream_writer
+{
+	capture_writer *writer;
+	bool (*next)(const unsigned char *buffer, size_t size, void *context);	// an acquisition_sink
+	void *next_context;
+	stream_parser parser;
+	stream_report report;
+	std::vector<unsigned char> out;
+	bool failed;
+
+	stream_writer(capture_writer *writer) : writer(writer), next(NULL), next_context(NULL), failed(false) {}
+};
+bool stream_writer_sink(const unsigned char *buffer, size_t size, void *context);
+
+// true if filename starts with the .pcistr magic, or straight with stream
+// records (a RAM_LA dump); *records_offset is where the records start
+bool is_stream_capture(const char *filename, uint64_t *records_offset = NULL);
+// Same for a capture in memory
+bool is_stream_data(const unsigned char *data, size_t size, size_t *records_offset = NULL);
+
+// Turns stream records into runs of samples, and the cycles lost in an
+// overflow or skipped between timed records into runs of an idle bus
+typedef void (*stream_run_callback)(const pci_run &run, void *context);
+class stream_runs
+{
+public:
+	stream_runs(stream_run_callback callback, void *context) : callback(callback), context(context), total(0) {}
+
+	void push_record(const unsigned char *record);
+
+	uint64_t samples() const { return total; }
+	const stream_report &report() const { return stats; }
+
+private:
+	void add(const pci_run &run);
+
+	stream_run_callback callback;
+	void *context;
+	uint64_t total;
+	stream_clock clock;
+	stream_report stats;
+};
+
+// Random access to the samples of a stream capture, expanded only when they
+// are read: the runs are kept as they are, with the index of their first
+// sample. The cycles lost in an overflow read as an idle bus.
+class stream_capture
+{
+public:
+	stream_capture() : total(0) {}
+
+	bool open(const char *filename);
+
+	uint64_t samples() const { return total; }
+	size_t runs() const { return run.size(); }
+	// Sample index of a run; for a RAM_LA dump of RLE_CAPTURE, where the runs
+	// are the entries, that of the trigger entry is where the trigger is
+	uint64_t first_sample(size_t r) const { return start[r]; }
+	const stream_report &report() const { return stats; }
+
+	// Expand samples [first, first + count) and append them to *out
+	void read(uint64_t first, size_t count, pci_capture *out) const;
+	// sample must be below samples()
+	pci_frame frame(uint64_t sample) const;
+
+private:
+	static void add_run(const pci_run &run, void *context);
+	size_t find_run(uint64_t sample) const;
+
+	std::vector<pci_run> run;
+	std::vector<uint64_t> start;	// first sample of each run
+	uint64_t total;
+	stream_report stats;
+};
+
+bool decode_stream_capture(const char *filename, transaction_callback callback, void *context,
+	stream_report *report, uint64_t *samples);
+
+// Calls callback with the samples of a stream capture file in order, up to
+// STREAM_EXPAND_BATCH at a time, the gaps read as an idle bus as in
+// stream_capture; for the formats that store every clock
+#define STREAM_EXPAND_BATCH 65536
+typedef void (*stream_samples_callback)(const pci_capture &samples, void *context);
+bool expand_stream_capture(const char *filename, stream_samples_callback callback, void *context,
+	stream_report *report);
+
+// Sample index where record n of a stream capture file starts, the magic
+// not counted: for a RAM_LA dump, where entry n is record n, that of the
+// trigger entry (trigger_sequencer.h). False if the file is not a stream
+// capture or has fewer records.
+bool stream_record_sample(const char *filename, uint64_t n, uint64_t *sample);
@@ -0,0 +1,314 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <chrono>
+
+#ifndef _WIN32
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+#include "capture_writer.h"
+
+std::string capture_sequence_filename(const char *filename, unsigned int sequence)
+{
+	std::string name(filename);
+	std::string extension;
+	size_t dot = name.find_last_of('.');
+	size_t slash = name.find_last_of("/\\");
+	if (dot != std::string::npos && (slash == std::string::npos || dot > slash)) {
+		extension = name.substr(dot);
+		name.erase(dot);
+	}
+	// wide enough that the names sort in order for any capture
+	char number[16];
+	snprintf(number, sizeof(number), ".%08u", sequence);
+	return name + number + extension;
+}
+
+// IORING_OP_WRITE came in 5.6; older kernels fail it
+static bool write_unsupported(int result)
+{
+#ifdef _WIN32
+	return false;
+#else
+	return result == -EINVAL || result == -EOPNOTSUPP;
+#endif
+}
+
+static uint64_t now_us()
+{
+	return (uint64_t)std::chrono::duration_cast<std::chrono::microseconds>(
+		std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+capture_writer::capture_writer()
+	: rotate_bytes(0), sequence(0), file_bytes(0), allocated(0), total_bytes(0), stall_us(0), failed(false),
+	blocks(NULL), ring_wrote(false), ring_unsupported(false), current(0), filled(0),
+#ifdef _WIN32
+	file(INVALID_HANDLE_VALUE)
+#else
+	fd(-1), direct(false)
+#endif
+{
+	memset(busy, 0, sizeof(busy));
+	memset(block_bytes, 0, sizeof(block_bytes));
+	memset(block_offset, 0, sizeof(block_offset));
+}
+
+capture_writer::~capture_writer()
+{
+	close();
+}
+
+bool capture_writer::open(const char *filename, uint64_t rotate, const void *file_header, size_t header_size)
+{
+	close();
+
+	base = filename;
+	if (header_size > 0)
+		header.assign((const char *)file_header, header_size);
+	else
+		header.clear();
+	rotate_bytes = (rotate + CAPTURE_WRITER_ALIGN - 1) / CAPTURE_WRITER_ALIGN * CAPTURE_WRITER_ALIGN;
+	sequence = 0;
+	total_bytes = 0;
+	stall_us = 0;
+	failed = false;
+
+	size_t size = (size_t)CAPTURE_WRITER_BLOCKS * CAPTURE_WRITER_BLOCK_SIZE;
+#ifdef _WIN32
+	blocks = (unsigned char *)_aligned_malloc(size, CAPTURE_WRITER_ALIGN);
+#else
+	void *memory;
+	blocks = posix_memalign(&memory, CAPTURE_WRITER_ALIGN, size) == 0 ? (unsigned char *)memory : NULL;
+#endif
+	if (blocks == NULL)
+		return false;
+	memset(busy, 0, sizeof(busy));
+	current = 0;
+	filled = 0;
+	ring_wrote = false;
+	ring_unsupported = false;
+
+	// without io_uring every block is written before write() returns
+	ring.open(2 * CAPTURE_WRITER_BLOCKS);
+	return open_file();
+}
+
+bool capture_writer::open_file()
+{
+	std::string name = rotate_bytes != 0 ? capture_sequence_filename(base.c_str(), sequence) : base;
+	sequence++;
+	file_bytes = 0;
+	allocated = 0;
+
+#ifdef _WIN32
+	file = CreateFileA(name.c_str(), GENERIC_WRITE, 0, NULL, CREATE_ALWAYS, FILE_FLAG_NO_BUFFERING, NULL);
+	if (file == INVALID_HANDLE_VALUE)
+		return false;
+#else
+	direct = true;
+	fd = ::open(name.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_DIRECT, 0644);
+	if (fd < 0 && errno == EINVAL) {
+		// the file system does not do direct I/O (tmpfs)
+		direct = false;
+		fd = ::open(name.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+	}
+	if (fd < 0)
+		return false;
+#endif
+	preallocate();
+
+	// the block is empty: flushed by close_file(), or not used yet
+	memcpy(blocks + (size_t)current * CAPTURE_WRITER_BLOCK_SIZE, header.data(), header.size());
+	filled = header.size();
+	return true;
+}
+
+// Reserve the rest of the file, or the next CAPTURE_WRITER_ROTATE_BYTES of
+// it when not rotating, without changing its size
+void capture_writer::preallocate()
+{
+	uint64_t size = rotate_bytes != 0 ? rotate_bytes : file_bytes + CAPTURE_WRITER_ROTATE_BYTES;
+	if (size <= allocated)
+		return;
+#ifdef _WIN32
+	FILE_ALLOCATION_INFO info;
+	info.AllocationSize.QuadPart = (LONGLONG)size;
+	SetFileInformationByHandle(file, FileAllocationInfo, &info, sizeof(info));
+#elif defined(__linux__)
+	// not every file system can; the writes still work without it
+	fallocate(fd, FALLOC_FL_KEEP_SIZE, (off_t)allocated, (off_t)(size - allocated));
+#endif
+	allocated = size;
+}
+
+bool capture_writer::write_at(const unsigned char *data, size_t size, uint64_t offset)
+{
+#ifdef _WIN32
+	OVERLAPPED position;
+	memset(&position, 0, sizeof(position));
+	position.Offset = (DWORD)offset;
+	position.OffsetHigh = (DWORD)(offset >> 32);
+	DWORD written;
+	return WriteFile(file, data, (DWORD)size, &written, &position) && written == size;
+#else
+	while (size > 0) {
+		ssize_t n = pwrite(fd, data, size, (off_t)offset);
+		if (n < 0 && errno == EINTR)
+			continue;
+		if (n <= 0)
+			return false;
+		data += n;
+		size -= (size_t)n;
+		offset += (uint64_t)n;
+	}
+	return true;
+#endif
+}
+
+bool capture_writer::flush_block()
+{
+	if (filled == 0)
+		return !failed;
+
+	uint64_t start = now_us();
+
+	// direct writes are whole sectors; the padding is cut off by close_file()
+	unsigned char *block = blocks + (size_t)current * CAPTURE_WRITER_BLOCK_SIZE;
+	size_t size = (filled + CAPTURE_WRITER_ALIGN - 1) / CAPTURE_WRITER_ALIGN * CAPTURE_WRITER_ALIGN;
+	memset(block + filled, 0, size - filled);
+
+	if (rotate_bytes == 0 && file_bytes + size > allocated)
+		preallocate();
+#ifndef _WIN32
+	if (ring.is_open()) {
+		if (!ring.prepare_write(fd, block, (unsigned int)size, file_bytes, current) || !ring.submit())
+			failed = true;
+		else
+			busy[current] = true;
+		block_bytes[current] = size;
+		block_offset[current] = file_bytes;
+	} else
+#endif
+	if (!write_at(block, size, file_bytes))
+		failed = true;
+
+	file_bytes += filled;
+	filled = 0;
+	current = (current + 1) % CAPTURE_WRITER_BLOCKS;
+	wait_block(current);
+
+	uint64_t took = now_us() - start;
+	if (took > stall_us)
+		stall_us = took;
+	return !failed;
+}
+
+// Collect finished writes until block b is free. If the kernel turns
+// out not to have io_uring writes, all the blocks still out are collected
+// and written with pwrite(), and the ring is closed.
+bool capture_writer::wait_block(unsigned int b)
+{
+	for (;;) {
+		uint64_t user;
+		int result;
+		while (ring.next_completion(&user, &result)) {
+			busy[user] = false;
+			if (!ring_wrote && write_unsupported(result)) {
+				ring_unsupported = true;
+				if (!write_at(blocks + (size_t)user * CAPTURE_WRITER_BLOCK_SIZE, block_bytes[user], block_offset[user]))
+					failed = true;
+			} else if (result < 0 || (size_t)result != block_bytes[user]) {
+				failed = true;
+			} else {
+				ring_wrote = true;
+			}
+		}
+
+		bool waiting = busy[b];
+		for (unsigned int i = 0; i < CAPTURE_WRITER_BLOCKS && ring_unsupported; i++)
+			waiting = waiting || busy[i];
+		if (!waiting)
+			break;
+		if (!ring.submit(1)) {
+			failed = true;
+			return false;
+		}
+	}
+	if (ring_unsupported && ring.is_open())
+		ring.close();
+	return !failed;
+}
+
+bool capture_writer::close_file()
+{
+	bool ok = flush_block();
+	for (unsigned int b = 0; b < CAPTURE_WRITER_BLOCKS; b++)
+		ok = wait_block(b) && ok;
+
+#ifdef _WIN32
+	if (file == INVALID_HANDLE_VALUE)
+		return false;
+	LARGE_INTEGER size;
+	size.QuadPart = (LONGLONG)file_bytes;
+	ok = SetFilePointerEx(file, size, NULL, FILE_BEGIN) && SetEndOfFile(file) && ok;
+	ok = CloseHandle(file) && ok;
+	file = INVALID_HANDLE_VALUE;
+#else
+	if (fd < 0)
+		return false;
+	// drops the sector padding and the space reserved past the end
+	ok = ftruncate(fd, (off_t)file_bytes) == 0 && ok;
+	ok = ::close(fd) == 0 && ok;
+	fd = -1;
+#endif
+	return ok;
+}
+
+bool capture_writer::write(const unsigned char *data, size_t size)
+{
+	while (size > 0 && !failed) {
+		size_t room = CAPTURE_WRITER_BLOCK_SIZE - filled;
+		if (rotate_bytes != 0 && rotate_bytes - file_bytes - filled < room)
+			room = (size_t)(rotate_bytes - file_bytes - filled);
+		size_t n = size < room ? size : room;
+
+		memcpy(blocks + (size_t)current * CAPTURE_WRITER_BLOCK_SIZE + filled, data, n);
+		filled += n;
+		data += n;
+		size -= n;
+		total_bytes += n;
+
+		if (rotate_bytes != 0 && file_bytes + filled == rotate_bytes) {
+			if (!close_file() || !open_file())
+				failed = true;
+		} else if (filled == CAPTURE_WRITER_BLOCK_SIZE) {
+			flush_block();
+		}
+	}
+	return !failed;
+}
+
+bool capture_writer::close()
+{
+	if (blocks == NULL)
+		return !failed;
+
+	bool ok = close_file() && !failed;
+	ring.close();
+#ifdef _WIN32
+	_aligned_free(blocks);
+#else
+	free(blocks);
+#endif
+	blocks = NULL;
+	return ok;
+}
+
+bool capture_writer_sink(const unsigned char *buffer, size_t size, void *context)
+{
+	return static_cast<capture_writer *>(context)->write(buffer, size);
+}
@@ -0,0 +1,96 @@
+#pragma once
+
+// Direct-to-disk capture writer.
+// Records are gathered into aligned blocks and written around the page cache
+// (O_DIRECT, or FILE_FLAG_NO_BUFFERING on Windows) to files whose space is
+// allocated up front, so a long capture neither fills memory with dirty
+// pages nor extends the file while it streams. On Linux the blocks are
+// written through io_uring when it is available, several at once, and the
+// caller only waits when all CAPTURE_WRITER_BLOCKS are still being written.
+// A kernel whose io_uring cannot write yet (before 5.6) fails the first
+// writes; those are done again with pwrite(), which then does the rest.
+// Output rotates to a new file every rotate_bytes: "capture.pciacq" becomes
+// "capture.00000000.pciacq", "capture.00000001.pciacq", ...
+// The writer runs on the acquisition's writer thread; used with a pool in
+// drop_when_full mode a slow disk costs dropped buffers, never a stalled read.
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string>
+
+#ifdef _WIN32
+#include <windows.h>
+#endif
+
+#include "io_ring.h"
+
+#define CAPTURE_WRITER_ALIGN 4096
+#define CAPTURE_WRITER_BLOCK_SIZE (1024*1024)
+#define CAPTURE_WRITER_BLOCKS 4
+#define CAPTURE_WRITER_ROTATE_BYTES (1024ULL*1024*1024)
+
+class capture_writer
+{
+public:
+	capture_writer();
+	~capture_writer();
+
+	// rotate_bytes is rounded up to CAPTURE_WRITER_ALIGN; 0 never rotates.
+	// Every file starts with the header_size bytes at header, if any.
+	bool open(const char *filename, uint64_t rotate_bytes = CAPTURE_WRITER_ROTATE_BYTES,
+		const void *header = NULL, size_t header_size = 0);
+	bool write(const unsigned char *data, size_t size);
+	// Write what is left and trim the last file to its real size
+	bool close();
+
+	unsigned int files() const { return sequence; }
+	uint64_t bytes() const { return total_bytes; }
+	bool using_io_ring() const { return ring.is_open(); }
+#ifndef _WIN32
+	bool direct_io() const { return direct; }
+#endif
+	// Longest time spent handing over a block, waiting for a free one
+	// included, in microseconds
+	uint64_t longest_stall() const { return stall_us; }
+
+private:
+	bool open_file();
+	bool close_file();
+	void preallocate();
+	bool flush_block();
+	bool wait_block(unsigned int b);
+	bool write_at(const unsigned char *data, size_t size, uint64_t offset);
+
+	std::string base;
+	std::string header;
+	uint64_t rotate_bytes;
+	unsigned int sequence;		// files opened so far
+	uint64_t file_bytes;		// bytes handed to the current file
+	uint64_t allocated;		// bytes reserved for it
+	uint64_t total_bytes;
+	uint64_t stall_us;
+	bool failed;
+
+	unsigned char *blocks;		// CAPTURE_WRITER_BLOCKS aligned blocks
+	bool busy[CAPTURE_WRITER_BLOCKS];	// being written by io_uring
+	size_t block_bytes[CAPTURE_WRITER_BLOCKS];
+	uint64_t block_offset[CAPTURE_WRITER_BLOCKS];
+	bool ring_wrote;		// io_uring has written a block: it can
+	bool ring_unsupported;		// it cannot, pwrite() takes over
+	unsigned int current;		// block being filled
+	size_t filled;
+
+	io_ring ring;
+#ifdef _WIN32
+	HANDLE file;
+#else
+	int fd;
+	bool direct;
+#endif
+};
+
+// "capture.pciacq", 3 -> "capture.00000003.pciacq"
+std::string capture_sequence_filename(const char *filename, unsigned int sequence);
+
+// acquisition_sink writing to a capture_writer (the context)
+bool capture_writer_sink(const unsigned char *buffer, size_t size, void *context);
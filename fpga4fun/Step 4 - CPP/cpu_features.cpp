@@ -0,0 +1,59 @@
+#include "cpu_features.h"
+
+#ifdef CPU_X86
+
+#ifdef _MSC_VER
+#include <intrin.h>
+#else
+#include <cpuid.h>
+#endif
+
+static void cpu_id(int leaf, int regs[4])
+{
+#ifdef _MSC_VER
+	__cpuidex(regs, leaf, 0);
+#else
+	unsigned int a, b, c, d;
+	__cpuid_count(leaf, 0, a, b, c, d);
+	regs[0] = a; regs[1] = b; regs[2] = c; regs[3] = d;
+#endif
+}
+
+bool cpu_has_sse2()
+{
+	int regs[4];
+	cpu_id(1, regs);
+	return (regs[3] & (1 << 26)) != 0;
+}
+
+bool cpu_has_avx2()
+{
+	int regs[4];
+	cpu_id(0, regs);
+	if (regs[0] < 7)
+		return false;
+
+	// the OS must also save the YMM registers (OSXSAVE, then XCR0 bits 1 and 2)
+	cpu_id(1, regs);
+	if ((regs[2] & (1 << 27)) == 0 || (regs[2] & (1 << 28)) == 0)
+		return false;
+#ifdef _MSC_VER
+	unsigned long long xcr0 = _xgetbv(0);
+#else
+	unsigned int eax, edx;
+	__asm__ __volatile__ ("xgetbv" : "=a"(eax), "=d"(edx) : "c"(0));
+	unsigned long long xcr0 = ((unsigned long long)edx << 32) | eax;
+#endif
+	if ((xcr0 & 6) != 6)
+		return false;
+
+	cpu_id(7, regs);
+	return (regs[1] & (1 << 5)) != 0;
+}
+
+#else
+
+bool cpu_has_sse2() { return false; }
+bool cpu_has_avx2() { return false; }
+
+#endif
@@ -0,0 +1,22 @@
+#pragma once
+
+// Run-time CPU feature checks for the SIMD code paths
+
+#if defined(_M_IX86) || defined(_M_X64) || defined(__i386__) || defined(__x86_64__)
+#define CPU_X86
+#include <emmintrin.h>
+#include <immintrin.h>
+#endif
+
+// GCC and clang only accept SIMD intrinsics in functions built for that
+// instruction set; MSVC accepts them anywhere
+#if defined(__GNUC__)
+#define TARGET_SSE2 __attribute__((target("sse2")))
+#define TARGET_AVX2 __attribute__((target("avx2")))
+#else
+#define TARGET_SSE2
+#define TARGET_AVX2
+#endif
+
+bool cpu_has_sse2();
+bool cpu_has_avx2();
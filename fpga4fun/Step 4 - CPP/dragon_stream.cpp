@@ -0,0 +1,223 @@
+#include <stddef.h>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <pthread.h>
+#include <signal.h>
+#include <atomic>
+#include <chrono>
+#include <thread>
+#endif
+
+#include "dragon_stream.h"
+#include "acquisition.h"
+#include "dragon_transport.h"
+#include "capture_file.h"
+#include "capture_writer.h"
+#include "capture_stream.h"
+#include "capture_decode.h"
+#include "soft_trigger.h"
+#include "trigger_sequencer.h"
+
+#ifdef _WIN32
+
+// Ctrl+C stops the acquisition instead of the process while it is set
+class ctrl_c_hook
+{
+public:
+	explicit ctrl_c_hook(acquisition *stream)
+	{
+		hooked = stream;
+		SetConsoleCtrlHandler(stop, TRUE);
+	}
+	~ctrl_c_hook()
+	{
+		SetConsoleCtrlHandler(stop, FALSE);
+		hooked = NULL;
+	}
+
+private:
+	// called on a thread of its own
+	static BOOL WINAPI stop(DWORD ctrl_type)
+	{
+		if (ctrl_type != CTRL_C_EVENT || hooked == NULL)
+			return FALSE;
+		hooked->stop();
+		return TRUE;
+	}
+
+	static acquisition *hooked;
+};
+
+acquisition *ctrl_c_hook::hooked = NULL;
+
+#else
+
+// Same with SIGINT. acquisition::stop() takes a lock, which a signal handler
+// must not do: SIGINT is blocked in this thread and in the ones started
+// after it, and taken by sigwait() on a thread of its own instead. An
+// ignored SIGINT (a background job) is left alone, sigwait() never sees it.
+class ctrl_c_hook
+{
+public:
+	explicit ctrl_c_hook(acquisition *stream)
+		: stream(stream), hooked(false), done(false)
+	{
+		struct sigaction current;
+		if (sigaction(SIGINT, NULL, &current) != 0 || current.sa_handler == SIG_IGN)
+			return;
+		sigemptyset(&signals);
+		sigaddset(&signals, SIGINT);
+		pthread_sigmask(SIG_BLOCK, &signals, &previous);
+		watcher = std::thread(watch, this);
+		hooked = true;
+	}
+	~ctrl_c_hook()
+	{
+		if (!hooked)
+			return;
+		done = true;
+		pthread_kill(watcher.native_handle(), SIGINT);
+		watcher.join();
+		pthread_sigmask(SIG_SETMASK, &previous, NULL);
+	}
+
+private:
+	static void watch(ctrl_c_hook *self)
+	{
+		int number;
+		while (sigwait(&self->signals, &number) == 0 && !self->done)
+			self->stream->stop();
+	}
+
+	acquisition *stream;
+	bool hooked;
+	sigset_t signals;
+	sigset_t previous;
+	std::atomic<bool> done;
+	std::thread watcher;
+};
+
+#endif
+
+// acquisition_sink handing every buffer to a live_decoder before the sink
+struct live_tee
+{
+	acquisition_sink sink;
+	void *sink_context;
+	live_decoder *live;
+};
+
+static bool live_tee_sink(const unsigned char *buffer, size_t size, void *context)
+{
+	live_tee *tee = static_cast<live_tee *>(context);
+	ring_sink(buffer, size, &tee->live->ring);
+	return tee->sink(buffer, size, tee->sink_context);
+}
+
+static void live_decoder_thread(live_decoder *live)
+{
+	decode_ring(&live->ring, live->callback, live->context, &live->framing, &live->samples);
+}
+
+bool StreamFromDragon(const char *output_filename, uint64_t max_bytes, acquisition_stats *stats,
+	stream_report *fifo_stream, soft_trigger *trigger, live_decoder *live)
+{
+	// unbuffered, preallocated, rotated every CAPTURE_WRITER_ROTATE_BYTES
+	capture_writer writer;
+	// the software trigger also writes .pciacq samples as stream records
+	bool stream_output = fifo_stream != NULL || trigger != NULL;
+	if (!writer.open(output_filename, CAPTURE_WRITER_ROTATE_BYTES,
+		stream_output ? PCISTR_MAGIC : NULL, stream_output ? PCI_RECORD_SIZE : 0))
+		return false;
+	// a board in stream mode pads with empty records when it has nothing to
+	// send; those are dropped before the disk
+	stream_writer filter(&writer);
+	acquisition_sink sink = fifo_stream != NULL ? stream_writer_sink : capture_writer_sink;
+	void *sink_context = fifo_stream != NULL ? (void *)&filter : (void *)&writer;
+	// the software trigger runs on the writer thread, ahead of the disk; in
+	// stream mode on the records the filter cut out, so that the overflows
+	// are still all counted
+	if (trigger != NULL) {
+		trigger->set_stream(fifo_stream != NULL);
+		trigger->set_sink(capture_writer_sink, &writer);
+		if (fifo_stream != NULL) {
+			filter.next = soft_trigger_sink;
+			filter.next_context = trigger;
+		} else {
+			sink = soft_trigger_sink;
+			sink_context = trigger;
+		}
+	}
+	live_tee tee = { sink, sink_context, live };
+	if (live != NULL) {
+		sink = live_tee_sink;
+		sink_context = &tee;
+	}
+
+	// keep DRAGON_READS_IN_FLIGHT 16KB reads queued until max_bytes or Ctrl+C;
+	// if the disk falls behind, reads are dropped rather than delayed
+	acquisition_options options;
+	options.max_bytes = max_bytes;
+	options.drop_when_full = true;
+	acquisition stream(options);
+
+	bool ok;
+	{
+		// set first, so that no thread started after it takes SIGINT
+		ctrl_c_hook hook(&stream);
+		// started after the hook, so that it does not take SIGINT either
+		std::thread decoder;
+		if (live != NULL)
+			decoder = std::thread(live_decoder_thread, live);
+		dragon_transport transport;
+		ok = transport.open() && stream.run_async(&transport, DRAGON_READS_IN_FLIGHT, sink, sink_context);
+		transport.close();
+		if (live != NULL) {
+			live->ring.close();
+			decoder.join();
+		}
+	}
+
+	*stats = stream.stats();
+	if (fifo_stream != NULL) {
+		filter.parser.finish();
+		filter.report.dropped_bytes = filter.parser.dropped_bytes();
+		*fifo_stream = filter.report;
+	}
+	// the skip record after the last window
+	if (trigger != NULL && !trigger->finish())
+		ok = false;
+	return writer.close() && ok;
+}
+
+bool CaptureTriggerFromDragon(const char *output_filename, const trigger_program *program,
+	unsigned int post_entries, acquisition_stats *stats, capture_status *status)
+{
+	la_registers registers;
+	if (!registers.open())
+		return false;
+	// the post-trigger count first, see set_post_trigger()
+	set_post_trigger(&registers, post_entries);
+	if (program != NULL)
+		load_trigger(&registers, *program);
+	else
+		disable_trigger(&registers);
+	for (;;) {
+		*status = read_capture_status(&registers);
+		if (status->done)
+			break;
+#ifdef _WIN32
+		Sleep(10);
+#else
+		std::this_thread::sleep_for(std::chrono::milliseconds(10));
+#endif
+	}
+	registers.close();
+
+	// the board sends RAM_LA over and over; one read holds all of it
+	if (!StreamFromDragon(output_filename, ACQUISITION_BUFFER_SIZE, stats))
+		return false;
+	return write_trigger_entry(capture_sequence_filename(output_filename, 0).c_str(), status->trigger_entry);
+}
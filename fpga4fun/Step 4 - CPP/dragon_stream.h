@@ -0,0 +1,60 @@
+#pragma once
+
+// Streaming acquisition from the Dragon board, the same on Windows and Linux:
+// dragon_transport keeps several 16KB reads in flight (the board's driver on
+// Windows, usbfs on Linux) and the acquisition's writer thread takes them to
+// disk. Ctrl+C stops it cleanly, through SetConsoleCtrlHandler() on Windows
+// and SIGINT on Linux.
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "framing_check.h"
+#include "record_ring.h"
+#include "transaction_decoder.h"
+
+struct acquisition_stats;
+struct stream_report;
+class soft_trigger;
+struct trigger_program;
+struct capture_status;
+
+#define DRAGON_READS_IN_FLIGHT 4
+
+// Stream 16KB USB reads until max_bytes (0: no limit) or Ctrl+C, with a
+// writer thread draining a pool of buffers to output_filename, rotated as
+// output.00000000.pciacq, output.00000001.pciacq, ... (see capture_writer).
+// With fifo_stream, the board is built with STREAM_CAPTURE: the output is a
+// .pcistr stream (see capture_stream.h) and *fifo_stream gets its overflows.
+// With trigger, only the windows around its hits are written, in either mode,
+// as a .pcistr stream with the gaps between them marked (see soft_trigger.h).
+// With live, the transactions are also decoded as the capture runs (see
+// live_decoder).
+struct live_decoder;
+bool StreamFromDragon(const char *output_filename, uint64_t max_bytes, acquisition_stats *stats,
+	stream_report *fifo_stream = NULL, soft_trigger *trigger = NULL, live_decoder *live = NULL);
+
+// One capture of RAM_LA around the board's trigger (see trigger_sequencer.h):
+// sets the post-trigger entries, loads program (NULL: any transaction, as
+// the original design), waits for the capture to be done, then reads it as
+// one 16KB dump to output.00000000.pciacq, with its trigger entry in the
+// .pcitrg next to it. Needs the board's registers in the PCI IO space, so
+// root on Linux.
+bool CaptureTriggerFromDragon(const char *output_filename, const trigger_program *program,
+	unsigned int post_entries, acquisition_stats *stats, capture_status *status);
+
+// Decoding while capturing: every record read also goes to ring, before the
+// trigger, and decode_ring() takes them to callback on a thread of its own
+// until the capture ends. A decoder that falls behind holds the writer
+// thread back, and reads are then dropped and counted as when the disk is
+// slow.
+struct live_decoder
+{
+	record_ring ring;
+	transaction_callback callback;
+	void *context;
+	framing_report framing;
+	uint64_t samples;
+
+	live_decoder(transaction_callback callback, void *context) : callback(callback), context(context), samples(0) {}
+};
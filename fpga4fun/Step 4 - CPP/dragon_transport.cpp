@@ -0,0 +1,370 @@
+#include <string.h>
+
+#include "dragon_transport.h"
+
+#define DRAGON_PIPE_REQUEST 6
+#define DRAGON_PIPE_DATA 3
+
+#ifdef _WIN32
+
+#include <tchar.h>
+
+// see USB_BulkWrite() and USB_BulkRead()
+#define DRAGON_IOCTL_BULK_WRITE 0x222051
+#define DRAGON_IOCTL_BULK_READ 0x22204E
+
+dragon_transport::dragon_transport()
+	: device(INVALID_HANDLE_VALUE)
+{
+	memset(slots, 0, sizeof(slots));
+}
+
+dragon_transport::~dragon_transport()
+{
+	close();
+}
+
+bool dragon_transport::open()
+{
+	close();
+	device = CreateFile(_T("\\\\.\\DRAGON_USB-0"), GENERIC_WRITE, FILE_SHARE_WRITE, NULL, OPEN_EXISTING, FILE_FLAG_OVERLAPPED, NULL);
+	if (device == INVALID_HANDLE_VALUE)
+		return false;
+
+	free_slots.clear();
+	for (int s = DRAGON_MAX_IN_FLIGHT - 1; s >= 0; s--) {
+		slots[s].request_done.hEvent = CreateEvent(NULL, TRUE, FALSE, NULL);
+		slots[s].read_done.hEvent = CreateEvent(NULL, TRUE, FALSE, NULL);
+		free_slots.push_back(&slots[s]);
+	}
+	return true;
+}
+
+void dragon_transport::close()
+{
+	if (device == INVALID_HANDLE_VALUE)
+		return;
+
+	// nothing may still point into the slots once they are gone
+	CancelIo(device);
+	while (wait_completion() != NULL)
+		;
+	for (int s = 0; s < DRAGON_MAX_IN_FLIGHT; s++) {
+		CloseHandle(slots[s].request_done.hEvent);
+		CloseHandle(slots[s].read_done.hEvent);
+	}
+	memset(slots, 0, sizeof(slots));
+	free_slots.clear();
+	CloseHandle(device);
+	device = INVALID_HANDLE_VALUE;
+}
+
+static bool started(BOOL result)
+{
+	return result || GetLastError() == ERROR_IO_PENDING;
+}
+
+bool dragon_transport::submit_read(usb_transfer *transfer)
+{
+	if (device == INVALID_HANDLE_VALUE || free_slots.empty() || transfer->size == 0 || transfer->size > 0xFFFF)
+		return false;
+
+	slot *s = free_slots.back();
+	s->transfer = transfer;
+	s->request_pipe = DRAGON_PIPE_REQUEST;
+	s->read_pipe = DRAGON_PIPE_DATA;
+	s->request = (WORD)transfer->size;
+	ResetEvent(s->request_done.hEvent);
+	ResetEvent(s->read_done.hEvent);
+
+	transfer->transferred = 0;
+	transfer->ok = false;
+	transfer->submitted = transport_clock();
+
+	// the board answers pipe-3 reads in the order of the pipe-6 requests
+	DWORD n;
+	if (!started(DeviceIoControl(device, DRAGON_IOCTL_BULK_WRITE, &s->request_pipe, sizeof(s->request_pipe),
+			&s->request, sizeof(s->request), &n, &s->request_done)))
+		return false;
+	if (!started(DeviceIoControl(device, DRAGON_IOCTL_BULK_READ, &s->read_pipe, sizeof(s->read_pipe),
+			transfer->buffer, (DWORD)transfer->size, &n, &s->read_done))) {
+		GetOverlappedResult(device, &s->request_done, &n, TRUE);
+		return false;
+	}
+
+	free_slots.pop_back();
+	in_flight.push_back(s);
+	return true;
+}
+
+usb_transfer *dragon_transport::wait_completion()
+{
+	if (in_flight.empty())
+		return NULL;
+
+	slot *s = in_flight.front();
+	in_flight.pop_front();
+
+	DWORD requested = 0, n = 0;
+	BOOL request_ok = GetOverlappedResult(device, &s->request_done, &requested, TRUE);
+	BOOL read_ok = GetOverlappedResult(device, &s->read_done, &n, TRUE);
+
+	usb_transfer *transfer = s->transfer;
+	transfer->completed = transport_clock();
+	transfer->transferred = n;
+	// a short read is not an error: the bytes that arrived go on
+	transfer->ok = request_ok && read_ok && requested == sizeof(s->request);
+	free_slots.push_back(s);
+	return transfer;
+}
+
+unsigned int dragon_transport::outstanding() const
+{
+	return (unsigned int)in_flight.size();
+}
+
+#else
+
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <sys/ioctl.h>
+#include <unistd.h>
+#include <linux/usb/ch9.h>
+
+dragon_transport::dragon_transport()
+	: device(-1), interface_number(0), request_endpoint(0), read_endpoint(0)
+{
+}
+
+dragon_transport::~dragon_transport()
+{
+	close();
+}
+
+static bool read_sysfs_number(const char *dir, const char *name, int base, unsigned int *value)
+{
+	char path[512];
+	snprintf(path, sizeof(path), "/sys/bus/usb/devices/%s/%s", dir, name);
+	FILE *F = fopen(path, "r");
+	if (F == NULL)
+		return false;
+	bool ok = fscanf(F, base == 16 ? "%x" : "%u", value) == 1;
+	fclose(F);
+	return ok;
+}
+
+bool dragon_transport::open()
+{
+	close();
+
+	// find the board's bus and device number
+	DIR *devices = opendir("/sys/bus/usb/devices");
+	if (devices == NULL)
+		return false;
+	char path[64] = "";
+	struct dirent *entry;
+	while ((entry = readdir(devices)) != NULL) {
+		unsigned int vendor, product, bus, address;
+		if (read_sysfs_number(entry->d_name, "idVendor", 16, &vendor) && vendor == DRAGON_USB_VENDOR
+			&& read_sysfs_number(entry->d_name, "idProduct", 16, &product) && product == DRAGON_USB_PRODUCT
+			&& read_sysfs_number(entry->d_name, "busnum", 10, &bus)
+			&& read_sysfs_number(entry->d_name, "devnum", 10, &address)) {
+			snprintf(path, sizeof(path), "/dev/bus/usb/%03u/%03u", bus, address);
+			break;
+		}
+	}
+	closedir(devices);
+	if (path[0] == 0)
+		return false;
+
+	device = ::open(path, O_RDWR | O_CLOEXEC);
+	if (device < 0)
+		return false;
+	if (!find_pipes()) {
+		close();
+		return false;
+	}
+
+	free_slots.clear();
+	for (int s = DRAGON_MAX_IN_FLIGHT - 1; s >= 0; s--)
+		free_slots.push_back(&slots[s]);
+	return true;
+}
+
+// The Windows driver numbers pipes in endpoint descriptor order within the
+// interface; take the first setting of interface 0 that has pipes up to 6.
+bool dragon_transport::find_pipes()
+{
+	// reading usbfs returns the device descriptor and then the configurations
+	unsigned char descriptors[4096];
+	ssize_t size = read(device, descriptors, sizeof(descriptors));
+	if (size < (ssize_t)sizeof(usb_device_descriptor))
+		return false;
+
+	bool found = false;
+	unsigned int alternate = 0, endpoints = 0;
+	unsigned char addresses[DRAGON_PIPE_REQUEST + 1];
+	bool in_candidate = false;
+	for (ssize_t p = descriptors[0]; p + 2 <= size && descriptors[p] >= 2 && !found; p += descriptors[p]) {
+		if (descriptors[p + 1] == USB_DT_INTERFACE && p + USB_DT_INTERFACE_SIZE <= size) {
+			const usb_interface_descriptor *d = (const usb_interface_descriptor *)(descriptors + p);
+			in_candidate = d->bInterfaceNumber == 0 && d->bNumEndpoints > DRAGON_PIPE_REQUEST;
+			alternate = d->bAlternateSetting;
+			endpoints = 0;
+		} else if (descriptors[p + 1] == USB_DT_ENDPOINT && in_candidate) {
+			addresses[endpoints++] = ((const usb_endpoint_descriptor *)(descriptors + p))->bEndpointAddress;
+			found = endpoints > DRAGON_PIPE_REQUEST;
+		}
+	}
+	if (!found)
+		return false;
+	request_endpoint = addresses[DRAGON_PIPE_REQUEST];
+	read_endpoint = addresses[DRAGON_PIPE_DATA];
+
+	interface_number = 0;
+	if (ioctl(device, USBDEVFS_CLAIMINTERFACE, &interface_number) < 0)
+		return false;
+	if (alternate != 0) {
+		usbdevfs_setinterface setting;
+		setting.interface = interface_number;
+		setting.altsetting = alternate;
+		if (ioctl(device, USBDEVFS_SETINTERFACE, &setting) < 0)
+			return false;
+	}
+	return true;
+}
+
+void dragon_transport::close()
+{
+	if (device < 0)
+		return;
+
+	// nothing may still point into the slots once they are gone
+	for (size_t i = 0; i < in_flight.size(); i++)
+		discard(in_flight[i], in_flight[i]->urbs.size());
+	while (wait_completion() != NULL)
+		;
+	ioctl(device, USBDEVFS_RELEASEINTERFACE, &interface_number);
+	::close(device);
+	device = -1;
+	free_slots.clear();
+}
+
+// Reap one finished URB, of whichever slot
+bool dragon_transport::reap_one()
+{
+	usbdevfs_urb *urb;
+	int result;
+	while ((result = ioctl(device, USBDEVFS_REAPURB, &urb)) < 0 && errno == EINTR)
+		;
+	if (result < 0)
+		return false;
+
+	// a short read of data is not an error, a short request is
+	slot *s = static_cast<slot *>(urb->usercontext);
+	if (urb->status != 0 || (urb->endpoint == request_endpoint && urb->actual_length != urb->buffer_length))
+		s->failed = true;
+	s->pending--;
+	return true;
+}
+
+void dragon_transport::discard(slot *s, size_t submitted)
+{
+	for (size_t u = 0; u < submitted; u++)
+		ioctl(device, USBDEVFS_DISCARDURB, &s->urbs[u]);
+}
+
+bool dragon_transport::submit_read(usb_transfer *transfer)
+{
+	if (device < 0 || free_slots.empty() || transfer->size == 0)
+		return false;
+
+	// one pipe-6 request and one pipe-3 read per piece
+	slot *s = free_slots.back();
+	size_t pieces = (transfer->size + DRAGON_READ_PIECE - 1) / DRAGON_READ_PIECE;
+	s->transfer = transfer;
+	s->urbs.resize(2 * pieces);
+	s->requests.resize(2 * pieces);
+	s->pending = 0;
+	s->failed = false;
+	memset(&s->urbs[0], 0, s->urbs.size() * sizeof(usbdevfs_urb));
+	for (size_t p = 0; p < pieces; p++) {
+		size_t offset = p * DRAGON_READ_PIECE;
+		size_t length = transfer->size - offset < DRAGON_READ_PIECE ? transfer->size - offset : DRAGON_READ_PIECE;
+		s->requests[2 * p] = (unsigned char)length;
+		s->requests[2 * p + 1] = (unsigned char)(length >> 8);
+
+		usbdevfs_urb &request = s->urbs[2 * p];
+		request.type = USBDEVFS_URB_TYPE_BULK;
+		request.endpoint = request_endpoint;
+		request.buffer = &s->requests[2 * p];
+		request.buffer_length = 2;
+		request.usercontext = s;
+
+		usbdevfs_urb &data = s->urbs[2 * p + 1];
+		data.type = USBDEVFS_URB_TYPE_BULK;
+		data.endpoint = read_endpoint;
+		data.buffer = transfer->buffer + offset;
+		data.buffer_length = (int)length;
+		data.usercontext = s;
+	}
+
+	transfer->transferred = 0;
+	transfer->ok = false;
+	transfer->submitted = transport_clock();
+
+	for (size_t u = 0; u < s->urbs.size(); u++) {
+		if (ioctl(device, USBDEVFS_SUBMITURB, &s->urbs[u]) < 0) {
+			// take back what was submitted before the slot is reused
+			discard(s, u);
+			while (s->pending > 0 && reap_one())
+				;
+			return false;
+		}
+		s->pending++;
+	}
+
+	free_slots.pop_back();
+	in_flight.push_back(s);
+	return true;
+}
+
+usb_transfer *dragon_transport::wait_completion()
+{
+	if (in_flight.empty())
+		return NULL;
+
+	slot *s = in_flight.front();
+	in_flight.pop_front();
+	while (s->pending > 0) {
+		if (!reap_one()) {
+			s->failed = true;
+			break;
+		}
+	}
+
+	// the bytes of the pieces that came back short are moved together
+	usb_transfer *transfer = s->transfer;
+	transfer->completed = transport_clock();
+	transfer->transferred = 0;
+	for (size_t u = 1; u < s->urbs.size(); u += 2) {
+		unsigned char *to = transfer->buffer + transfer->transferred;
+		if (s->urbs[u].actual_length > 0 && to != s->urbs[u].buffer)
+			memmove(to, s->urbs[u].buffer, s->urbs[u].actual_length);
+		transfer->transferred += s->urbs[u].actual_length;
+	}
+	transfer->ok = !s->failed;
+	// a slot with URBs the kernel still holds is never reused
+	if (s->pending == 0)
+		free_slots.push_back(s);
+	return transfer;
+}
+
+unsigned int dragon_transport::outstanding() const
+{
+	return (unsigned int)in_flight.size();
+}
+
+#endif
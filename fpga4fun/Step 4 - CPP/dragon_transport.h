@@ -0,0 +1,82 @@
+#pragma once
+
+// usb_transport for the Dragon board's USB pipes.
+// Every read is a request on pipe 6 (the byte count) followed by a bulk read
+// on pipe 3, both issued asynchronously so several reads can be outstanding.
+// On Windows this goes through the board's driver with overlapped
+// DeviceIoControl calls. On Linux it goes straight to usbfs with URBs, and a
+// read may be any size: it is scattered over requests of DRAGON_READ_PIECE
+// bytes into consecutive parts of the buffer.
+
+#include <deque>
+#include <vector>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <linux/usbdevice_fs.h>
+#endif
+
+#include "usb_transport.h"
+
+#define DRAGON_MAX_IN_FLIGHT 32
+
+// USB IDs of the board, from DragnUSB.inf
+#define DRAGON_USB_VENDOR 0x0547
+#define DRAGON_USB_PRODUCT 0x2131
+// Largest pipe-6 request, and piece of a larger read on Linux
+#define DRAGON_READ_PIECE (64*256)
+
+class dragon_transport : public usb_transport
+{
+public:
+	dragon_transport();
+	~dragon_transport();
+
+	bool open();
+	void close();
+
+	// On Windows size is at most 65535 bytes, the request on pipe 6 is 16 bits
+	bool submit_read(usb_transfer *transfer);
+	usb_transfer *wait_completion();
+	unsigned int outstanding() const;
+
+private:
+#ifdef _WIN32
+	struct slot
+	{
+		usb_transfer *transfer;
+		ULONG request_pipe;
+		ULONG read_pipe;
+		WORD request;
+		OVERLAPPED request_done;
+		OVERLAPPED read_done;
+	};
+
+	HANDLE device;
+	slot slots[DRAGON_MAX_IN_FLIGHT];
+	std::vector<slot *> free_slots;
+	std::deque<slot *> in_flight;
+#else
+	struct slot
+	{
+		usb_transfer *transfer;
+		std::vector<usbdevfs_urb> urbs;		// request and read for each piece
+		std::vector<unsigned char> requests;	// 16-bit little-endian byte counts
+		size_t pending;				// URBs not reaped yet
+		bool failed;
+	};
+
+	bool find_pipes();
+	bool reap_one();
+	void discard(slot *s, size_t submitted);
+
+	int device;
+	unsigned int interface_number;
+	unsigned char request_endpoint;
+	unsigned char read_endpoint;
+	slot slots[DRAGON_MAX_IN_FLIGHT];
+	std::vector<slot *> free_slots;
+	std::deque<slot *> in_flight;
+#endif
+};
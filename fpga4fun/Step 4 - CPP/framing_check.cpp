@@ -0,0 +1,127 @@
+#include <string.h>
+#include <mutex>
+
+#include "framing_check.h"
+#include "capture_file.h"
+#include "cpu_features.h"
+
+// Number of consecutive framed records at p, up to max
+static size_t framed_count_scalar(const unsigned char *p, size_t max)
+{
+	size_t n = 0;
+	while (n < max && p[n * PCI_RECORD_SIZE + 6] == 0x01 && p[n * PCI_RECORD_SIZE + 7] == 0x02)
+		n++;
+	return n;
+}
+
+#ifdef CPU_X86
+
+// Compare 2 records per load against a pattern with 0x01 0x02 in bytes 6 and 7
+// of each record; only those byte positions of the compare mask matter.
+TARGET_SSE2 static size_t framed_count_sse2(const unsigned char *p, size_t max)
+{
+	const __m128i pattern = _mm_set_epi32(0x02010000, 0, 0x02010000, 0);
+	size_t n = 0;
+
+	for (; n + 4 <= max; n += 4) {
+		const __m128i *q = (const __m128i *)(p + n * PCI_RECORD_SIZE);
+		int m0 = _mm_movemask_epi8(_mm_cmpeq_epi8(_mm_loadu_si128(q), pattern));
+		int m1 = _mm_movemask_epi8(_mm_cmpeq_epi8(_mm_loadu_si128(q + 1), pattern));
+		if ((m0 & m1 & 0xC0C0) != 0xC0C0)
+			break;
+	}
+	return n + framed_count_scalar(p + n * PCI_RECORD_SIZE, max - n);
+}
+
+TARGET_AVX2 static size_t framed_count_avx2(const unsigned char *p, size_t max)
+{
+	const __m256i pattern = _mm256_set_epi32(0x02010000, 0, 0x02010000, 0, 0x02010000, 0, 0x02010000, 0);
+	size_t n = 0;
+
+	for (; n + 8 <= max; n += 8) {
+		const __m256i *q = (const __m256i *)(p + n * PCI_RECORD_SIZE);
+		__m256i ok = _mm256_and_si256(_mm256_cmpeq_epi8(_mm256_loadu_si256(q), pattern),
+			_mm256_cmpeq_epi8(_mm256_loadu_si256(q + 1), pattern));
+		if (((unsigned int)_mm256_movemask_epi8(ok) & 0xC0C0C0C0) != 0xC0C0C0C0)
+			break;
+	}
+	return n + framed_count_scalar(p + n * PCI_RECORD_SIZE, max - n);
+}
+
+#endif
+
+typedef size_t (*framed_count_fn)(const unsigned char *, size_t);
+
+static framed_count_fn count_fn;
+static std::once_flag count_fn_chosen;
+
+static void select_framed_count()
+{
+	count_fn = framed_count_scalar;
+#ifdef CPU_X86
+	if (cpu_has_avx2())
+		count_fn = framed_count_avx2;
+	else if (cpu_has_sse2())
+		count_fn = framed_count_sse2;
+#endif
+}
+
+// Selected on first use, once for all the threads checking captures (with
+// call_once: Visual C++ before 2015 does not guard function-local statics)
+static size_t framed_count(const unsigned char *p, size_t max)
+{
+	std::call_once(count_fn_chosen, select_framed_count);
+	return count_fn(p, max);
+}
+
+// Find the first offset >= from where FRAMING_LOCK_RECORDS framed records
+// follow (or fewer, if that many do not fit before the end of the buffer).
+// Returns size if there is none.
+static size_t find_lock(const unsigned char *buf, size_t size, size_t from)
+{
+	while (from + PCI_RECORD_SIZE <= size) {
+		// next 0x01 0x02 pair that could end a record starting at or after from
+		const unsigned char *m = (const unsigned char *)memchr(buf + from + 6, 0x01, size - from - 7);
+		if (m == NULL)
+			break;
+		size_t candidate = (m - buf) - 6;
+		if (m[1] == 0x02) {
+			size_t avail = (size - candidate) / PCI_RECORD_SIZE;
+			size_t need = avail < FRAMING_LOCK_RECORDS ? avail : FRAMING_LOCK_RECORDS;
+			if (framed_count(buf + candidate, need) == need)
+				return candidate;
+		}
+		from = candidate + 1;
+	}
+	return size;
+}
+
+static void add_dropped(framing_report *report, uint64_t offset, uint64_t length)
+{
+	framing_range range = { offset, length };
+	report->dropped.push_back(range);
+	report->dropped_bytes += length;
+}
+
+void check_framing(const unsigned char *buf, size_t size, uint64_t base, framing_report *report)
+{
+	size_t pos = 0;
+	while (size - pos >= PCI_RECORD_SIZE) {
+		size_t n = framed_count(buf + pos, (size - pos) / PCI_RECORD_SIZE);
+		if (n > 0) {
+			framing_range run = { base + pos, n * PCI_RECORD_SIZE };
+			report->runs.push_back(run);
+			report->records += n;
+			pos += n * PCI_RECORD_SIZE;
+			continue;
+		}
+
+		// lost the record phase, drop bytes up to where it can be found again
+		size_t lock = find_lock(buf, size, pos + 1);
+		add_dropped(report, base + pos, lock - pos);
+		pos = lock;
+	}
+
+	if (pos < size)
+		add_dropped(report, base + pos, size - pos);
+}
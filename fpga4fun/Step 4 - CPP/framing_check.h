@@ -0,0 +1,38 @@
+#pragma once
+
+// Framing check for raw capture data.
+// Every record ends in the bytes 0x01 0x02. When a USB bulk read comes back
+// short, everything after it is shifted and no longer 8-byte aligned.
+// check_framing() finds the runs of well-framed records, re-locks onto the
+// record phase after a slip, and reports the byte ranges it had to drop.
+// Boards that store a clock counter in those two bytes instead send timed
+// records, which are parsed with the stream records (see capture_stream.h).
+
+#include <stddef.h>
+#include <stdint.h>
+#include <vector>
+
+// Consecutive framed records needed to re-lock after a slip, so that 0x01 0x02
+// bytes in the AD payload are not taken for a record boundary
+#define FRAMING_LOCK_RECORDS 4
+
+struct framing_range
+{
+	uint64_t offset;	// bytes
+	uint64_t length;	// bytes
+};
+
+struct framing_report
+{
+	std::vector<framing_range> runs;	// well-framed records, usable in place
+	std::vector<framing_range> dropped;	// bytes skipped to get back in phase
+	uint64_t records;
+	uint64_t dropped_bytes;
+
+	framing_report() : records(0), dropped_bytes(0) {}
+};
+
+// Check size bytes at buf, and append the runs and dropped ranges found to
+// *report. base is added to the reported offsets (e.g. the file offset of
+// buf), so a report can be built up over consecutive buffers.
+void check_framing(const unsigned char *buf, size_t size, uint64_t base, framing_report *report);
@@ -0,0 +1,185 @@
+#include <string.h>
+
+#include "io_ring.h"
+
+#if defined(__linux__)
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#if defined(__NR_io_uring_setup)
+#include <linux/io_uring.h>
+#define IO_RING_SUPPORTED
+#endif
+#endif
+
+io_ring::io_ring()
+	: ring_fd(-1), sq_ring(NULL), sq_ring_size(0), cq_ring(NULL), cq_ring_size(0), sqes(NULL), sqes_size(0),
+	sq_head(NULL), sq_tail(NULL), sq_mask(NULL), sq_array(NULL), cq_head(NULL), cq_tail(NULL), cq_mask(NULL), cqes(NULL),
+	prepared(0), outstanding(0)
+{
+}
+
+io_ring::~io_ring()
+{
+	close();
+}
+
+#ifdef IO_RING_SUPPORTED
+
+bool io_ring::open(unsigned int entries)
+{
+	close();
+
+	io_uring_params params;
+	memset(&params, 0, sizeof(params));
+	int fd = (int)syscall(__NR_io_uring_setup, entries, &params);
+	if (fd < 0)
+		return false;
+	ring_fd = fd;
+
+	sq_ring_size = params.sq_off.array + params.sq_entries * sizeof(unsigned int);
+	cq_ring_size = params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+	sqes_size = params.sq_entries * sizeof(io_uring_sqe);
+
+	sq_ring = mmap(NULL, sq_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring_fd, IORING_OFF_SQ_RING);
+	cq_ring = mmap(NULL, cq_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring_fd, IORING_OFF_CQ_RING);
+	sqes = mmap(NULL, sqes_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring_fd, IORING_OFF_SQES);
+	if (sq_ring == MAP_FAILED || cq_ring == MAP_FAILED || sqes == MAP_FAILED) {
+		if (sq_ring == MAP_FAILED) sq_ring = NULL;
+		if (cq_ring == MAP_FAILED) cq_ring = NULL;
+		if (sqes == MAP_FAILED) sqes = NULL;
+		close();
+		return false;
+	}
+
+	unsigned char *sq = (unsigned char *)sq_ring;
+	unsigned char *cq = (unsigned char *)cq_ring;
+	sq_head = (unsigned int *)(sq + params.sq_off.head);
+	sq_tail = (unsigned int *)(sq + params.sq_off.tail);
+	sq_mask = (unsigned int *)(sq + params.sq_off.ring_mask);
+	sq_array = (unsigned int *)(sq + params.sq_off.array);
+	cq_head = (unsigned int *)(cq + params.cq_off.head);
+	cq_tail = (unsigned int *)(cq + params.cq_off.tail);
+	cq_mask = (unsigned int *)(cq + params.cq_off.ring_mask);
+	cqes = cq + params.cq_off.cqes;
+	prepared = 0;
+	outstanding = 0;
+	return true;
+}
+
+void io_ring::close()
+{
+	if (sq_ring != NULL) munmap(sq_ring, sq_ring_size);
+	if (cq_ring != NULL) munmap(cq_ring, cq_ring_size);
+	if (sqes != NULL) munmap(sqes, sqes_size);
+	if (ring_fd >= 0) ::close(ring_fd);
+	sq_ring = cq_ring = sqes = NULL;
+	ring_fd = -1;
+	prepared = 0;
+	outstanding = 0;
+}
+
+void *io_ring::prepare(uint8_t opcode, int fd, uint64_t address, unsigned int size, uint64_t offset, uint64_t user)
+{
+	if (ring_fd < 0)
+		return NULL;
+
+	// only this thread moves the tail; the kernel moves the head
+	unsigned int tail = *sq_tail + prepared;
+	unsigned int head = __atomic_load_n(sq_head, __ATOMIC_ACQUIRE);
+	if (tail - head > *sq_mask)
+		return NULL;
+
+	unsigned int index = tail & *sq_mask;
+	io_uring_sqe *sqe = (io_uring_sqe *)sqes + index;
+	memset(sqe, 0, sizeof(*sqe));
+	sqe->opcode = opcode;
+	sqe->fd = fd;
+	sqe->addr = address;
+	sqe->len = size;
+	sqe->off = offset;
+	sqe->user_data = user;
+	sq_array[index] = index;
+	prepared++;
+	outstanding++;
+	return sqe;
+}
+
+bool io_ring::prepare_read(int fd, void *buffer, unsigned int size, uint64_t offset, uint64_t user)
+{
+	return prepare(IORING_OP_READ, fd, (uint64_t)(uintptr_t)buffer, size, offset, user) != NULL;
+}
+
+bool io_ring::prepare_write(int fd, const void *buffer, unsigned int size, uint64_t offset, uint64_t user)
+{
+	return prepare(IORING_OP_WRITE, fd, (uint64_t)(uintptr_t)buffer, size, offset, user) != NULL;
+}
+
+bool io_ring::prepare_openat(const char *path, int flags, int mode, uint64_t user)
+{
+	io_uring_sqe *sqe = (io_uring_sqe *)prepare(IORING_OP_OPENAT, AT_FDCWD, (uint64_t)(uintptr_t)path, (unsigned int)mode, 0, user);
+	if (sqe == NULL)
+		return false;
+	sqe->open_flags = (uint32_t)flags;
+	return true;
+}
+
+bool io_ring::prepare_close(int fd, uint64_t user)
+{
+	return prepare(IORING_OP_CLOSE, fd, 0, 0, 0, user) != NULL;
+}
+
+bool io_ring::submit(unsigned int wait_for)
+{
+	if (ring_fd < 0)
+		return false;
+
+	unsigned int count = prepared;
+	__atomic_store_n(sq_tail, *sq_tail + prepared, __ATOMIC_RELEASE);
+	prepared = 0;
+
+	while (count > 0 || wait_for > 0) {
+		int done = (int)syscall(__NR_io_uring_enter, ring_fd, count, wait_for, wait_for > 0 ? IORING_ENTER_GETEVENTS : 0, NULL, 0);
+		if (done < 0) {
+			if (errno == EINTR)
+				continue;
+			return false;
+		}
+		count -= (unsigned int)done;
+		if (wait_for > 0 && __atomic_load_n(cq_tail, __ATOMIC_ACQUIRE) - *cq_head >= wait_for)
+			wait_for = 0;
+	}
+	return true;
+}
+
+bool io_ring::next_completion(uint64_t *user, int *result)
+{
+	if (ring_fd < 0)
+		return false;
+
+	unsigned int head = *cq_head;
+	if (head == __atomic_load_n(cq_tail, __ATOMIC_ACQUIRE))
+		return false;
+
+	const io_uring_cqe *cqe = (const io_uring_cqe *)cqes + (head & *cq_mask);
+	*user = cqe->user_data;
+	*result = cqe->res;
+	__atomic_store_n(cq_head, head + 1, __ATOMIC_RELEASE);
+	outstanding--;
+	return true;
+}
+
+#else
+
+bool io_ring::open(unsigned int entries) { return false; }
+void io_ring::close() {}
+bool io_ring::prepare_read(int fd, void *buffer, unsigned int size, uint64_t offset, uint64_t user) { return false; }
+bool io_ring::prepare_write(int fd, const void *buffer, unsigned int size, uint64_t offset, uint64_t user) { return false; }
+bool io_ring::prepare_openat(const char *path, int flags, int mode, uint64_t user) { return false; }
+bool io_ring::prepare_close(int fd, uint64_t user) { return false; }
+bool io_ring::submit(unsigned int wait_for) { return false; }
+bool io_ring::next_completion(uint64_t *user, int *result) { return false; }
+
+#endif
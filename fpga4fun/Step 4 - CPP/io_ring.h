@@ -0,0 +1,61 @@
+#pragma once
+
+// Minimal io_uring wrapper, straight on the system calls (no liburing).
+// Operations are queued with the prepare_ functions, handed to the kernel
+// with submit(), and their results collected with next_completion(), each
+// tagged with the caller's user value.
+// open() fails where io_uring is missing (other systems, old kernels, or
+// blocked by seccomp); callers then fall back to plain system calls.
+
+#include <stddef.h>
+#include <stdint.h>
+
+class io_ring
+{
+public:
+	io_ring();
+	~io_ring();
+
+	bool open(unsigned int entries);
+	void close();
+	bool is_open() const { return ring_fd >= 0; }
+
+	// false when the submission queue is full: submit() first
+	bool prepare_read(int fd, void *buffer, unsigned int size, uint64_t offset, uint64_t user);
+	bool prepare_write(int fd, const void *buffer, unsigned int size, uint64_t offset, uint64_t user);
+	bool prepare_openat(const char *path, int flags, int mode, uint64_t user);
+	bool prepare_close(int fd, uint64_t user);
+
+	// Submit everything prepared and wait until at least wait_for
+	// completions are available; false on error
+	bool submit(unsigned int wait_for = 0);
+	// Take one completion; false if none is ready. result is what the
+	// system call would return, or -errno.
+	bool next_completion(uint64_t *user, int *result);
+
+	// Operations submitted or prepared and not collected yet
+	unsigned int in_flight() const { return outstanding; }
+
+private:
+	void *prepare(uint8_t opcode, int fd, uint64_t address, unsigned int size, uint64_t offset, uint64_t user);
+
+	int ring_fd;
+	void *sq_ring;
+	size_t sq_ring_size;
+	void *cq_ring;
+	size_t cq_ring_size;
+	void *sqes;
+	size_t sqes_size;
+
+	unsigned int *sq_head;
+	unsigned int *sq_tail;
+	unsigned int *sq_mask;
+	unsigned int *sq_array;
+	unsigned int *cq_head;
+	unsigned int *cq_tail;
+	unsigned int *cq_mask;
+	void *cqes;
+
+	unsigned int prepared;		// queued since the last submit()
+	unsigned int outstanding;
+};
@@ -0,0 +1,158 @@
+#include <thread>
+#include <atomic>
+#include <vector>
+
+#include "parallel_decoder.h"
+#include "pci_capture.h"
+
+// Smallest chunk worth handing to a thread
+#define PARALLEL_MIN_CHUNK (64*1024)
+// Chunks per thread, so that threads finishing early can pick up more work
+#define PARALLEL_CHUNKS_PER_THREAD 8
+
+struct parallel_item
+{
+	size_t begin;	// sync point
+	size_t end;	// next sync point, decoded only to finish the transaction ending there
+	std::vector<pci_transaction> transactions;
+};
+
+static void collect_transaction(const pci_transaction &transaction, void *context)
+{
+	static_cast<std::vector<pci_transaction> *>(context)->push_back(transaction);
+}
+
+// First sync point at or after from, or size if there is none
+static size_t find_sync_point(const uint16_t *ctrl, size_t size, size_t from)
+{
+	for (size_t s = from > 0 ? from : 1; s < size; s++) {
+		if ((ctrl[s - 1] & PCI_CTRL_FRAMEn) && (ctrl[s] & PCI_CTRL_IRDYn))
+			return s;
+	}
+	return size;
+}
+
+// Last sync point, or 0 if there is none
+static size_t find_last_sync_point(const uint16_t *ctrl, size_t size)
+{
+	for (size_t s = size - 1; s > 0; s--) {
+		if ((ctrl[s - 1] & PCI_CTRL_FRAMEn) && (ctrl[s] & PCI_CTRL_IRDYn))
+			return s;
+	}
+	return 0;
+}
+
+void run_workers(unsigned int threads, size_t items, void (*work)(size_t item, void *context), void *context)
+{
+	std::atomic<size_t> next(0);
+	std::vector<std::thread> pool;
+
+	struct worker
+	{
+		static void run(std::atomic<size_t> *next, size_t items, void (*work)(size_t, void *), void *context)
+		{
+			for (size_t item; (item = (*next)++) < items; )
+				work(item, context);
+		}
+	};
+
+	for (unsigned int t = 1; t < threads && t < items; t++)
+		pool.push_back(std::thread(worker::run, &next, items, work, context));
+	worker::run(&next, items, work, context);
+	for (size_t t = 0; t < pool.size(); t++)
+		pool[t].join();
+}
+
+struct parallel_job
+{
+	const pci_capture *capture;
+	uint64_t first;
+	uint16_t prev_ctrl;
+	std::vector<size_t> splits;
+	std::vector<parallel_item> items;
+};
+
+static void find_sync_work(size_t item, void *context)
+{
+	parallel_job *job = static_cast<parallel_job *>(context);
+	if (item > 0)
+		job->splits[item] = find_sync_point(job->capture->control_column(), job->capture->size(), job->splits[item]);
+}
+
+static void decode_work(size_t item, void *context)
+{
+	parallel_job *job = static_cast<parallel_job *>(context);
+	parallel_item &it = job->items[item];
+	const pci_capture &capture = *job->capture;
+	bool final_item = (it.end == capture.size());
+
+	transaction_decoder decoder(collect_transaction, &it.transactions);
+	decoder.reset(job->first + it.begin, it.begin > 0 ? capture.control(it.begin - 1) : job->prev_ctrl);
+	decoder.push(capture, it.begin, (final_item ? it.end : it.end + 1) - it.begin);
+
+	// anything still open at the next sync point belongs to the next item
+	if (final_item)
+		decoder.flush();
+}
+
+size_t decode_transactions_parallel(const pci_capture &capture, uint64_t first, uint16_t prev_ctrl,
+	bool last, unsigned int threads, transaction_callback callback, void *context)
+{
+	size_t size = capture.size();
+	if (size == 0)
+		return 0;
+	if (threads == 0)
+		threads = 1;
+
+	parallel_job job;
+	job.capture = &capture;
+	job.first = first;
+	job.prev_ctrl = prev_ctrl;
+
+	// split evenly, then move each split forward to a sync point
+	size_t chunks = threads * PARALLEL_CHUNKS_PER_THREAD;
+	if (chunks > size / PARALLEL_MIN_CHUNK)
+		chunks = size / PARALLEL_MIN_CHUNK;
+	if (chunks == 0)
+		chunks = 1;
+	job.splits.resize(chunks);
+	for (size_t k = 0; k < chunks; k++)
+		job.splits[k] = (size_t)((uint64_t)size * k / chunks);
+	run_workers(threads, chunks, find_sync_work, &job);
+
+	// splits that found the same sync point (or none) merge
+	std::vector<size_t> sync;
+	for (size_t k = 0; k < chunks; k++) {
+		if (job.splits[k] < size && (sync.empty() || job.splits[k] != sync.back()))
+			sync.push_back(job.splits[k]);
+	}
+
+	// when more samples are coming, the part after the last sync point waits for them
+	size_t done = size;
+	if (!last) {
+		done = find_last_sync_point(capture.control_column(), size);
+		if (done > sync.back())
+			sync.push_back(done);
+	}
+
+	for (size_t k = 0; k + 1 < sync.size(); k++) {
+		parallel_item it;
+		it.begin = sync[k];
+		it.end = sync[k + 1];
+		job.items.push_back(it);
+	}
+	if (last) {
+		parallel_item it;
+		it.begin = sync.back();
+		it.end = size;
+		job.items.push_back(it);
+	}
+	run_workers(threads, job.items.size(), decode_work, &job);
+
+	for (size_t k = 0; k < job.items.size(); k++) {
+		const std::vector<pci_transaction> &transactions = job.items[k].transactions;
+		for (size_t t = 0; t < transactions.size(); t++)
+			callback(transactions[t], context);
+	}
+	return done;
+}
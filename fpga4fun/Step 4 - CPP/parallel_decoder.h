@@ -0,0 +1,37 @@
+#pragma once
+
+// Multi-threaded transaction decoding.
+// The samples are split into chunks that are decoded on worker threads.
+// Each chunk starts at a sync point, the first cycle at or after the split
+// where the bus is seen going idle (FRAMEn deasserted on the previous cycle
+// and IRDYn deasserted on this one). The serial decoder's state is known
+// there whatever came before, so a transaction straddling a split is decoded
+// whole by the chunk it started in, and the output is exactly that of a
+// single transaction_decoder, in the same order.
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "transaction_decoder.h"
+
+class pci_capture;
+
+// Decode all samples of capture on up to threads threads, calling callback
+// (on the calling thread) for every transaction.
+// Sample 0 is numbered first, and is decoded from an idle bus with prev_ctrl
+// as the control word of the cycle before it: PCI_CTRL_UNKNOWN at the start of
+// a capture, or the control word before a sync point returned earlier.
+//
+// When last is false, decoding stops at the last sync point, whose index is
+// returned; the samples from there on have to be decoded again by the next
+// call, along with the samples that follow them. Returns 0 when there is no
+// sync point yet. When last is true, everything is decoded and a transaction
+// still in progress is flushed as incomplete; capture.size() is returned.
+size_t decode_transactions_parallel(const pci_capture &capture, uint64_t first, uint16_t prev_ctrl,
+	bool last, unsigned int threads, transaction_callback callback, void *context);
+
+
+// Run work(item, context) for items 0..items-1 on up to threads threads,
+// the calling thread included. Items are handed out in order as threads
+// become free.
+void run_workers(unsigned int threads, size_t items, void (*work)(size_t item, void *context), void *context);
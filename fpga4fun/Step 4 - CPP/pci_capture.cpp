@@ -0,0 +1,72 @@
+#include "pci_capture.h"
+#include "record_decoder.h"
+#include "sample_predicate.h"
+
+void pci_capture::reserve(size_t count)
+{
+	ad.reserve(count);
+	cbe.reserve(count);
+	ctrl.reserve(count);
+}
+
+void pci_capture::clear()
+{
+	ad.clear();
+	cbe.clear();
+	ctrl.clear();
+}
+
+void pci_capture::erase_front(size_t count)
+{
+	ad.erase(ad.begin(), ad.begin() + count);
+	cbe.erase(cbe.begin(), cbe.begin() + count);
+	ctrl.erase(ctrl.begin(), ctrl.begin() + count);
+}
+
+void pci_capture::push_back(uint32_t AD, uint8_t CBE, uint16_t control)
+{
+	ad.push_back(AD);
+	cbe.push_back(CBE);
+	ctrl.push_back(control);
+}
+
+size_t pci_capture::append_records(const unsigned char *records, size_t count)
+{
+	if (count == 0)
+		return 0;
+
+	size_t first = ad.size();
+	ad.resize(first + count);
+	cbe.resize(first + count);
+	ctrl.resize(first + count);
+
+	return decode_records(records, count, &ad[first], &cbe[first], &ctrl[first]);
+}
+
+pci_frame pci_capture::frame(size_t i) const
+{
+	pci_frame frame_cap;
+	frame_cap.AD = ad[i];
+	frame_cap.CBE = cbe[i];
+	frame_cap.FRAMEn = FRAMEn(i);
+	frame_cap.IRDYn = IRDYn(i);
+	frame_cap.TRDYn = TRDYn(i);
+	frame_cap.DEVSELn = DEVSELn(i);
+	frame_cap.IDSEL = IDSEL(i);
+	frame_cap.PAR = PAR(i);
+	frame_cap.GNTn = GNTn(i);
+	frame_cap.LOCKn = LOCKn(i);
+	frame_cap.PERRn = PERRn(i);
+	frame_cap.REQn = REQn(i);
+	frame_cap.SERRn = SERRn(i);
+	frame_cap.STOPn = STOPn(i);
+	return frame_cap;
+}
+
+void pci_capture::find_falling_edges(uint16_t signal, std::vector<size_t> *found) const
+{
+	// from the second sample on, the first has no sample before it
+	if (ctrl.size() < 2)
+		return;
+	find_samples(falls(signal), sample_columns(&ad[1], &cbe[1], &ctrl[1], ctrl[0]), ctrl.size() - 1, (size_t)1, found);
+}
@@ -0,0 +1,84 @@
+#pragma once
+
+// Column store for captured PCI samples.
+// AD, CBE and the 12 control lines live in separate contiguous arrays, so a
+// scan over one signal only touches that signal's column (2 bytes per sample
+// for the control lines instead of a whole pci_frame).
+
+#include <stddef.h>
+#include <stdint.h>
+#include <vector>
+
+#include "analyze_dump.h"
+
+// Bits of the packed control word, as PCI_LogicAnalyzer.v stores them in the
+// first two bytes of each record (CBE, in the top nibble, is kept separately)
+#define PCI_CTRL_STOPn		0x0001
+#define PCI_CTRL_SERRn		0x0002
+#define PCI_CTRL_REQn		0x0004
+#define PCI_CTRL_PERRn		0x0008
+#define PCI_CTRL_LOCKn		0x0010
+#define PCI_CTRL_GNTn		0x0020
+#define PCI_CTRL_PAR		0x0040
+#define PCI_CTRL_IDSEL		0x0080
+#define PCI_CTRL_DEVSELn	0x0100
+#define PCI_CTRL_FRAMEn		0x0200
+#define PCI_CTRL_TRDYn		0x0400
+#define PCI_CTRL_IRDYn		0x0800
+#define PCI_CTRL_MASK		0x0FFF
+
+// Control word when the bus is idle (every active-low line deasserted)
+#define PCI_CTRL_IDLE		0x0F3F
+// Taken for the cycle before the first sample of a capture, or after a gap,
+// when the transactions are decoded: FRAMEn as if already asserted, so a
+// capture that starts in the middle of a transaction does not make its
+// first sample an address phase
+#define PCI_CTRL_UNKNOWN	(PCI_CTRL_IDLE & ~PCI_CTRL_FRAMEn)
+
+class pci_capture
+{
+public:
+	size_t size() const { return ad.size(); }
+	void reserve(size_t count);
+	void clear();
+	// Drop the first count samples
+	void erase_front(size_t count);
+
+	void push_back(uint32_t AD, uint8_t CBE, uint16_t control);
+	// Decode raw 8-byte USB records and append them.
+	// Returns the number of records with bad framing bytes.
+	size_t append_records(const unsigned char *records, size_t count);
+
+	uint32_t AD(size_t i) const { return ad[i]; }
+	uint8_t CBE(size_t i) const { return cbe[i]; }
+	uint16_t control(size_t i) const { return ctrl[i]; }
+
+	bool FRAMEn(size_t i) const { return (ctrl[i] & PCI_CTRL_FRAMEn) != 0; }
+	bool IRDYn(size_t i) const { return (ctrl[i] & PCI_CTRL_IRDYn) != 0; }
+	bool TRDYn(size_t i) const { return (ctrl[i] & PCI_CTRL_TRDYn) != 0; }
+	bool DEVSELn(size_t i) const { return (ctrl[i] & PCI_CTRL_DEVSELn) != 0; }
+	bool IDSEL(size_t i) const { return (ctrl[i] & PCI_CTRL_IDSEL) != 0; }
+	bool PAR(size_t i) const { return (ctrl[i] & PCI_CTRL_PAR) != 0; }
+	bool GNTn(size_t i) const { return (ctrl[i] & PCI_CTRL_GNTn) != 0; }
+	bool LOCKn(size_t i) const { return (ctrl[i] & PCI_CTRL_LOCKn) != 0; }
+	bool PERRn(size_t i) const { return (ctrl[i] & PCI_CTRL_PERRn) != 0; }
+	bool REQn(size_t i) const { return (ctrl[i] & PCI_CTRL_REQn) != 0; }
+	bool SERRn(size_t i) const { return (ctrl[i] & PCI_CTRL_SERRn) != 0; }
+	bool STOPn(size_t i) const { return (ctrl[i] & PCI_CTRL_STOPn) != 0; }
+
+	// Rebuild the old one-struct-per-sample view, e.g. for dump_pci_frame()
+	pci_frame frame(size_t i) const;
+
+	// Append to *found the index of every sample where an active-low signal
+	// (one of the PCI_CTRL_ bits) gets asserted, i.e. goes from 1 to 0
+	void find_falling_edges(uint16_t signal, std::vector<size_t> *found) const;
+
+	const uint32_t *ad_column() const { return ad.empty() ? NULL : &ad[0]; }
+	const uint8_t *cbe_column() const { return cbe.empty() ? NULL : &cbe[0]; }
+	const uint16_t *control_column() const { return ctrl.empty() ? NULL : &ctrl[0]; }
+
+private:
+	std::vector<uint32_t> ad;
+	std::vector<uint8_t> cbe;
+	std::vector<uint16_t> ctrl;
+};
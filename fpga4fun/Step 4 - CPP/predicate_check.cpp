@@ -0,0 +1,158 @@
+// Check of the predicates of sample_predicate.h against the trigger
+// expressions of soft_trigger.h, which are compiled at run time from the same
+// terms: on a capture, each predicate below must match the same samples as
+// its expression, count_samples() must count them, and sequence<> must find
+// the same samples as a plain loop over the hits of its two expressions.
+//
+//   predicate_check <capture>
+//
+// The capture is a .pciacq, or a stream capture (.pcistr or RAM_LA dump),
+// expanded first.
+
+#include <stdio.h>
+#include <string.h>
+#include <string>
+#include <vector>
+
+#include "capture_file.h"
+#include "capture_stream.h"
+#include "pci_capture.h"
+#include "sample_predicate.h"
+#include "soft_trigger.h"
+
+#define SEQUENCE_WITHIN 16
+// not a multiple of PREDICATE_BLOCK, so sequence<> carries its state
+// across the kernels' blocks and across calls
+#define SEQUENCE_FEED 1000
+
+static bool load_capture(const char *filename, pci_capture *samples)
+{
+	if (is_stream_capture(filename)) {
+		stream_capture stream;
+		if (!stream.open(filename)) {
+			fprintf(stderr, "Could not open %s\n", filename);
+			return false;
+		}
+		stream.read(0, (size_t)stream.samples(), samples);
+		return true;
+	}
+	capture_file capture;
+	if (!capture.open(filename)) {
+		fprintf(stderr, "Could not open %s\n", filename);
+		return false;
+	}
+	const unsigned char *records;
+	size_t count, bad = 0;
+	while ((count = capture.next(&records)) > 0)
+		bad += samples->append_records(records, count);
+	if (capture.failed()) {
+		fprintf(stderr, "Could not read %s\n", filename);
+		return false;
+	}
+	if (bad > 0)
+		printf("%u records with bad framing, decoded as they are\n", (unsigned int)bad);
+	return true;
+}
+
+static bool compile(const char *text, trigger_expression *expression)
+{
+	std::string error;
+	if (expression->compile(text, &error))
+		return true;
+	printf("Bad expression %s: %s\n", text, error.c_str());
+	return false;
+}
+
+// The predicate must match the samples the expression does
+template <class P>
+static bool check_predicate(const predicate<P> &p, const char *text, const sample_columns &s, size_t count)
+{
+	trigger_expression expression;
+	if (!compile(text, &expression))
+		return false;
+	std::vector<uint8_t> hit(count), expected(count);
+	match_samples(p, s, count, &hit[0]);
+	expression.evaluate(s, count, &expected[0]);
+
+	size_t hits = 0;
+	for (size_t i = 0; i < count; i++)
+		hits += expected[i];
+	size_t counted = count_samples(p, s, count);
+	printf("%s\n  %u hits, %u counted\n", text, (unsigned int)hits, (unsigned int)counted);
+	for (size_t i = 0; i < count; i++)
+		if (hit[i] != expected[i]) {
+			printf("  sample %u: predicate %u, expression %u\n", (unsigned int)i, hit[i], expected[i]);
+			return false;
+		}
+	return counted == hits;
+}
+
+// sequence<> must find the then samples at most within after a first one
+template <class A, class B>
+static bool check_sequence(const predicate<A> &first, const char *first_text, const predicate<B> &then,
+	const char *then_text, const sample_columns &s, size_t count)
+{
+	trigger_expression first_expression, then_expression;
+	if (!compile(first_text, &first_expression) || !compile(then_text, &then_expression))
+		return false;
+	std::vector<uint8_t> hit_first(count), hit_then(count);
+	first_expression.evaluate(s, count, &hit_first[0]);
+	then_expression.evaluate(s, count, &hit_then[0]);
+	std::vector<uint64_t> expected;
+	bool seen = false;
+	uint64_t last = 0;
+	for (size_t i = 0; i < count; i++) {
+		if (hit_then[i] && seen && i - last <= SEQUENCE_WITHIN)
+			expected.push_back(i);
+		if (hit_first[i]) {
+			seen = true;
+			last = i;
+		}
+	}
+
+	sequence<A, B> search(first, then, SEQUENCE_WITHIN);
+	std::vector<uint64_t> found;
+	for (size_t b = 0; b < count; b += SEQUENCE_FEED) {
+		size_t n = count - b < SEQUENCE_FEED ? count - b : SEQUENCE_FEED;
+		sample_columns block(s.ad + b, s.cbe + b, s.ctrl + b, b == 0 ? s.previous : s.ctrl[b - 1]);
+		search.find(block, n, b, &found);
+	}
+	printf("%s, then within %u: %s\n  %u found, %u expected\n", first_text, SEQUENCE_WITHIN, then_text,
+		(unsigned int)found.size(), (unsigned int)expected.size());
+	return found == expected;
+}
+
+int main(int argc, char **argv)
+{
+	if (argc != 2) {
+		fprintf(stderr, "usage: predicate_check <capture>\n");
+		return 2;
+	}
+	pci_capture samples;
+	if (!load_capture(argv[1], &samples))
+		return 1;
+	size_t count = samples.size();
+	printf("%u samples\n", (unsigned int)count);
+	if (count == 0)
+		return 1;
+	sample_columns s(samples.ad_column(), samples.cbe_column(), samples.control_column());
+
+	bool ok = true;
+	ok &= check_predicate(falls(PCI_CTRL_FRAMEn) & command(PCI_CMD_MEMWRITE),
+		"FRAMEn falls && CBE==MemWrite", s, count);
+	ok &= check_predicate(falls(PCI_CTRL_FRAMEn) & commands((1u << PCI_CMD_IORD) | (1u << PCI_CMD_IOWR)) &
+		AD_in(0x200, 0x23F),
+		"FRAMEn falls && CBE==IORead && AD in [0x200,0x23F] || FRAMEn falls && CBE==IOWrite && AD in [0x200,0x23F]",
+		s, count);
+	ok &= check_predicate(low(PCI_CTRL_IRDYn | PCI_CTRL_TRDYn), "IRDYn==0 && TRDYn==0", s, count);
+	ok &= check_predicate(rises(PCI_CTRL_FRAMEn) | falls(PCI_CTRL_DEVSELn), "FRAMEn rises || DEVSELn falls", s, count);
+	ok &= check_predicate(AD_mask(0xFFFF0000, 0xFEB00000) & high(PCI_CTRL_STOPn),
+		"AD & 0xFFFF0000 == 0xFEB00000 && STOPn==1", s, count);
+	ok &= check_predicate((!low(PCI_CTRL_FRAMEn)) & (!command(PCI_CMD_CFGREAD)), "FRAMEn!=0 && CBE!=ConfigRead", s, count);
+	ok &= check_sequence(falls(PCI_CTRL_FRAMEn) & command(PCI_CMD_MEMWRITE), "FRAMEn falls && CBE==MemWrite",
+		falls(PCI_CTRL_TRDYn), "TRDYn falls", s, count);
+	ok &= check_sequence(falls(PCI_CTRL_FRAMEn), "FRAMEn falls", falls(PCI_CTRL_FRAMEn), "FRAMEn falls", s, count);
+
+	printf(ok ? "OK\n" : "FAILED\n");
+	return ok ? 0 : 1;
+}
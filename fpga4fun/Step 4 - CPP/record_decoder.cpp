@@ -0,0 +1,175 @@
+#include <mutex>
+
+#include "record_decoder.h"
+#include "capture_file.h"
+#include "pci_capture.h"
+#include "cpu_features.h"
+
+// Framing bytes 0x01 0x02, as the top 16 bits of a little-endian record
+#define RECORD_FRAMING 0x0201
+
+size_t decode_records_scalar(const unsigned char *records, size_t count, uint32_t *ad, uint8_t *cbe, uint16_t *ctrl)
+{
+	size_t bad = 0;
+	for (size_t n = 0; n < count; n++) {
+		//3fff 80f0 4408 0102
+		const unsigned char *block = records + n * PCI_RECORD_SIZE;
+		ad[n] = ((uint32_t)block[5] << 24) | ((uint32_t)block[4] << 16) | ((uint32_t)block[3] << 8) | block[2];
+		cbe[n] = block[1] >> 4;
+		ctrl[n] = ((block[1] & 0x0F) << 8) | block[0];
+		bad += (block[6] != 0x01) | (block[7] != 0x02);
+	}
+	return bad;
+}
+
+#ifdef CPU_X86
+
+// 8 records per iteration, 2 per 128-bit load.
+// For each record, the low dword holds the control bits and CBE, AD sits
+// 16 bits up, and the framing bytes are the top half of the high dword.
+TARGET_SSE2 size_t decode_records_sse2(const unsigned char *records, size_t count, uint32_t *ad, uint8_t *cbe, uint16_t *ctrl)
+{
+	const __m128i ctrl_mask = _mm_set1_epi32(PCI_CTRL_MASK);
+	const __m128i cbe_mask = _mm_set1_epi32(0xF);
+	const __m128i framing = _mm_set1_epi32(RECORD_FRAMING);
+	__m128i good = _mm_setzero_si128();	// per-lane count of good records (compares give -1)
+	size_t n = 0;
+
+	for (; n + 8 <= count; n += 8) {
+		const __m128i *p = (const __m128i *)(records + n * PCI_RECORD_SIZE);
+		__m128i r01 = _mm_loadu_si128(p);
+		__m128i r23 = _mm_loadu_si128(p + 1);
+		__m128i r45 = _mm_loadu_si128(p + 2);
+		__m128i r67 = _mm_loadu_si128(p + 3);
+
+		// low and high dwords of records 0-3 and 4-7
+		__m128i lo03 = _mm_unpacklo_epi64(_mm_shuffle_epi32(r01, _MM_SHUFFLE(2,0,2,0)), _mm_shuffle_epi32(r23, _MM_SHUFFLE(2,0,2,0)));
+		__m128i lo47 = _mm_unpacklo_epi64(_mm_shuffle_epi32(r45, _MM_SHUFFLE(2,0,2,0)), _mm_shuffle_epi32(r67, _MM_SHUFFLE(2,0,2,0)));
+		__m128i hi03 = _mm_unpacklo_epi64(_mm_shuffle_epi32(r01, _MM_SHUFFLE(3,1,3,1)), _mm_shuffle_epi32(r23, _MM_SHUFFLE(3,1,3,1)));
+		__m128i hi47 = _mm_unpacklo_epi64(_mm_shuffle_epi32(r45, _MM_SHUFFLE(3,1,3,1)), _mm_shuffle_epi32(r67, _MM_SHUFFLE(3,1,3,1)));
+
+		// AD = low 16 bits of the high dword : top 16 bits of the low dword
+		__m128i ad03 = _mm_or_si128(_mm_srli_epi32(lo03, 16), _mm_slli_epi32(hi03, 16));
+		__m128i ad47 = _mm_or_si128(_mm_srli_epi32(lo47, 16), _mm_slli_epi32(hi47, 16));
+		_mm_storeu_si128((__m128i *)(ad + n), ad03);
+		_mm_storeu_si128((__m128i *)(ad + n + 4), ad47);
+
+		// values fit in 12 bits, so the signed saturating pack is exact
+		__m128i c = _mm_packs_epi32(_mm_and_si128(lo03, ctrl_mask), _mm_and_si128(lo47, ctrl_mask));
+		_mm_storeu_si128((__m128i *)(ctrl + n), c);
+
+		__m128i b = _mm_packs_epi32(_mm_and_si128(_mm_srli_epi32(lo03, 12), cbe_mask), _mm_and_si128(_mm_srli_epi32(lo47, 12), cbe_mask));
+		_mm_storel_epi64((__m128i *)(cbe + n), _mm_packus_epi16(b, b));
+
+		__m128i ok03 = _mm_cmpeq_epi32(_mm_srli_epi32(hi03, 16), framing);
+		__m128i ok47 = _mm_cmpeq_epi32(_mm_srli_epi32(hi47, 16), framing);
+		good = _mm_sub_epi32(good, _mm_add_epi32(ok03, ok47));
+	}
+
+	uint32_t lanes[4];
+	_mm_storeu_si128((__m128i *)lanes, good);
+	size_t bad = n - ((size_t)lanes[0] + lanes[1] + lanes[2] + lanes[3]);
+	return bad + decode_records_scalar(records + n * PCI_RECORD_SIZE, count - n, ad + n, cbe + n, ctrl + n);
+}
+
+// 8 records per iteration, 4 per 256-bit load. Same layout as the SSE2
+// version; shuffles work within 128-bit lanes, so the dwords are put back
+// in record order with a cross-lane permute.
+TARGET_AVX2 size_t decode_records_avx2(const unsigned char *records, size_t count, uint32_t *ad, uint8_t *cbe, uint16_t *ctrl)
+{
+	const __m256i ctrl_mask = _mm256_set1_epi32(PCI_CTRL_MASK);
+	const __m256i cbe_mask = _mm256_set1_epi32(0xF);
+	const __m256i framing = _mm256_set1_epi32(RECORD_FRAMING);
+	__m256i good = _mm256_setzero_si256();
+	size_t n = 0;
+
+	for (; n + 8 <= count; n += 8) {
+		const __m256i *p = (const __m256i *)(records + n * PCI_RECORD_SIZE);
+		__m256i r03 = _mm256_loadu_si256(p);
+		__m256i r47 = _mm256_loadu_si256(p + 1);
+
+		// lane 0: records 0 1 4 5, lane 1: records 2 3 6 7, then reorder
+		__m256i lo = _mm256_unpacklo_epi64(_mm256_shuffle_epi32(r03, _MM_SHUFFLE(2,0,2,0)), _mm256_shuffle_epi32(r47, _MM_SHUFFLE(2,0,2,0)));
+		__m256i hi = _mm256_unpacklo_epi64(_mm256_shuffle_epi32(r03, _MM_SHUFFLE(3,1,3,1)), _mm256_shuffle_epi32(r47, _MM_SHUFFLE(3,1,3,1)));
+		lo = _mm256_permute4x64_epi64(lo, _MM_SHUFFLE(3,1,2,0));
+		hi = _mm256_permute4x64_epi64(hi, _MM_SHUFFLE(3,1,2,0));
+
+		__m256i a = _mm256_or_si256(_mm256_srli_epi32(lo, 16), _mm256_slli_epi32(hi, 16));
+		_mm256_storeu_si256((__m256i *)(ad + n), a);
+
+		__m256i c = _mm256_and_si256(lo, ctrl_mask);
+		_mm_storeu_si128((__m128i *)(ctrl + n), _mm_packs_epi32(_mm256_castsi256_si128(c), _mm256_extracti128_si256(c, 1)));
+
+		__m256i b = _mm256_and_si256(_mm256_srli_epi32(lo, 12), cbe_mask);
+		__m128i b16 = _mm_packs_epi32(_mm256_castsi256_si128(b), _mm256_extracti128_si256(b, 1));
+		_mm_storel_epi64((__m128i *)(cbe + n), _mm_packus_epi16(b16, b16));
+
+		__m256i ok = _mm256_cmpeq_epi32(_mm256_srli_epi32(hi, 16), framing);
+		good = _mm256_sub_epi32(good, ok);
+	}
+
+	uint32_t lanes[8];
+	_mm256_storeu_si256((__m256i *)lanes, good);
+	size_t bad = n;
+	for (int i = 0; i < 8; i++)
+		bad -= lanes[i];
+	return bad + decode_records_scalar(records + n * PCI_RECORD_SIZE, count - n, ad + n, cbe + n, ctrl + n);
+}
+
+#else
+
+size_t decode_records_sse2(const unsigned char *records, size_t count, uint32_t *ad, uint8_t *cbe, uint16_t *ctrl)
+{
+	return decode_records_scalar(records, count, ad, cbe, ctrl);
+}
+
+size_t decode_records_avx2(const unsigned char *records, size_t count, uint32_t *ad, uint8_t *cbe, uint16_t *ctrl)
+{
+	return decode_records_scalar(records, count, ad, cbe, ctrl);
+}
+
+#endif
+
+typedef size_t (*decode_records_fn)(const unsigned char *, size_t, uint32_t *, uint8_t *, uint16_t *);
+
+struct decoder_choice
+{
+	decode_records_fn decode;
+	const char *isa;
+};
+
+static decoder_choice choice;
+static std::once_flag choice_made;
+
+static void select_decoder()
+{
+	if (cpu_has_avx2()) {
+		choice.isa = "avx2";
+		choice.decode = decode_records_avx2;
+	} else if (cpu_has_sse2()) {
+		choice.isa = "sse2";
+		choice.decode = decode_records_sse2;
+	} else {
+		choice.isa = "scalar";
+		choice.decode = decode_records_scalar;
+	}
+}
+
+// Selected on first use; the decoder threads may get here at the same time.
+// Not a function-local static: those are only initialized thread-safely
+// from Visual C++ 2015 on.
+static const decoder_choice &decoder()
+{
+	std::call_once(choice_made, select_decoder);
+	return choice;
+}
+
+size_t decode_records(const unsigned char *records, size_t count, uint32_t *ad, uint8_t *cbe, uint16_t *ctrl)
+{
+	return decoder().decode(records, count, ad, cbe, ctrl);
+}
+
+const char *decode_records_isa()
+{
+	return decoder().isa;
+}
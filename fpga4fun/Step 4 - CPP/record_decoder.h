@@ -0,0 +1,24 @@
+#pragma once
+
+// Batch decoder for the 8-byte RAM_LA records streamed over USB.
+// Each record is unpacked into the AD / CBE / control columns of a
+// pci_capture, and its 0x01 0x02 framing bytes are checked in the same pass.
+//
+// decode_records() picks the AVX2, SSE2 or scalar version at run time,
+// depending on what the CPU supports.
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Decode count records. Returns the number of records whose last two bytes
+// are not 0x01 0x02 (they are decoded anyway).
+size_t decode_records(const unsigned char *records, size_t count, uint32_t *ad, uint8_t *cbe, uint16_t *ctrl);
+
+// Name of the version decode_records() uses: "avx2", "sse2" or "scalar"
+const char *decode_records_isa();
+
+// The individual versions, for testing and benchmarking.
+// The SIMD ones are only usable when the CPU supports them.
+size_t decode_records_scalar(const unsigned char *records, size_t count, uint32_t *ad, uint8_t *cbe, uint16_t *ctrl);
+size_t decode_records_sse2(const unsigned char *records, size_t count, uint32_t *ad, uint8_t *cbe, uint16_t *ctrl);
+size_t decode_records_avx2(const unsigned char *records, size_t count, uint32_t *ad, uint8_t *cbe, uint16_t *ctrl);
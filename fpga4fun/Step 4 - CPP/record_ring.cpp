@@ -0,0 +1,124 @@
+#include <string.h>
+#include <thread>
+
+#include "record_ring.h"
+#include "capture_file.h"
+
+record_ring::record_ring(size_t capacity)
+	: closed(false), aborted(false)
+{
+	size_t size = 1;
+	while (size < capacity)
+		size <<= 1;
+	mask = size - 1;
+	storage.resize(size);
+
+	writer.head.store(0);
+	writer.cached_tail = 0;
+	writer.high_water.store(0);
+	reader.tail.store(0);
+	reader.cached_head = 0;
+}
+
+size_t record_ring::begin_write(unsigned char **records, size_t wanted)
+{
+	uint64_t head = writer.head.load(std::memory_order_relaxed);
+	if (head - writer.cached_tail + wanted > capacity())
+		writer.cached_tail = reader.tail.load(std::memory_order_acquire);
+
+	size_t free_records = capacity() - (size_t)(head - writer.cached_tail);
+	size_t offset = (size_t)head & mask;
+	size_t count = capacity() - offset;	// up to the end of the ring
+	if (count > free_records)
+		count = free_records;
+	if (count > wanted)
+		count = wanted;
+	*records = (unsigned char *)&storage[offset];
+	return count;
+}
+
+void record_ring::publish(size_t count)
+{
+	uint64_t head = writer.head.load(std::memory_order_relaxed) + count;
+	writer.head.store(head, std::memory_order_release);
+
+	// the cached tail may be far behind, it is only refreshed when the ring
+	// looks full: take the current one, once per batch
+	writer.cached_tail = reader.tail.load(std::memory_order_acquire);
+	size_t used = (size_t)(head - writer.cached_tail);
+	if (used > writer.high_water.load(std::memory_order_relaxed))
+		writer.high_water.store(used, std::memory_order_relaxed);
+}
+
+bool record_ring::push(const unsigned char *records, size_t count)
+{
+	while (count > 0) {
+		unsigned char *space;
+		size_t n = begin_write(&space, count);
+		if (n == 0) {
+			if (aborted.load(std::memory_order_relaxed))
+				return false;
+			std::this_thread::yield();
+			continue;
+		}
+		memcpy(space, records, n * PCI_RECORD_SIZE);
+		publish(n);
+		records += n * PCI_RECORD_SIZE;
+		count -= n;
+	}
+	return true;
+}
+
+void record_ring::close()
+{
+	closed.store(true, std::memory_order_release);
+}
+
+size_t record_ring::begin_read(const unsigned char **records)
+{
+	uint64_t tail = reader.tail.load(std::memory_order_relaxed);
+	if (reader.cached_head == tail)
+		reader.cached_head = writer.head.load(std::memory_order_acquire);
+
+	size_t offset = (size_t)tail & mask;
+	size_t count = capacity() - offset;
+	if (count > reader.cached_head - tail)
+		count = (size_t)(reader.cached_head - tail);
+	*records = (const unsigned char *)&storage[offset];
+	return count;
+}
+
+void record_ring::consume(size_t count)
+{
+	reader.tail.store(reader.tail.load(std::memory_order_relaxed) + count, std::memory_order_release);
+}
+
+bool record_ring::wait_readable()
+{
+	for (;;) {
+		// closed is read first: records published before close() are then seen
+		bool done = closed.load(std::memory_order_acquire);
+		if (writer.head.load(std::memory_order_acquire) != reader.tail.load(std::memory_order_relaxed))
+			return true;
+		if (done)
+			return false;
+		std::this_thread::yield();
+	}
+}
+
+void record_ring::abort()
+{
+	aborted.store(true, std::memory_order_relaxed);
+}
+
+size_t record_ring::occupancy() const
+{
+	uint64_t tail = reader.tail.load(std::memory_order_acquire);
+	uint64_t head = writer.head.load(std::memory_order_acquire);
+	return head > tail ? (size_t)(head - tail) : 0;
+}
+
+bool ring_sink(const unsigned char *buffer, size_t size, void *context)
+{
+	return static_cast<record_ring *>(context)->push(buffer, size / PCI_RECORD_SIZE);
+}
@@ -0,0 +1,77 @@
+#pragma once
+
+// Lock-free single-producer/single-consumer ring of 8-byte USB records,
+// the hand-off between an acquisition thread and a decoding thread in the
+// same process.
+// Writer and reader indexes live on their own cache lines, and each side
+// keeps a cached copy of the other side's index: begin_write() and
+// begin_read() only touch the shared line when the cached one says the ring
+// is full (or empty). publish() reads the reader's index once per batch, for
+// the high-water mark. Records
+// are published and consumed in batches, in place: begin_write() and
+// begin_read() return a contiguous span of the ring, publish() and consume()
+// hand it over. Nothing allocates or locks after construction.
+
+#include <stddef.h>
+#include <stdint.h>
+#include <atomic>
+#include <vector>
+
+#define RECORD_RING_CACHE_LINE 64
+#define RECORD_RING_RECORDS (1024*1024)		// 8MB
+
+class record_ring
+{
+public:
+	// capacity is rounded up to a power of two
+	explicit record_ring(size_t capacity = RECORD_RING_RECORDS);
+
+	// Producer: up to wanted free records, contiguous; returns how many
+	size_t begin_write(unsigned char **records, size_t wanted);
+	void publish(size_t count);
+	// Copy count records in, waiting for space; false if the ring was aborted
+	bool push(const unsigned char *records, size_t count);
+	// No more records will be published
+	void close();
+
+	// Consumer: the published records, contiguous; returns how many
+	size_t begin_read(const unsigned char **records);
+	void consume(size_t count);
+	// Wait until records are published or the ring is closed; false when
+	// it is closed and empty
+	bool wait_readable();
+	// The consumer is giving up; push() stops waiting
+	void abort();
+
+	size_t capacity() const { return mask + 1; }
+	// Records published and not consumed yet; exact on either side, a snapshot elsewhere
+	size_t occupancy() const;
+	// Most records published and not consumed yet, as of each publish()
+	size_t high_water() const { return writer.high_water.load(std::memory_order_relaxed); }
+
+private:
+	struct writer_line
+	{
+		std::atomic<uint64_t> head;	// next record to publish
+		uint64_t cached_tail;
+		std::atomic<size_t> high_water;
+		char padding[RECORD_RING_CACHE_LINE];
+	};
+	struct reader_line
+	{
+		std::atomic<uint64_t> tail;	// next record to consume
+		uint64_t cached_head;
+		char padding[RECORD_RING_CACHE_LINE];
+	};
+
+	char padding_before[RECORD_RING_CACHE_LINE];
+	writer_line writer;
+	reader_line reader;
+	std::atomic<bool> closed;
+	std::atomic<bool> aborted;
+	size_t mask;
+	std::vector<uint64_t> storage;	// 8-byte aligned records
+};
+
+// acquisition_sink pushing buffers into a record_ring (the context)
+bool ring_sink(const unsigned char *buffer, size_t size, void *context);
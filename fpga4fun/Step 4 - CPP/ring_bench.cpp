@@ -0,0 +1,155 @@
+// Throughput of record_ring (record_ring.h), the hand-off between the
+// acquisition and a decoder on another thread.
+//
+//   ring_bench [<batch records> [<ring records>]]
+//   ring_bench -f <capture> [<ring records>]
+//
+// Without -f, a producer thread publishes a count in every record, batch
+// records at a time, and the consumer checks that it reads every one in
+// order: the ring's own cost, with no USB or decoding in the way.
+// With -f, the capture is served by a file_transport at full speed through
+// an acquisition into the ring, and decode_ring() decodes it on the calling
+// thread, as StreamFromDragon -d does with the board.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <chrono>
+#include <thread>
+
+#include "record_ring.h"
+#include "acquisition.h"
+#include "capture_decode.h"
+#include "capture_file.h"
+#include "usb_transport.h"
+
+#define BENCH_RECORDS (256ULL*1024*1024)	// 2GB through the ring
+#define BENCH_BATCH 4096
+
+static double seconds_since(std::chrono::steady_clock::time_point start)
+{
+	return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+struct counter_producer
+{
+	record_ring *ring;
+	size_t batch;
+};
+
+static void produce_counts(counter_producer *p)
+{
+	uint64_t next = 0;
+	while (next < BENCH_RECORDS) {
+		unsigned char *space;
+		size_t wanted = BENCH_RECORDS - next < p->batch ? (size_t)(BENCH_RECORDS - next) : p->batch;
+		size_t n = p->ring->begin_write(&space, wanted);
+		if (n == 0) {
+			std::this_thread::yield();
+			continue;
+		}
+		for (size_t i = 0; i < n; i++, next++)
+			memcpy(space + i * PCI_RECORD_SIZE, &next, sizeof(next));
+		p->ring->publish(n);
+	}
+	p->ring->close();
+}
+
+static int bench_counts(size_t batch, size_t capacity)
+{
+	record_ring ring(capacity);
+	counter_producer producer = { &ring, batch };
+	std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+	std::thread thread(produce_counts, &producer);
+
+	uint64_t expected = 0;
+	bool in_order = true;
+	while (ring.wait_readable()) {
+		const unsigned char *records;
+		size_t n = ring.begin_read(&records);
+		for (size_t i = 0; i < n; i++, expected++) {
+			uint64_t value;
+			memcpy(&value, records + i * PCI_RECORD_SIZE, sizeof(value));
+			in_order &= value == expected;
+		}
+		ring.consume(n);
+	}
+	thread.join();
+	double seconds = seconds_since(start);
+
+	printf("%llu records in batches of %u through %u: %.2f s, %.1f Mrecords/s, %.2f GB/s\n",
+		(unsigned long long)expected, (unsigned int)batch, (unsigned int)ring.capacity(), seconds,
+		expected / seconds / 1e6, expected * PCI_RECORD_SIZE / seconds / 1e9);
+	printf("High water: %u records\n", (unsigned int)ring.high_water());
+	if (!in_order || expected != BENCH_RECORDS) {
+		printf("Records lost or out of order\n");
+		return 1;
+	}
+	return 0;
+}
+
+struct file_producer
+{
+	record_ring *ring;
+	file_transport *transport;
+	acquisition_stats stats;
+	bool ok;
+};
+
+static void produce_file(file_producer *p)
+{
+	acquisition_options options;
+	acquisition stream(options);
+	// the end of the file ends the run as a failed read, so only the sink counts
+	stream.run_async(p->transport, 4, ring_sink, p->ring);
+	p->stats = stream.stats();
+	p->ok = !p->stats.sink_failed;
+	p->ring->close();
+}
+
+static void count_transaction(const pci_transaction &, void *context)
+{
+	(*static_cast<uint64_t *>(context))++;
+}
+
+static int bench_file(const char *filename, size_t capacity)
+{
+	file_transport transport;
+	if (!transport.open(filename, false, 0)) {
+		fprintf(stderr, "Could not open %s\n", filename);
+		return 1;
+	}
+	record_ring ring(capacity);
+	file_producer producer = { &ring, &transport, acquisition_stats(), false };
+	std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+	std::thread thread(produce_file, &producer);
+
+	uint64_t transactions = 0, samples = 0;
+	framing_report framing;
+	decode_ring(&ring, count_transaction, &transactions, &framing, &samples);
+	thread.join();
+	double seconds = seconds_since(start);
+	transport.close();
+
+	printf("%llu bytes, %llu samples, %llu transactions: %.2f s, %.1f MB/s\n",
+		(unsigned long long)producer.stats.bytes_written, (unsigned long long)samples,
+		(unsigned long long)transactions, seconds, producer.stats.bytes_written / seconds / 1e6);
+	printf("High water: %u of %u records, %llu bytes out of frame\n", (unsigned int)ring.high_water(),
+		(unsigned int)ring.capacity(), (unsigned long long)framing.dropped_bytes);
+	return producer.ok ? 0 : 1;
+}
+
+int main(int argc, char **argv)
+{
+	if (argc >= 3 && strcmp(argv[1], "-f") == 0 && argc <= 4)
+		return bench_file(argv[2], argc == 4 ? (size_t)strtoul(argv[3], NULL, 0) : RECORD_RING_RECORDS);
+	if (argc <= 3 && (argc < 2 || argv[1][0] != '-')) {
+		size_t batch = argc >= 2 ? (size_t)strtoul(argv[1], NULL, 0) : BENCH_BATCH;
+		size_t capacity = argc == 3 ? (size_t)strtoul(argv[2], NULL, 0) : RECORD_RING_RECORDS;
+		if (batch > 0 && capacity > 0)
+			return bench_counts(batch, capacity);
+	}
+	fprintf(stderr, "usage: ring_bench [<batch records> [<ring records>]]\n");
+	fprintf(stderr, "       ring_bench -f <capture> [<ring records>]\n");
+	return 2;
+}
@@ -0,0 +1,269 @@
+#pragma once
+
+// Predicates over the AD / CBE / control columns of captured samples.
+// The conditions known when the analyzer is built are written with the terms
+// below, joined with & and |, e.g.
+//   falls(PCI_CTRL_FRAMEn) & command(PCI_CMD_MEMWRITE) & AD_in(0xFEB00000, 0xFEB0FFFF)
+// The type of such an expression spells it out, so match_samples() gets one
+// loop for it with every term inlined: no call and no branch per sample, the
+// terms are 0/1 values combined with bitwise operators, and the compiler can
+// vectorize it.
+// The conditions only known at run time, e.g. typed on the command line, are
+// compiled into a trigger_expression (soft_trigger.h) instead; it is built on
+// the same terms and goes through the same kernels. predicate_check.cpp checks
+// the two against each other on a capture.
+
+#include <stddef.h>
+#include <stdint.h>
+#include <vector>
+
+#include "pci_capture.h"
+
+// PCI commands, the CBE value of the address phase
+#define PCI_CMD_IORD	0x2
+#define PCI_CMD_IOWR	0x3
+#define PCI_CMD_MEMREAD	0x6
+#define PCI_CMD_MEMWRITE	0x7
+#define PCI_CMD_CFGREAD	0xA
+#define PCI_CMD_CFGWRITE	0xB
+
+// count samples; previous is the control word of the sample before the first
+struct sample_columns
+{
+	const uint32_t *ad;
+	const uint8_t *cbe;
+	const uint16_t *ctrl;
+	uint16_t previous;
+
+	sample_columns(const uint32_t *ad, const uint8_t *cbe, const uint16_t *ctrl, uint16_t previous = PCI_CTRL_IDLE)
+		: ad(ad), cbe(cbe), ctrl(ctrl), previous(previous) {}
+};
+
+// Base of every predicate P: P(ad, cbe, ctrl, prev) is 1 for a matching
+// sample, 0 otherwise, prev being the control word of the sample before
+template <class P>
+struct predicate
+{
+	const P &self() const { return static_cast<const P &>(*this); }
+};
+
+// All the lines (PCI_CTRL_* bits) go from 1 to 0
+struct falls_term : predicate<falls_term>
+{
+	uint32_t lines;
+	explicit falls_term(uint32_t lines) : lines(lines) {}
+	uint32_t operator()(uint32_t, uint32_t, uint32_t ctrl, uint32_t prev) const
+	{
+		return (uint32_t)(((prev & ~ctrl) & lines) == lines);
+	}
+};
+
+// All the lines go from 0 to 1
+struct rises_term : predicate<rises_term>
+{
+	uint32_t lines;
+	explicit rises_term(uint32_t lines) : lines(lines) {}
+	uint32_t operator()(uint32_t, uint32_t, uint32_t ctrl, uint32_t prev) const
+	{
+		return (uint32_t)(((~prev & ctrl) & lines) == lines);
+	}
+};
+
+// The lines in mask are at their value
+struct level_term : predicate<level_term>
+{
+	uint32_t mask, value;
+	level_term(uint32_t mask, uint32_t value) : mask(mask), value(value & mask) {}
+	uint32_t operator()(uint32_t, uint32_t, uint32_t ctrl, uint32_t) const
+	{
+		return (uint32_t)(((ctrl ^ value) & mask) == 0);
+	}
+};
+
+// CBE in a set, bit n for CBE n
+struct command_term : predicate<command_term>
+{
+	uint32_t commands;
+	explicit command_term(uint32_t commands) : commands(commands) {}
+	uint32_t operator()(uint32_t, uint32_t cbe, uint32_t, uint32_t) const
+	{
+		return (commands >> (cbe & 0x0F)) & 1;
+	}
+};
+
+// (AD & mask) == value
+struct AD_mask_term : predicate<AD_mask_term>
+{
+	uint32_t mask, value;
+	AD_mask_term(uint32_t mask, uint32_t value) : mask(mask), value(value & mask) {}
+	uint32_t operator()(uint32_t ad, uint32_t, uint32_t, uint32_t) const
+	{
+		return (uint32_t)(((ad ^ value) & mask) == 0);
+	}
+};
+
+// first <= AD <= first + span
+struct AD_range_term : predicate<AD_range_term>
+{
+	uint32_t first, span;
+	AD_range_term(uint32_t first, uint32_t span) : first(first), span(span) {}
+	uint32_t operator()(uint32_t ad, uint32_t, uint32_t, uint32_t) const
+	{
+		return (uint32_t)(ad - first <= span);
+	}
+};
+
+template <class A, class B>
+struct and_term : predicate<and_term<A, B> >
+{
+	A a;
+	B b;
+	and_term(const A &a, const B &b) : a(a), b(b) {}
+	uint32_t operator()(uint32_t ad, uint32_t cbe, uint32_t ctrl, uint32_t prev) const
+	{
+		return a(ad, cbe, ctrl, prev) & b(ad, cbe, ctrl, prev);
+	}
+};
+
+template <class A, class B>
+struct or_term : predicate<or_term<A, B> >
+{
+	A a;
+	B b;
+	or_term(const A &a, const B &b) : a(a), b(b) {}
+	uint32_t operator()(uint32_t ad, uint32_t cbe, uint32_t ctrl, uint32_t prev) const
+	{
+		return a(ad, cbe, ctrl, prev) | b(ad, cbe, ctrl, prev);
+	}
+};
+
+template <class A>
+struct not_term : predicate<not_term<A> >
+{
+	A a;
+	explicit not_term(const A &a) : a(a) {}
+	uint32_t operator()(uint32_t ad, uint32_t cbe, uint32_t ctrl, uint32_t prev) const
+	{
+		return a(ad, cbe, ctrl, prev) ^ 1;
+	}
+};
+
+template <class A, class B>
+and_term<A, B> operator&(const predicate<A> &a, const predicate<B> &b) { return and_term<A, B>(a.self(), b.self()); }
+template <class A, class B>
+or_term<A, B> operator|(const predicate<A> &a, const predicate<B> &b) { return or_term<A, B>(a.self(), b.self()); }
+template <class A>
+not_term<A> operator!(const predicate<A> &a) { return not_term<A>(a.self()); }
+
+inline falls_term falls(uint32_t lines) { return falls_term(lines); }
+inline rises_term rises(uint32_t lines) { return rises_term(lines); }
+// Active-low lines are asserted when low
+inline level_term low(uint32_t lines) { return level_term(lines, 0); }
+inline level_term high(uint32_t lines) { return level_term(lines, lines); }
+inline command_term command(uint8_t cbe) { return command_term(1u << (cbe & 0x0F)); }
+inline command_term commands(uint32_t set) { return command_term(set); }
+inline AD_mask_term AD_mask(uint32_t mask, uint32_t value) { return AD_mask_term(mask, value); }
+inline AD_mask_term AD_equals(uint32_t value) { return AD_mask_term(0xFFFFFFFF, value); }
+inline AD_range_term AD_in(uint32_t first, uint32_t last) { return AD_range_term(first, last - first); }
+
+////////////////////////////////////////////////////////////////////////////////
+// Kernels
+
+#define PREDICATE_BLOCK 4096
+
+// hit[i] = 1 where sample i matches, 0 elsewhere
+template <class P>
+void match_samples(const predicate<P> &p, const sample_columns &s, size_t count, uint8_t *hit)
+{
+	const P &match = p.self();
+	if (count == 0)
+		return;
+	hit[0] = (uint8_t)match(s.ad[0], s.cbe[0], s.ctrl[0], s.previous);
+	for (size_t i = 1; i < count; i++)
+		hit[i] = (uint8_t)match(s.ad[i], s.cbe[i], s.ctrl[i], s.ctrl[i - 1]);
+}
+
+// Same, or-ing into hit
+template <class P>
+void match_samples_or(const predicate<P> &p, const sample_columns &s, size_t count, uint8_t *hit)
+{
+	const P &match = p.self();
+	if (count == 0)
+		return;
+	hit[0] |= (uint8_t)match(s.ad[0], s.cbe[0], s.ctrl[0], s.previous);
+	for (size_t i = 1; i < count; i++)
+		hit[i] |= (uint8_t)match(s.ad[i], s.cbe[i], s.ctrl[i], s.ctrl[i - 1]);
+}
+
+template <class P>
+size_t count_samples(const predicate<P> &p, const sample_columns &s, size_t count)
+{
+	const P &match = p.self();
+	if (count == 0)
+		return 0;
+	size_t n = match(s.ad[0], s.cbe[0], s.ctrl[0], s.previous);
+	// 32-bit sums, as wide as the terms, so the loop vectorizes
+	for (size_t b = 1; b < count; b += PREDICATE_BLOCK) {
+		size_t end = count - b < PREDICATE_BLOCK ? count : b + PREDICATE_BLOCK;
+		uint32_t part = 0;
+		for (size_t i = b; i < end; i++)
+			part += match(s.ad[i], s.cbe[i], s.ctrl[i], s.ctrl[i - 1]);
+		n += part;
+	}
+	return n;
+}
+
+// Append first + i to *found for every matching sample i. M is a predicate,
+// or anything match_samples() takes, such as a trigger_expression.
+template <class M, class T>
+void find_samples(const M &m, const sample_columns &s, size_t count, T first, std::vector<T> *found)
+{
+	uint8_t hit[PREDICATE_BLOCK];
+	for (size_t b = 0; b < count; b += PREDICATE_BLOCK) {
+		size_t n = count - b < PREDICATE_BLOCK ? count - b : PREDICATE_BLOCK;
+		sample_columns block(s.ad + b, s.cbe + b, s.ctrl + b, b == 0 ? s.previous : s.ctrl[b - 1]);
+		match_samples(m, block, n, hit);
+		for (size_t i = 0; i < n; i++)
+			if (hit[i])
+				found->push_back(first + (T)(b + i));
+	}
+}
+
+// A sample matching then, at most within samples after one matching first
+// (a later one, not the same). Fed a block at a time; the last sample that
+// matched first is carried from block to block.
+template <class A, class B>
+class sequence
+{
+public:
+	sequence(const predicate<A> &first, const predicate<B> &then, uint64_t within)
+		: first(first.self()), then(then.self()), within(within), seen(false), last(0) {}
+
+	// Samples [base, base + count)
+	void find(const sample_columns &s, size_t count, uint64_t base, std::vector<uint64_t> *found)
+	{
+		uint8_t hit_first[PREDICATE_BLOCK], hit_then[PREDICATE_BLOCK];
+		for (size_t b = 0; b < count; b += PREDICATE_BLOCK) {
+			size_t n = count - b < PREDICATE_BLOCK ? count - b : PREDICATE_BLOCK;
+			sample_columns block(s.ad + b, s.cbe + b, s.ctrl + b, b == 0 ? s.previous : s.ctrl[b - 1]);
+			match_samples(first, block, n, hit_first);
+			match_samples(then, block, n, hit_then);
+			for (size_t i = 0; i < n; i++) {
+				uint64_t at = base + b + i;
+				if (hit_then[i] && seen && at - last <= within)
+					found->push_back(at);
+				if (hit_first[i]) {
+					seen = true;
+					last = at;
+				}
+			}
+		}
+	}
+
+private:
+	A first;
+	B then;
+	uint64_t within;
+	bool seen;
+	uint64_t last;
+};
@@ -0,0 +1,251 @@
+// Host-side check of the PCI_LogicAnalyzer.v simulation (see sim/Makefile in
+// Step 2a): decodes what the testbench read from the USB port with the same
+// code as a real capture, and compares the samples with the reference the
+// testbench wrote, one .pciacq record per clock the capture logic sampled.
+//
+//   sim_check stream <usb bytes> <reference.pciacq> <overflows>
+//   sim_check ram <RAM_LA dump> <reference.pciacq> <trigger.txt> [-rle]
+//   sim_check compare <RLE_CAPTURE dump> <trigger.txt> <dump> <trigger.txt>
+//
+// stream: a board built with STREAM_CAPTURE. The runs, expanded by
+// stream_capture, must give the reference clock for clock, except for the
+// clocks lost in the overflows, which the status records must account for
+// exactly: a wrong count shifts every sample after it. Only the run held at
+// the end of the simulation may be missing.
+// ram: a RAM_LA dump, expanded by stream_capture, must match the reference
+// from its first clock to its last, lined up on the trigger. trigger.txt
+// holds the trigger entry, as word 14 reports it, and the reference clock of
+// the trigger. With -rle, the dump must also hold a run saturated at 4096
+// clocks, and a trigger that cut the run before it in two.
+// compare: the RAM_LA dumps of the same stimulus with and without
+// RLE_CAPTURE must have triggered on the same clock, and agree on every
+// clock of the shorter one.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <algorithm>
+
+#include "capture_file.h"
+#include "capture_stream.h"
+#include "pci_capture.h"
+
+static int usage()
+{
+	fprintf(stderr, "usage: sim_check stream <usb bytes> <reference.pciacq> <overflows>\n");
+	fprintf(stderr, "       sim_check ram <RAM_LA dump> <reference.pciacq> <trigger.txt> [-rle]\n");
+	fprintf(stderr, "       sim_check compare <RLE_CAPTURE dump> <trigger.txt> <dump> <trigger.txt>\n");
+	return 2;
+}
+
+static bool load_reference(const char *filename, pci_capture *reference)
+{
+	capture_file capture;
+	if (!capture.open(filename)) {
+		fprintf(stderr, "Could not open %s\n", filename);
+		return false;
+	}
+	const unsigned char *records;
+	size_t count, bad = 0;
+	while ((count = capture.next(&records)) > 0)
+		bad += reference->append_records(records, count);
+	if (capture.failed() || bad > 0 || capture.tail_bytes() > 0) {
+		fprintf(stderr, "%s is not a clean .pciacq capture\n", filename);
+		return false;
+	}
+	return true;
+}
+
+static bool same_sample(const pci_capture &a, size_t i, const pci_capture &b, size_t j)
+{
+	return a.AD(i) == b.AD(j) && a.CBE(i) == b.CBE(j) && a.control(i) == b.control(j);
+}
+
+static void print_sample(const char *name, const pci_capture &c, size_t i)
+{
+	printf("  %-10s AD %08X CBE %X control %03X\n", name, c.AD(i), c.CBE(i), c.control(i));
+}
+
+// Compare count samples of got from got_first with those of expected from
+// expected_first; samples of got in a gap are not compared
+static bool compare_samples(const pci_capture &got, size_t got_first, const pci_capture &expected,
+	size_t expected_first, size_t count, const std::vector<stream_gap> &gaps, const char *expected_name = "reference")
+{
+	size_t g = 0;
+	for (size_t i = 0; i < count; i++) {
+		uint64_t sample = got_first + i;
+		while (g < gaps.size() && gaps[g].sample + gaps[g].lost <= sample)
+			g++;
+		if (g < gaps.size() && gaps[g].sample <= sample)
+			continue;
+		if (!same_sample(got, got_first + i, expected, expected_first + i)) {
+			printf("Sample %llu differs from %s sample %llu\n", (unsigned long long)(got_first + i),
+				expected_name, (unsigned long long)(expected_first + i));
+			print_sample("decoded", got, got_first + i);
+			print_sample(expected_name, expected, expected_first + i);
+			return false;
+		}
+	}
+	return true;
+}
+
+static int check_stream(const char *usb_filename, const char *reference_filename, unsigned int overflows)
+{
+	pci_capture reference;
+	if (!load_reference(reference_filename, &reference))
+		return 1;
+
+	stream_capture capture;
+	if (!capture.open(usb_filename)) {
+		fprintf(stderr, "%s is not a stream capture\n", usb_filename);
+		return 1;
+	}
+	const stream_report &report = capture.report();
+	printf("Reference: %llu clocks\n", (unsigned long long)reference.size());
+	printf("Stream: %llu records, %llu empty, %llu samples, %llu lost cycles in %u overflows\n",
+		(unsigned long long)report.records, (unsigned long long)report.empty_records,
+		(unsigned long long)capture.samples(), (unsigned long long)report.lost_cycles,
+		(unsigned int)report.overflows);
+
+	bool ok = true;
+	if (report.dropped_bytes > 0) {
+		printf("%llu bytes were not records\n", (unsigned long long)report.dropped_bytes);
+		ok = false;
+	}
+	if (report.overflows != overflows || report.gaps.size() != overflows) {
+		printf("Expected %u overflows, the board counted %u and sent %u status records with a gap\n",
+			overflows, (unsigned int)report.overflows, (unsigned int)report.gaps.size());
+		ok = false;
+	}
+	if (capture.samples() > reference.size() || reference.size() - capture.samples() > STREAM_MAX_REPEAT + 1) {
+		printf("The stream covers %llu clocks of the %llu sampled\n", (unsigned long long)capture.samples(),
+			(unsigned long long)reference.size());
+		ok = false;
+	}
+	if (!ok)
+		return 1;
+
+	pci_capture samples;
+	capture.read(0, (size_t)capture.samples(), &samples);
+	if (!compare_samples(samples, 0, reference, 0, samples.size(), report.gaps))
+		return 1;
+	printf("OK\n");
+	return 0;
+}
+
+// A RAM_LA dump with its trigger.txt
+struct ram_dump
+{
+	stream_capture capture;
+	unsigned int trigger_entry;
+	uint64_t trigger_clock;		// in the reference
+	uint64_t trigger_sample;	// in the dump
+};
+
+static bool load_ram_dump(const char *filename, const char *trigger_filename, ram_dump *dump)
+{
+	FILE *F = fopen(trigger_filename, "r");
+	if (F == NULL) {
+		fprintf(stderr, "Could not open %s\n", trigger_filename);
+		return false;
+	}
+	unsigned long long clock;
+	int fields = fscanf(F, "%u %llu", &dump->trigger_entry, &clock);
+	fclose(F);
+	if (fields != 2) {
+		fprintf(stderr, "%s does not hold a trigger entry and clock\n", trigger_filename);
+		return false;
+	}
+	dump->trigger_clock = clock;
+
+	if (!dump->capture.open(filename)) {
+		fprintf(stderr, "%s is not a RAM_LA dump\n", filename);
+		return false;
+	}
+	const stream_report &report = dump->capture.report();
+	printf("%s: %u entries, %llu samples, trigger entry %u at clock %llu\n", filename,
+		(unsigned int)dump->capture.runs(), (unsigned long long)dump->capture.samples(),
+		dump->trigger_entry, clock);
+	// the entries must follow each other: no gap between timed records,
+	// and no status record
+	if (dump->capture.runs() != 256 || report.records != 256 || !report.gaps.empty() || report.dropped_bytes > 0) {
+		printf("%s is not 256 entries on consecutive clocks\n", filename);
+		return false;
+	}
+	if (dump->trigger_entry >= 256) {
+		printf("No trigger entry\n");
+		return false;
+	}
+	dump->trigger_sample = dump->capture.first_sample(dump->trigger_entry);
+	return true;
+}
+
+static int check_ram(const char *dump_filename, const char *reference_filename, const char *trigger_filename, bool rle)
+{
+	pci_capture reference;
+	ram_dump dump;
+	if (!load_reference(reference_filename, &reference) || !load_ram_dump(dump_filename, trigger_filename, &dump))
+		return 1;
+
+	const stream_capture &capture = dump.capture;
+	if (dump.trigger_clock < dump.trigger_sample ||
+		dump.trigger_clock - dump.trigger_sample + capture.samples() > reference.size()) {
+		printf("The dump does not fit in the %llu reference clocks\n", (unsigned long long)reference.size());
+		return 1;
+	}
+	pci_capture samples;
+	capture.read(0, (size_t)capture.samples(), &samples);
+	if (!compare_samples(samples, 0, reference, (size_t)(dump.trigger_clock - dump.trigger_sample), samples.size(),
+		std::vector<stream_gap>()))
+		return 1;
+
+	if (rle) {
+		size_t saturated = 0;
+		for (size_t r = 0; r + 1 < capture.runs(); r++)
+			if (capture.first_sample(r + 1) - capture.first_sample(r) == STREAM_MAX_REPEAT + 1)
+				saturated++;
+		size_t t = (size_t)dump.trigger_sample;
+		bool cut = dump.trigger_entry > 0 && same_sample(samples, t - 1, samples, t);
+		printf("Saturated runs: %u, trigger cuts a run: %s\n", (unsigned int)saturated, cut ? "yes" : "no");
+		if (saturated == 0 || !cut)
+			return 1;
+	}
+	printf("OK\n");
+	return 0;
+}
+
+static int compare_ram(const char *rle_filename, const char *rle_trigger_filename,
+	const char *filename, const char *trigger_filename)
+{
+	ram_dump rle, dump;
+	if (!load_ram_dump(rle_filename, rle_trigger_filename, &rle) || !load_ram_dump(filename, trigger_filename, &dump))
+		return 1;
+	if (rle.trigger_clock != dump.trigger_clock) {
+		printf("The captures did not trigger on the same clock\n");
+		return 1;
+	}
+
+	// the window both dumps cover, around the trigger
+	uint64_t before = std::min(rle.trigger_sample, dump.trigger_sample);
+	uint64_t after = std::min(rle.capture.samples() - rle.trigger_sample, dump.capture.samples() - dump.trigger_sample);
+	pci_capture rle_samples, samples;
+	rle.capture.read(rle.trigger_sample - before, (size_t)(before + after), &rle_samples);
+	dump.capture.read(dump.trigger_sample - before, (size_t)(before + after), &samples);
+	printf("Comparing %llu clocks before the trigger and %llu from it\n", (unsigned long long)before,
+		(unsigned long long)after);
+	if (!compare_samples(rle_samples, 0, samples, 0, rle_samples.size(), std::vector<stream_gap>(), filename))
+		return 1;
+	printf("OK\n");
+	return 0;
+}
+
+int main(int argc, char **argv)
+{
+	if (argc == 5 && strcmp(argv[1], "stream") == 0)
+		return check_stream(argv[2], argv[3], (unsigned int)strtoul(argv[4], NULL, 0));
+	if ((argc == 5 || (argc == 6 && strcmp(argv[5], "-rle") == 0)) && strcmp(argv[1], "ram") == 0)
+		return check_ram(argv[2], argv[3], argv[4], argc == 6);
+	if (argc == 6 && strcmp(argv[1], "compare") == 0)
+		return compare_ram(argv[2], argv[3], argv[4], argv[5]);
+	return usage();
+}
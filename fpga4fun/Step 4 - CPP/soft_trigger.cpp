@@ -0,0 +1,530 @@
+#include <ctype.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "soft_trigger.h"
+#include "capture_file.h"
+#include "capture_stream.h"
+#include "pci_capture.h"
+#include "record_decoder.h"
+
+// Control lines by bit of the packed control word
+static const char *const line_names[12] = {
+	"STOPn", "SERRn", "REQn", "PERRn", "LOCKn", "GNTn",
+	"PAR", "IDSEL", "DEVSELn", "FRAMEn", "TRDYn", "IRDYn"
+};
+
+// PCI commands by CBE value
+static const char *const command_names[16] = {
+	"IntAck", "Special", "IORead", "IOWrite", "Reserved4", "Reserved5", "MemRead", "MemWrite",
+	"Reserved8", "Reserved9", "ConfigRead", "ConfigWrite", "MemReadMultiple", "DualAddr", "MemReadLine", "MemWriteInvalidate"
+};
+
+static bool same_name(const std::string &a, const char *b)
+{
+	size_t i = 0;
+	for (; i < a.size() && b[i] != 0; i++)
+		if (tolower((unsigned char)a[i]) != tolower((unsigned char)b[i]))
+			return false;
+	return i == a.size() && b[i] == 0;
+}
+
+static int find_name(const std::string &name, const char *const *names, int count)
+{
+	for (int i = 0; i < count; i++)
+		if (same_name(name, names[i]))
+			return i;
+	return -1;
+}
+
+static bool to_number(const std::string &token, uint32_t *value)
+{
+	if (token.empty() || !isdigit((unsigned char)token[0]))
+		return false;
+	char *end;
+	*value = (uint32_t)strtoul(token.c_str(), &end, 0);
+	return *end == 0;
+}
+
+static bool tokenize(const char *p, std::vector<std::string> *tokens, std::string *error)
+{
+	static const char *const symbols[] = { "&&", "||", "==", "!=", "&", "[", "]", "," };
+	while (*p != 0) {
+		if (isspace((unsigned char)*p)) {
+			p++;
+			continue;
+		}
+		if (isalnum((unsigned char)*p) || *p == '_') {
+			const char *start = p;
+			while (isalnum((unsigned char)*p) || *p == '_')
+				p++;
+			tokens->push_back(std::string(start, p));
+			continue;
+		}
+		size_t s = 0;
+		while (s < sizeof(symbols) / sizeof(symbols[0]) && strncmp(p, symbols[s], strlen(symbols[s])) != 0)
+			s++;
+		if (s == sizeof(symbols) / sizeof(symbols[0])) {
+			*error = std::string("unexpected '") + *p + "'";
+			return false;
+		}
+		tokens->push_back(symbols[s]);
+		p += strlen(symbols[s]);
+	}
+	return true;
+}
+
+// The predicate of an && group; the terms that are not used match anything
+static and_term<and_term<and_term<level_term, falls_term>, and_term<rises_term, command_term> >, and_term<AD_mask_term, AD_range_term> >
+	term_predicate(const trigger_term &t)
+{
+	return (level_term(t.level_mask, t.level_value) & falls_term(t.falls)) &
+		(rises_term(t.rises) & command_term(t.commands)) &
+		(AD_mask_term(t.AD_mask, t.AD_value) & AD_range_term(t.AD_first, t.AD_span));
+}
+
+// A term that matches every sample
+static trigger_term any_sample()
+{
+	trigger_term t = { 0, 0, 0, 0, 0xFFFF, 0, 0, 0, 0xFFFFFFFF };
+	return t;
+}
+
+// The terms that contradict each other are kept, with no command allowed
+static void never(trigger_term *t)
+{
+	t->commands = 0;
+}
+
+static void require_level(trigger_term *t, uint32_t line, bool high)
+{
+	uint32_t value = high ? line : 0;
+	if ((t->level_mask & line) != 0 && (t->level_value & line) != value)
+		never(t);
+	t->level_mask |= line;
+	t->level_value = (t->level_value & ~line) | value;
+}
+
+static void require_AD(trigger_term *t, uint32_t mask, uint32_t value)
+{
+	value &= mask;
+	if (((t->AD_value ^ value) & t->AD_mask & mask) != 0)
+		never(t);
+	t->AD_mask |= mask;
+	t->AD_value |= value;
+}
+
+static void require_range(trigger_term *t, uint32_t first, uint32_t last)
+{
+	uint32_t old_last = t->AD_first + t->AD_span;
+	if (first < t->AD_first)
+		first = t->AD_first;
+	if (last > old_last)
+		last = old_last;
+	if (first > last) {
+		never(t);
+		return;
+	}
+	t->AD_first = first;
+	t->AD_span = last - first;
+}
+
+class expression_parser
+{
+public:
+	expression_parser(const std::vector<std::string> &tokens, std::string *error)
+		: tokens(tokens), at(0), error(error) {}
+
+	bool parse(std::vector<trigger_term> *terms)
+	{
+		do {
+			trigger_term t = any_sample();
+			do {
+				if (!parse_term(&t))
+					return false;
+			} while (accept("&&"));
+			terms->push_back(t);
+		} while (accept("||"));
+		if (at < tokens.size())
+			return fail("unexpected '" + tokens[at] + "'");
+		return true;
+	}
+
+private:
+	bool accept(const char *token)
+	{
+		if (at < tokens.size() && tokens[at] == token) {
+			at++;
+			return true;
+		}
+		return false;
+	}
+
+	bool fail(const std::string &message)
+	{
+		*error = message;
+		return false;
+	}
+
+	bool number(uint32_t *value)
+	{
+		if (at < tokens.size() && to_number(tokens[at], value)) {
+			at++;
+			return true;
+		}
+		return fail(at < tokens.size() ? "expected a number at '" + tokens[at] + "'" : "expected a number");
+	}
+
+	bool parse_term(trigger_term *t)
+	{
+		if (at >= tokens.size())
+			return fail("expected a term");
+		std::string name = tokens[at++];
+		uint32_t value, mask;
+
+		int line = find_name(name, line_names, 12);
+		if (line >= 0) {
+			uint32_t bit = 1u << line;
+			if (accept("falls"))
+				t->falls |= bit;
+			else if (accept("rises"))
+				t->rises |= bit;
+			else if (accept("==") || accept("!=")) {
+				bool equal = tokens[at - 1] == "==";
+				if (!number(&value))
+					return false;
+				if (value > 1)
+					return fail(name + " is 0 or 1");
+				require_level(t, bit, (value == 1) == equal);
+			} else
+				return fail("expected falls, rises, == or != after " + name);
+			return true;
+		}
+
+		if (same_name(name, "CBE")) {
+			if (!accept("==") && !accept("!="))
+				return fail("expected == or != after CBE");
+			bool equal = tokens[at - 1] == "==";
+			if (at >= tokens.size())
+				return fail("expected a command");
+			int command = find_name(tokens[at], command_names, 16);
+			if (command >= 0)
+				at++;
+			else if (number(&value) && value < 16)
+				command = (int)value;
+			else
+				return fail("expected a command name or 0 to 15");
+			uint32_t bit = 1u << command;
+			t->commands &= equal ? bit : ~bit;
+			return true;
+		}
+
+		if (same_name(name, "AD")) {
+			if (accept("==")) {
+				if (!number(&value))
+					return false;
+				require_AD(t, 0xFFFFFFFF, value);
+			} else if (accept("&")) {
+				if (!number(&mask) || !accept("==") || !number(&value))
+					return fail("expected AD & <mask> == <value>");
+				require_AD(t, mask, value);
+			} else if (accept("in")) {
+				uint32_t last;
+				if (!accept("[") || !number(&value) || !accept(",") || !number(&last) || !accept("]"))
+					return fail("expected AD in [<first>,<last>]");
+				require_range(t, value, last);
+			} else
+				return fail("expected ==, & or in after AD");
+			return true;
+		}
+
+		return fail("unknown signal '" + name + "'");
+	}
+
+	const std::vector<std::string> &tokens;
+	size_t at;
+	std::string *error;
+};
+
+bool trigger_expression::compile(const char *expression, std::string *error)
+{
+	std::vector<std::string> tokens;
+	std::vector<trigger_term> terms;
+	if (!tokenize(expression, &tokens, error))
+		return false;
+	expression_parser parser(tokens, error);
+	if (!parser.parse(&terms))
+		return false;
+	term.swap(terms);
+	return true;
+}
+
+void trigger_expression::evaluate(const sample_columns &s, size_t count, uint8_t *hit) const
+{
+	if (term.empty())
+		memset(hit, 0, count);
+
+	// one pass per && group, with the same predicate type for all of them
+	for (size_t t = 0; t < term.size(); t++) {
+		const trigger_term &m = term[t];
+		if (t == 0)
+			match_samples(term_predicate(m), s, count, hit);
+		else
+			match_samples_or(term_predicate(m), s, count, hit);
+	}
+}
+
+soft_trigger::soft_trigger(const trigger_expression &expression, size_t pre, size_t post)
+	: expression(expression), pre(pre), post(post), next(NULL), next_context(NULL),
+	ctrl(1, PCI_CTRL_IDLE), records(NULL), base(0), written(0), keep_end(0), emitted(0),
+	stream(false), clock(0), held_start(0), held_first(0), skipped(0)
+{
+	memset(&counters, 0, sizeof(counters));
+	memset(overflows, 0, sizeof(overflows));
+}
+
+// Pass samples [first, end) on as one-clock sample records, after a skip
+// record for the gap since the last window: those before base are still in
+// history
+void soft_trigger::keep(uint64_t first, uint64_t end)
+{
+	skipped += first - emitted;
+	put_skip();
+	emitted = end;
+	counters.kept += end - first;
+
+	for (uint64_t s = first; s < end; s++) {
+		const unsigned char *r = s < base
+			? &history[0] + history.size() - (size_t)(base - s) * PCI_RECORD_SIZE
+			: records + (size_t)(s - base) * PCI_RECORD_SIZE;
+		unsigned char sample[PCI_RECORD_SIZE] = { r[0], r[1], r[2], r[3], r[4], r[5], 0, STREAM_TAG_SAMPLE << 4 };
+		out.insert(out.end(), sample, sample + PCI_RECORD_SIZE);
+	}
+}
+
+bool soft_trigger::push(const unsigned char *data, size_t size)
+{
+	if (stream)
+		return push_stream(data, size);
+	size_t n = size / PCI_RECORD_SIZE;
+	if (n == 0)
+		return true;
+	ad.resize(n);
+	cbe.resize(n);
+	ctrl.resize(n + 1);
+	hit.resize(n);
+	decode_records(data, n, &ad[0], &cbe[0], &ctrl[1]);
+	expression.evaluate(sample_columns(&ad[0], &cbe[0], &ctrl[1], ctrl[0]), n, &hit[0]);
+	records = data;
+	out.clear();
+
+	for (size_t i = 0; i < n; i++) {
+		// most of the stream does not match: skip 8 samples at a time
+		if ((i & 7) == 0 && i + 8 <= n) {
+			uint64_t none;
+			memcpy(&none, &hit[i], sizeof(none));
+			if (none == 0) {
+				i += 7;
+				continue;
+			}
+		}
+		if (hit[i] == 0)
+			continue;
+
+		uint64_t h = base + i;
+		uint64_t first = h > pre ? h - pre : 0;
+		if (first < written)
+			first = written;
+		if (counters.windows == 0 || first > keep_end) {
+			// a new window: what is left of the last one goes first
+			if (keep_end > written)
+				keep(written, keep_end);
+			written = first;
+			counters.windows++;
+		}
+		if (h + post + 1 > keep_end)
+			keep_end = h + post + 1;
+		counters.hits++;
+	}
+
+	uint64_t end = base + n;
+	uint64_t stop = keep_end < end ? keep_end : end;
+	if (stop > written) {
+		keep(written, stop);
+		written = stop;
+	}
+
+	// the pre-trigger samples of a hit early in the next push
+	size_t keep_bytes = pre * PCI_RECORD_SIZE;
+	if (n * PCI_RECORD_SIZE >= keep_bytes)
+		history.assign(data + n * PCI_RECORD_SIZE - keep_bytes, data + n * PCI_RECORD_SIZE);
+	else {
+		history.insert(history.end(), data, data + n * PCI_RECORD_SIZE);
+		if (history.size() > keep_bytes)
+			history.erase(history.begin(), history.begin() + (history.size() - keep_bytes));
+	}
+	ctrl[0] = ctrl[n];
+	base = end;
+	counters.samples += n;
+	records = NULL;
+	return put_out();
+}
+
+bool soft_trigger::finish()
+{
+	out.clear();
+	if (stream) {
+		drop_held(clock);
+	} else if (base > emitted) {
+		skipped += base - emitted;
+		emitted = base;
+	}
+	put_skip();
+	return put_out();
+}
+
+bool soft_trigger::put_out()
+{
+	if (out.empty() || next == NULL)
+		return true;
+	return next(&out[0], out.size(), next_context);
+}
+
+static bool is_run(const unsigned char *r)
+{
+	return (r[7] & STREAM_TIMED_MASK) == STREAM_TIMED || (r[7] >> 4) == STREAM_TAG_SAMPLE;
+}
+
+static bool is_status(const unsigned char *r)
+{
+	return (r[7] & STREAM_TIMED_MASK) != STREAM_TIMED && (r[7] >> 4) == STREAM_TAG_STATUS;
+}
+
+// A skip record for the clocks dropped since the last record passed on
+void soft_trigger::put_skip()
+{
+	while (skipped > 0) {
+		uint32_t c = skipped > 0xFFFFFFFF ? 0xFFFFFFFF : (uint32_t)skipped;
+		unsigned char skip[PCI_RECORD_SIZE] = {
+			(unsigned char)c, (unsigned char)(c >> 8), (unsigned char)(c >> 16), (unsigned char)(c >> 24),
+			overflows[0], overflows[1], STREAM_STATUS_SKIPPED, STREAM_TAG_STATUS << 4
+		};
+		out.insert(out.end(), skip, skip + PCI_RECORD_SIZE);
+		skipped -= c;
+	}
+}
+
+// Pass a stream record on, after a skip record for what was dropped before it
+void soft_trigger::pass_on(const unsigned char *r, uint32_t clocks)
+{
+	put_skip();
+	out.insert(out.end(), r, r + PCI_RECORD_SIZE);
+	if (is_run(r))
+		counters.kept += clocks;
+	else if (is_status(r)) {
+		overflows[0] = r[4];
+		overflows[1] = r[5];
+	}
+}
+
+// Drop the held records that end at or before clock first
+void soft_trigger::drop_held(uint64_t first)
+{
+	while (held_start < held.size()) {
+		uint32_t clocks = stream_record_clocks(&held[held_start]);
+		if (held_first + clocks > first)
+			break;
+		// the skip record that takes its place has its overflow count
+		if (is_status(&held[held_start])) {
+			overflows[0] = held[held_start + 4];
+			overflows[1] = held[held_start + 5];
+		}
+		held_first += clocks;
+		skipped += clocks;
+		held_start += PCI_RECORD_SIZE;
+	}
+	if (held_start == held.size()) {
+		held.clear();
+		held_start = 0;
+	}
+}
+
+// Hold a stream record back, as long as a hit after it can reach back to it
+void soft_trigger::hold(const unsigned char *r, uint32_t clocks)
+{
+	if (held_start == held.size())
+		held_first = clock;
+	held.insert(held.end(), r, r + PCI_RECORD_SIZE);
+	uint64_t end = clock + clocks;
+	drop_held(end > pre ? end - pre : 0);
+	if (held_start > held.size() / 2) {
+		held.erase(held.begin(), held.begin() + held_start);
+		held_start = 0;
+	}
+}
+
+bool soft_trigger::push_stream(const unsigned char *data, size_t size)
+{
+	size_t n = size / PCI_RECORD_SIZE;
+	// one sample per run: the edges between runs are where they start
+	ad.clear();
+	cbe.clear();
+	ctrl.resize(1);
+	for (size_t i = 0; i < n; i++) {
+		const unsigned char *r = data + i * PCI_RECORD_SIZE;
+		if (!is_run(r))
+			continue;
+		ctrl.push_back((uint16_t)(((r[1] & 0x0F) << 8) | r[0]));
+		cbe.push_back(r[1] >> 4);
+		ad.push_back((uint32_t)r[2] | ((uint32_t)r[3] << 8) | ((uint32_t)r[4] << 16) | ((uint32_t)r[5] << 24));
+	}
+	hit.resize(ad.size());
+	if (!ad.empty())
+		expression.evaluate(sample_columns(&ad[0], &cbe[0], &ctrl[1], ctrl[0]), ad.size(), &hit[0]);
+	out.clear();
+
+	size_t s = 0;
+	for (size_t i = 0; i < n; i++) {
+		const unsigned char *r = data + i * PCI_RECORD_SIZE;
+		uint32_t clocks = stream_record_clocks(r);
+		if (!is_run(r)) {
+			if (!is_status(r))
+				continue;
+			// in order with the samples: an overflow gap is part of the
+			// pre samples of a hit after it
+			if (clock < keep_end)
+				pass_on(r, clocks);
+			else
+				hold(r, clocks);
+			clock += clocks;
+			continue;
+		}
+		if (hit[s++] != 0) {
+			uint64_t first = clock > pre ? clock - pre : 0;
+			if (counters.windows == 0 || first > keep_end)
+				counters.windows++;
+			// what is left of the held records is in the window
+			drop_held(first);
+			for (size_t h = held_start; h < held.size(); h += PCI_RECORD_SIZE)
+				pass_on(&held[h], stream_record_clocks(&held[h]));
+			held.clear();
+			held_start = 0;
+			if (clock + post + 1 > keep_end)
+				keep_end = clock + post + 1;
+			counters.hits++;
+		}
+		if (clock < keep_end)
+			pass_on(r, clocks);
+		else
+			hold(r, clocks);
+		clock += clocks;
+		counters.samples += clocks;
+	}
+	ctrl[0] = ctrl.back();
+	return put_out();
+}
+
+bool soft_trigger_sink(const unsigned char *buffer, size_t size, void *context)
+{
+	return static_cast<soft_trigger *>(context)->push(buffer, size);
+}
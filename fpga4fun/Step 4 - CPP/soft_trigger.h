@@ -0,0 +1,144 @@
+#pragma once
+
+// Software trigger on the acquisition side: the streamed samples are matched
+// against a trigger expression, and only a window of samples around each hit
+// goes on to the sink; everything else is dropped before the disk.
+//
+// Expressions are terms joined by && and ||, && binding tighter:
+//   FRAMEn falls && CBE==MemWrite && AD in [0xFEB00000,0xFEB0FFFF]
+// with the terms
+//   <line> falls, <line> rises	the line changes from the previous sample
+//   <line>==0, <line>==1, <line>!=0, <line>!=1
+//   CBE==<command>, CBE!=<command>	a number or MemWrite, IORead, ...
+//   AD==<value>, AD & <mask> == <value>, AD in [<first>,<last>]
+// where <line> is one of the 12 control lines of the packed control word
+// (FRAMEn, IRDYn, ... see PCI_CTRL_*). Each && group is compiled to a
+// handful of masks (trigger_term), evaluated over the AD, CBE and control
+// columns without a branch per sample by the kernels of sample_predicate.h.
+//
+// The windows are in samples, so the records must be one per clock: .pciacq
+// records, which go out as one-clock sample records of a FIFO stream (see
+// capture_stream.h), so that the gaps between windows can be marked; the
+// caller starts the output with PCISTR_MAGIC.
+// With set_stream(), the records are those of a FIFO stream instead, whole
+// records with the empty ones dropped, as stream_writer hands them on, or
+// the timed RAM_LA records of the default build. A sample record is a run
+// of clocks and is matched once, at its first clock, where its edges are;
+// the windows are still in clocks, and keep every record they overlap.
+// Status records are held back and passed on like samples, so that an
+// overflow does not cut the pre samples of a hit after it.
+// Either way, what is dropped between the windows, and after the last one
+// once finish() is called, is replaced by a status record with the skip
+// flag, so that the .pcistr keeps the clock of every sample.
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+#include "acquisition.h"
+#include "sample_predicate.h"
+
+// One && group: a sample matches when all of these hold
+struct trigger_term
+{
+	uint32_t level_mask;	// control lines compared to level_value
+	uint32_t level_value;
+	uint32_t falls;		// control lines that must go from 1 to 0
+	uint32_t rises;		// and from 0 to 1
+	uint32_t commands;	// bit n set: CBE n matches
+	uint32_t AD_mask;	// (AD ^ AD_value) & AD_mask must be 0
+	uint32_t AD_value;
+	uint32_t AD_first;	// and AD - AD_first <= AD_span
+	uint32_t AD_span;
+};
+
+class trigger_expression
+{
+public:
+	// false with *error set if expression does not parse
+	bool compile(const char *expression, std::string *error);
+
+	const std::vector<trigger_term> &terms() const { return term; }
+
+	// hit[i] = 1 where sample i matches, 0 elsewhere
+	void evaluate(const sample_columns &s, size_t count, uint8_t *hit) const;
+
+private:
+	std::vector<trigger_term> term;
+};
+
+struct soft_trigger_stats
+{
+	uint64_t samples;	// seen
+	uint64_t hits;		// a stream run counts once
+	uint64_t windows;	// hits closer than a window merge into one
+	uint64_t kept;		// samples passed on to the sink
+};
+
+// acquisition_sink filter (soft_trigger_sink, with a soft_trigger as the
+// context): keeps the pre samples before each hit, the hit and the post
+// samples after it, and passes them on to another sink
+class soft_trigger
+{
+public:
+	soft_trigger(const trigger_expression &expression, size_t pre, size_t post);
+
+	void set_sink(acquisition_sink sink, void *context) { next = sink; next_context = context; }
+	// The records are FIFO stream records, not one per clock
+	void set_stream(bool stream_records) { stream = stream_records; }
+
+	// size is a multiple of PCI_RECORD_SIZE
+	bool push(const unsigned char *records, size_t size);
+	// At the end of the capture: mark what was dropped after the last window
+	bool finish();
+	const soft_trigger_stats &stats() const { return counters; }
+
+private:
+	void keep(uint64_t first, uint64_t end);
+	bool push_stream(const unsigned char *records, size_t size);
+	void hold(const unsigned char *record, uint32_t clocks);
+	void drop_held(uint64_t first);
+	void pass_on(const unsigned char *record, uint32_t clocks);
+	void put_skip();
+	bool put_out();
+
+	trigger_expression expression;
+	size_t pre, post;
+	acquisition_sink next;
+	void *next_context;
+
+	// columns of the records being pushed; ctrl[0] is the sample before them
+	std::vector<uint32_t> ad;
+	std::vector<uint8_t> cbe;
+	std::vector<uint16_t> ctrl;
+	std::vector<uint8_t> hit;
+
+	const unsigned char *records;	// being pushed, from sample base on
+	uint64_t base;
+	std::vector<unsigned char> history;	// the last pre records before base
+	uint64_t written;	// samples below it are passed on or dropped
+	uint64_t keep_end;	// samples below it are passed on
+	uint64_t emitted;	// samples below it are in the output, or skipped there
+	std::vector<unsigned char> out;
+	soft_trigger_stats counters;
+
+	// stream records: the clock of the next one; the records held back for
+	// the pre samples of a later hit, from byte held_start on and clock
+	// held_first on; the clocks dropped since the last record passed on
+	bool stream;
+	uint64_t clock;
+	std::vector<unsigned char> held;
+	size_t held_start;
+	uint64_t held_first;
+	uint64_t skipped;
+	unsigned char overflows[2];	// as of the last status record
+};
+
+bool soft_trigger_sink(const unsigned char *buffer, size_t size, void *context);
+
+// The runtime fallback of the predicates of sample_predicate.h
+inline void match_samples(const trigger_expression &e, const sample_columns &s, size_t count, uint8_t *hit)
+{
+	e.evaluate(s, count, hit);
+}
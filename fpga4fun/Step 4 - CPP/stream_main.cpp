@@ -0,0 +1,149 @@
+// Command-line streaming capture for Linux, where ReadFromDragon.cpp (the
+// Windows driver calls) is not built. See Makefile.
+//
+//   StreamFromDragon <output.pciacq> [-b <max bytes>] [-s]
+//	[-t <trigger expression> <pre> <post>] [-d]
+//   StreamFromDragon <output.pciacq> [-T <stage expression> <count>]... [-p <post entries>]
+//
+// -s: the board is built with STREAM_CAPTURE, the output is a .pcistr stream
+// -t: only keep the samples around the hits of the expression (soft_trigger.h);
+//     the output is then a .pcistr stream either way
+// -d: decode the transactions as they are read, through a record_ring, and
+//     count them
+// -T: one stage of the board's trigger sequencer (trigger_sequencer.h), up to
+//     3 in order, passing on its count-th matching clock; an expression of
+//     soft_trigger.h within what compile_trigger_stage() takes
+// -p: the entries of RAM_LA kept from the trigger on, 128 by default
+// With -T or -p, a single capture of RAM_LA is taken around the trigger (any
+// transaction without -T), as a 16KB dump with its trigger entry next to it
+// in a .pcitrg file; as root on Linux, for the board's registers
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <string>
+
+#include "dragon_stream.h"
+#include "acquisition.h"
+#include "capture_stream.h"
+#include "soft_trigger.h"
+#include "trigger_sequencer.h"
+#include "capture_writer.h"
+
+static int usage()
+{
+	fprintf(stderr, "usage: StreamFromDragon <output.pciacq> [-b <max bytes>] [-s] [-t <expression> <pre> <post>] [-d]\n");
+	fprintf(stderr, "       StreamFromDragon <output.pciacq> [-T <expression> <count>]... [-p <post entries>]\n");
+	return 2;
+}
+
+// -T and -p: one capture of RAM_LA around the board's trigger
+static int capture_trigger(const char *output_filename, const trigger_program *program, unsigned int post_entries)
+{
+	acquisition_stats stats;
+	capture_status status;
+	if (!CaptureTriggerFromDragon(output_filename, program, post_entries, &stats, &status)) {
+		fprintf(stderr, "Capturing from the board to %s failed\n", output_filename);
+		return 1;
+	}
+	printf("Trigger entry: %u of %u, in %s\n", status.trigger_entry, (unsigned int)LA_ENTRIES,
+		capture_sequence_filename(output_filename, 0).c_str());
+	return 0;
+}
+
+static void count_transaction(const pci_transaction &, void *context)
+{
+	(*static_cast<uint64_t *>(context))++;
+}
+
+int main(int argc, char **argv)
+{
+	if (argc < 2)
+		return usage();
+	const char *output_filename = argv[1];
+	uint64_t max_bytes = 0;
+	bool fifo = false, decode = false;
+	const char *expression = NULL;
+	size_t pre = 0, post = 0;
+	trigger_program program;
+	program.stages = 0;
+	unsigned int post_entries = LA_ENTRIES / 2;
+	bool board_trigger = false;
+	std::string error;
+	for (int a = 2; a < argc; a++) {
+		if (strcmp(argv[a], "-b") == 0 && a + 1 < argc)
+			max_bytes = strtoull(argv[++a], NULL, 0);
+		else if (strcmp(argv[a], "-s") == 0)
+			fifo = true;
+		else if (strcmp(argv[a], "-d") == 0)
+			decode = true;
+		else if (strcmp(argv[a], "-t") == 0 && a + 3 < argc) {
+			expression = argv[++a];
+			pre = (size_t)strtoul(argv[++a], NULL, 0);
+			post = (size_t)strtoul(argv[++a], NULL, 0);
+		} else if (strcmp(argv[a], "-T") == 0 && a + 2 < argc && program.stages < TRIGGER_STAGES) {
+			const char *stage = argv[++a];
+			unsigned int count = (unsigned int)strtoul(argv[++a], NULL, 0);
+			if (!compile_trigger_stage(stage, count, &program.stage[program.stages], &error)) {
+				fprintf(stderr, "Bad trigger stage: %s\n", error.c_str());
+				return 1;
+			}
+			program.stages++;
+			board_trigger = true;
+		} else if (strcmp(argv[a], "-p") == 0 && a + 1 < argc) {
+			post_entries = (unsigned int)strtoul(argv[++a], NULL, 0);
+			if (post_entries < 1 || post_entries > LA_ENTRIES) {
+				fprintf(stderr, "The post-trigger entries are 1 to %u\n", (unsigned int)LA_ENTRIES);
+				return 1;
+			}
+			board_trigger = true;
+		} else
+			return usage();
+	}
+	// the board's trigger takes a capture of RAM_LA, not a stream
+	if (board_trigger) {
+		if (max_bytes != 0 || fifo || decode || expression != NULL)
+			return usage();
+		return capture_trigger(output_filename, program.stages > 0 ? &program : NULL, post_entries);
+	}
+
+	trigger_expression compiled;
+	if (expression != NULL && !compiled.compile(expression, &error)) {
+		fprintf(stderr, "Bad trigger expression: %s\n", error.c_str());
+		return 1;
+	}
+	soft_trigger trigger(compiled, pre, post);
+	uint64_t transactions = 0;
+	live_decoder live(count_transaction, &transactions);
+
+	acquisition_stats stats;
+	stream_report report;
+	bool ok = StreamFromDragon(output_filename, max_bytes, &stats, fifo ? &report : NULL,
+		expression != NULL ? &trigger : NULL, decode ? &live : NULL);
+
+	printf("Buffers read: %llu, written: %llu, dropped: %llu\n", (unsigned long long)stats.buffers_read,
+		(unsigned long long)stats.buffers_written, (unsigned long long)stats.buffers_dropped);
+	if (stats.transfers_timed > 0)
+		printf("Transfer latency: %llu / %llu / %llu us (min / average / max)\n",
+			(unsigned long long)(stats.latency_min / 1000),
+			(unsigned long long)(stats.latency_total / stats.transfers_timed / 1000),
+			(unsigned long long)(stats.latency_max / 1000));
+	if (stats.short_transfers > 0)
+		printf("Short transfers: %llu\n", (unsigned long long)stats.short_transfers);
+	if (fifo)
+		printf("Samples: %llu, lost cycles: %llu, overflows: %u\n", (unsigned long long)report.samples,
+			(unsigned long long)report.lost_cycles, (unsigned int)report.overflows);
+	if (decode)
+		printf("Decoded: %llu transactions in %llu samples, %llu bytes out of frame, ring high water %u of %u records\n",
+			(unsigned long long)transactions, (unsigned long long)live.samples,
+			(unsigned long long)live.framing.dropped_bytes, (unsigned int)live.ring.high_water(),
+			(unsigned int)live.ring.capacity());
+	if (expression != NULL)
+		printf("Hits: %llu, windows: %llu, samples kept: %llu\n", (unsigned long long)trigger.stats().hits,
+			(unsigned long long)trigger.stats().windows, (unsigned long long)trigger.stats().kept);
+	if (!ok) {
+		fprintf(stderr, "Streaming from the board to %s failed\n", output_filename);
+		return 1;
+	}
+	return 0;
+}
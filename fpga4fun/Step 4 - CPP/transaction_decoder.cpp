@@ -0,0 +1,142 @@
+#include "transaction_decoder.h"
+#include "pci_capture.h"
+
+transaction_decoder::transaction_decoder(transaction_callback callback, void *context)
+	: callback(callback), context(context)
+{
+	current.data.reserve(TRANSACTION_MAX_DATA_PHASES);
+	reset();
+}
+
+void transaction_decoder::reset(uint64_t first, uint16_t prev)
+{
+	sample = first;
+	emitted = 0;
+	prev_ctrl = prev;
+	in_transaction = false;
+	current.data.clear();
+}
+
+void transaction_decoder::push(const pci_capture &capture, size_t first, size_t count)
+{
+	if (count == 0)
+		return;
+	push(capture.ad_column() + first, capture.cbe_column() + first, capture.control_column() + first, count);
+}
+
+void transaction_decoder::push(const uint32_t *ad, const uint8_t *cbe, const uint16_t *ctrl, size_t count)
+{
+	for (size_t i = 0; i < count; i++, sample++) {
+		uint16_t c = ctrl[i];
+		uint16_t prev = prev_ctrl;
+		prev_ctrl = c;
+
+		if (in_transaction) {
+			// once the master has deasserted FRAMEn, the transaction is over
+			// when IRDYn goes high too (FRAMEn may already be low again for
+			// a fast back-to-back transaction)
+			if ((prev & PCI_CTRL_FRAMEn) && (c & PCI_CTRL_IRDYn)) {
+				if (aborted)
+					finish(PCI_TERM_TARGET_ABORT);
+				else if (stopped)
+					finish(current.data_phases > 0 ? PCI_TERM_DISCONNECT : PCI_TERM_RETRY);
+				else if (!claimed)
+					finish(PCI_TERM_MASTER_ABORT);
+				else
+					finish(PCI_TERM_NORMAL);
+			} else {
+				current.end = sample;
+				if ((c & PCI_CTRL_DEVSELn) == 0)
+					claimed = true;
+				if ((c & PCI_CTRL_STOPn) == 0) {
+					stopped = true;
+					if ((c & PCI_CTRL_DEVSELn) && claimed)
+						aborted = true;
+				}
+
+				if ((c & (PCI_CTRL_IRDYn | PCI_CTRL_TRDYn)) == 0) {
+					if (current.data.size() < TRANSACTION_MAX_DATA_PHASES) {
+						pci_data_phase phase = { ad[i], cbe[i] };
+						current.data.push_back(phase);
+					}
+					current.data_phases++;
+				} else {
+					current.wait_states++;
+				}
+				continue;
+			}
+		}
+
+		// address phase: FRAMEn falls
+		if ((c & PCI_CTRL_FRAMEn) == 0 && (prev & PCI_CTRL_FRAMEn) != 0) {
+			in_transaction = true;
+			claimed = false;
+			stopped = false;
+			aborted = false;
+			current.start = sample;
+			current.end = sample;
+			current.address = ad[i];
+			current.command = cbe[i];
+			current.data_phases = 0;
+			current.wait_states = 0;
+			current.data.clear();
+		}
+	}
+}
+
+void transaction_decoder::push_run(uint32_t ad, uint8_t cbe, uint16_t ctrl, uint64_t count)
+{
+	// the first sample can start a transaction and the second can end one;
+	// after that each sample repeats the one before, so nothing starts or ends
+	for (int i = 0; i < 2 && count > 0; i++, count--)
+		push(&ad, &cbe, &ctrl, 1);
+	if (count == 0)
+		return;
+
+	if (in_transaction) {
+		current.end = sample + count - 1;
+		if ((ctrl & (PCI_CTRL_IRDYn | PCI_CTRL_TRDYn)) == 0) {
+			pci_data_phase phase = { ad, cbe };
+			while (current.data.size() < TRANSACTION_MAX_DATA_PHASES && current.data.size() < current.data_phases + count)
+				current.data.push_back(phase);
+			current.data_phases += (uint32_t)count;
+		} else {
+			current.wait_states += (uint32_t)count;
+		}
+	}
+	sample += count;
+}
+
+void transaction_decoder::flush()
+{
+	if (in_transaction)
+		finish(PCI_TERM_INCOMPLETE);
+}
+
+void transaction_decoder::finish(pci_termination termination)
+{
+	in_transaction = false;
+	current.termination = termination;
+	emitted++;
+	callback(current, context);
+}
+
+const char *getTerminationType(pci_termination termination)
+{
+	switch (termination)
+	{
+	case PCI_TERM_NORMAL:
+		return "Normal";
+	case PCI_TERM_DISCONNECT:
+		return "Disconnect";
+	case PCI_TERM_RETRY:
+		return "Retry";
+	case PCI_TERM_TARGET_ABORT:
+		return "Target Abort";
+	case PCI_TERM_MASTER_ABORT:
+		return "Master Abort";
+	case PCI_TERM_INCOMPLETE:
+		return "Incomplete";
+	}
+	return "Unknown";
+}
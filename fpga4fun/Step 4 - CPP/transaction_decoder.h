@@ -0,0 +1,87 @@
+#pragma once
+
+// Push-based PCI transaction decoder.
+// Samples are fed in chunks of any size, and every complete transaction is
+// handed to a callback as soon as the bus goes idle after it. Only the
+// transaction in progress is kept, so memory use does not grow with the
+// length of the capture.
+
+#include <stddef.h>
+#include <stdint.h>
+#include <vector>
+
+#include "pci_capture.h"
+
+// Data phases stored per transaction; longer bursts are still counted
+#define TRANSACTION_MAX_DATA_PHASES 1024
+
+enum pci_termination
+{
+	PCI_TERM_NORMAL,	// master completed the transfer
+	PCI_TERM_DISCONNECT,	// target STOP after some data was transferred
+	PCI_TERM_RETRY,		// target STOP before any data was transferred
+	PCI_TERM_TARGET_ABORT,	// target STOP with DEVSEL deasserted
+	PCI_TERM_MASTER_ABORT,	// no target claimed the transaction
+	PCI_TERM_INCOMPLETE	// capture ended in the middle of the transaction
+};
+
+struct pci_data_phase
+{
+	uint32_t data;
+	uint8_t byte_enables;	// C/BE[3::0], active low
+};
+
+struct pci_transaction
+{
+	uint64_t start;		// sample index of the address phase
+	uint64_t end;		// sample index of the last cycle
+	uint32_t address;
+	uint8_t command;	// C/BE[3::0] during the address phase, see getMessageType()
+	uint32_t data_phases;	// data transfers, including any not stored in data
+	uint32_t wait_states;	// cycles after the address phase without a transfer
+	pci_termination termination;
+	std::vector<pci_data_phase> data;
+};
+
+typedef void (*transaction_callback)(const pci_transaction &transaction, void *context);
+
+class transaction_decoder
+{
+public:
+	transaction_decoder(transaction_callback callback, void *context);
+
+	// Feed the next count samples
+	void push(const uint32_t *ad, const uint8_t *cbe, const uint16_t *ctrl, size_t count);
+	void push(const pci_capture &capture, size_t first, size_t count);
+	// Feed count identical samples, e.g. from a compressed capture, in constant time
+	void push_run(uint32_t ad, uint8_t cbe, uint16_t ctrl, uint64_t count);
+
+	// End of capture: emit the transaction in progress, if any, as incomplete
+	void flush();
+
+	// Start over on an idle bus at sample index first, prev_ctrl being the
+	// control word of the cycle before it; if that is not known, the first
+	// sample does not start a transaction
+	void reset(uint64_t first = 0, uint16_t prev_ctrl = PCI_CTRL_UNKNOWN);
+
+	uint64_t samples() const { return sample; }
+	uint64_t transactions() const { return emitted; }
+
+private:
+	void finish(pci_termination termination);
+
+	transaction_callback callback;
+	void *context;
+
+	uint64_t sample;	// index of the next sample pushed
+	uint64_t emitted;
+	uint16_t prev_ctrl;
+
+	bool in_transaction;
+	bool claimed;		// DEVSELn seen asserted
+	bool stopped;		// STOPn seen asserted
+	bool aborted;		// STOPn asserted with DEVSELn deasserted
+	pci_transaction current;
+};
+
+const char *getTerminationType(pci_termination termination);
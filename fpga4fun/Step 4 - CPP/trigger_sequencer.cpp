@@ -0,0 +1,195 @@
+#include <stdio.h>
+#include <string.h>
+
+#include "trigger_sequencer.h"
+#include "capture_index.h"
+#include "soft_trigger.h"
+
+#ifdef _WIN32
+#include <intrin.h>
+#else
+#include <sys/io.h>
+#endif
+
+bool la_registers::open(uint16_t io_address)
+{
+#ifndef _WIN32
+	if (ioperm(io_address, LA_REGISTERS * sizeof(uint32_t), 1) != 0)
+		return false;
+#endif
+	base = io_address;
+	return true;
+}
+
+void la_registers::write(unsigned int index, uint32_t value)
+{
+	unsigned short port = (unsigned short)(base + index * sizeof(uint32_t));
+#ifdef _WIN32
+	__outdword(port, value);
+#else
+	outl(value, port);
+#endif
+}
+
+uint32_t la_registers::read(unsigned int index)
+{
+	unsigned short port = (unsigned short)(base + index * sizeof(uint32_t));
+#ifdef _WIN32
+	return __indword(port);
+#else
+	return inl(port);
+#endif
+}
+
+void trigger_stage::match_command(uint8_t cbe)
+{
+	commands = (uint16_t)(1 << (cbe & 0x0F));
+	address_phase = true;
+}
+
+void trigger_stage::match_AD(uint32_t value, uint32_t mask)
+{
+	AD_value = value & mask;
+	AD_mask = mask;
+}
+
+void trigger_stage::match_control(uint16_t line, bool asserted)
+{
+	// the control lines are active low, except IDSEL and PAR
+	bool high = (line & (PCI_CTRL_IDSEL | PCI_CTRL_PAR)) ? asserted : !asserted;
+	control_mask |= line;
+	if (high)
+		control_value |= line;
+	else
+		control_value &= ~line;
+}
+
+bool compile_trigger_stage(const char *expression, unsigned int count, trigger_stage *stage, std::string *error)
+{
+	trigger_expression compiled;
+	if (!compiled.compile(expression, error))
+		return false;
+	if (compiled.terms().size() != 1) {
+		*error = "a stage is one && group, without ||";
+		return false;
+	}
+	const trigger_term &t = compiled.terms()[0];
+	if (t.rises != 0 || (t.falls & ~PCI_CTRL_FRAMEn) != 0) {
+		*error = "the only edge a stage matches is FRAMEn falls, the address phase";
+		return false;
+	}
+
+	uint32_t mask = t.AD_mask, value = t.AD_value;
+	uint32_t commands = t.commands;
+	if (t.AD_span != 0xFFFFFFFF) {
+		// [first, first + span] is the AD bits above span
+		uint32_t range_mask = ~t.AD_span;
+		if (((t.AD_span + 1) & t.AD_span) != 0 || (t.AD_first & t.AD_span) != 0) {
+			*error = "a stage matches AD ranges of a power of 2, aligned on their size";
+			return false;
+		}
+		// the terms that contradict each other match no command, as in soft_trigger.cpp
+		if (((value ^ t.AD_first) & mask & range_mask) != 0)
+			commands = 0;
+		value = (value & mask) | (t.AD_first & range_mask & ~mask);
+		mask |= range_mask;
+	}
+
+	trigger_stage s;
+	s.match_AD(value, mask);
+	s.control_mask = (uint16_t)(t.level_mask & PCI_CTRL_MASK);
+	s.control_value = (uint16_t)(t.level_value & PCI_CTRL_MASK);
+	s.commands = (uint16_t)commands;
+	s.address_phase = t.falls != 0;
+	s.count = (uint16_t)(count < 1 ? 1 : count > 0xFFFF ? 0xFFFF : count);
+	*stage = s;
+	return true;
+}
+
+void trigger_program::encode(uint32_t words[TRIGGER_REG_STATUS]) const
+{
+	memset(words, 0, TRIGGER_REG_STATUS * sizeof(uint32_t));
+	unsigned int n = stages < 1 ? 1 : stages > TRIGGER_STAGES ? TRIGGER_STAGES : stages;
+	words[TRIGGER_REG_CONTROL] = TRIGGER_CONTROL_ENABLE | ((n - 1) << 1);
+	for (unsigned int s = 0; s < TRIGGER_STAGES; s++) {
+		const trigger_stage &t = stage[s];
+		uint32_t *w = words + TRIGGER_REG_STAGE + s * TRIGGER_STAGE_WORDS;
+		w[0] = t.AD_value;
+		w[1] = t.AD_mask;
+		w[2] = (t.control_value & PCI_CTRL_MASK) | ((uint32_t)(t.control_mask & PCI_CTRL_MASK) << 16) |
+			(t.address_phase ? TRIGGER_ADDRESS_PHASE : 0);
+		w[3] = t.commands | ((uint32_t)t.count << 16);
+	}
+}
+
+void load_trigger(la_registers *registers, const trigger_program &program)
+{
+	uint32_t words[TRIGGER_REG_STATUS];
+	program.encode(words);
+
+	// the control word last: it arms the sequencer with the stages in place
+	unsigned int end = TRIGGER_REG_STAGE + TRIGGER_STAGES * TRIGGER_STAGE_WORDS;
+	for (unsigned int i = TRIGGER_REG_STAGE; i < end; i++)
+		registers->write(i, words[i]);
+	registers->write(TRIGGER_REG_CONTROL, words[TRIGGER_REG_CONTROL]);
+}
+
+void disable_trigger(la_registers *registers)
+{
+	registers->write(TRIGGER_REG_CONTROL, 0);
+}
+
+trigger_status read_trigger_status(la_registers *registers)
+{
+	uint32_t word = registers->read(TRIGGER_REG_STATUS);
+	trigger_status status;
+	status.armed = (word & TRIGGER_STATUS_ARMED) != 0;
+	status.fired = (word & TRIGGER_STATUS_FIRED) != 0;
+	status.stage = (word >> 16) & 3;
+	status.hits = (uint16_t)(word & TRIGGER_STATUS_HITS);
+	return status;
+}
+
+void set_post_trigger(la_registers *registers, unsigned int entries)
+{
+	if (entries < 1)
+		entries = 1;
+	if (entries > LA_ENTRIES)
+		entries = LA_ENTRIES;
+	registers->write(CAPTURE_REG_POST_TRIGGER, entries);
+}
+
+void set_pre_trigger(la_registers *registers, unsigned int entries)
+{
+	set_post_trigger(registers, entries < LA_ENTRIES ? LA_ENTRIES - entries : 1);
+}
+
+capture_status read_capture_status(la_registers *registers)
+{
+	uint32_t word = registers->read(CAPTURE_REG_STATUS);
+	capture_status status;
+	status.waiting = (word & CAPTURE_STATUS_WAITING) != 0;
+	status.triggered = (word & CAPTURE_STATUS_TRIGGERED) != 0;
+	status.done = (word & CAPTURE_STATUS_DONE) != 0;
+	status.trigger_entry = word & CAPTURE_STATUS_TRIGGER;
+	return status;
+}
+
+bool write_trigger_entry(const char *capture_filename, unsigned int entry)
+{
+	FILE *F = fopen(capture_sidecar_filename(capture_filename, TRIGGER_SIDECAR_EXTENSION).c_str(), "w");
+	if (F == NULL)
+		return false;
+	bool ok = fprintf(F, "%u\n", entry) > 0;
+	return fclose(F) == 0 && ok;
+}
+
+bool read_trigger_entry(const char *capture_filename, unsigned int *entry)
+{
+	FILE *F = fopen(capture_sidecar_filename(capture_filename, TRIGGER_SIDECAR_EXTENSION).c_str(), "r");
+	if (F == NULL)
+		return false;
+	bool ok = fscanf(F, "%u", entry) == 1 && *entry < LA_ENTRIES;
+	fclose(F);
+	return ok;
+}
@@ -0,0 +1,154 @@
+#pragma once
+
+// Programming the trigger of PCI_LogicAnalyzer.v (PCI_TriggerSequencer.v)
+// and the capture around it from the PC the board is plugged into.
+// The design decodes 16 32-bit registers at IO_address (0x200) of the PCI IO
+// space; the sequencer and the capture take their settings from the writes
+// to them:
+//   word 0       control: bit 0 enable, bits 2-1 last stage; writing it arms
+//                the sequence again at stage 0, and the capture
+//   word 1       post-trigger count, 1 to LA_ENTRIES; writing it arms the
+//                capture
+//   words 2-13   TRIGGER_STAGE_WORDS per stage, from TRIGGER_REG_STAGE:
+//     +0  AD value
+//     +1  AD mask, 1 where the AD bit is compared
+//     +2  bits 11-0 control value, 27-16 control mask (PCI_CTRL_* bits),
+//         bit 31 match on the address phase only
+//     +3  bits 15-0 command set, bit n accepts CBE n; 31-16 count
+//   word 14      reads back the capture status (CAPTURE_STATUS_*)
+//   word 15      reads back the sequencer status (TRIGGER_STATUS_*)
+// The stages match one after the other: a stage passes on its count-th
+// matching clock, and the capture triggers when the last one passes. With the
+// sequencer disabled the capture triggers on any transaction, as the original
+// design did.
+// RAM_LA is a circular buffer of LA_ENTRIES: armed, it keeps the entries
+// before the trigger, then takes the post-trigger count and stops. The dump
+// starts with the oldest entry, so the trigger is entry LA_ENTRIES - count.
+// An entry is a clock, or a run of them with RLE_CAPTURE (see
+// stream_record_sample() for its sample index). The trigger entry is kept
+// next to the dump, as a line of text in "<dump>.pcitrg", for the analyzer
+// to line the dump up on the trigger.
+
+#include <stdint.h>
+#include <string>
+
+#include "pci_capture.h"
+
+#define LA_IO_ADDRESS 0x200
+#define LA_REGISTERS 16
+#define LA_ENTRIES 256
+
+#define TRIGGER_STAGES 3
+#define TRIGGER_STAGE_WORDS 4
+#define TRIGGER_REG_CONTROL 0
+#define CAPTURE_REG_POST_TRIGGER 1
+#define TRIGGER_REG_STAGE 2
+#define CAPTURE_REG_STATUS 14
+#define TRIGGER_REG_STATUS 15
+
+#define TRIGGER_CONTROL_ENABLE 0x00000001
+#define TRIGGER_ADDRESS_PHASE 0x80000000
+#define TRIGGER_ANY_COMMAND 0xFFFF
+
+#define TRIGGER_STATUS_HITS 0x0000FFFF
+#define TRIGGER_STATUS_ARMED 0x01000000
+#define TRIGGER_STATUS_FIRED 0x02000000
+
+#define CAPTURE_STATUS_TRIGGER 0x000000FF
+#define CAPTURE_STATUS_WAITING 0x01000000
+#define CAPTURE_STATUS_TRIGGERED 0x02000000
+#define CAPTURE_STATUS_DONE 0x04000000
+
+#define TRIGGER_SIDECAR_EXTENSION ".pcitrg"
+
+// The board's registers, through port IO. The PCI IO space must be open to
+// user programs: GiveIO or UserPort on Windows (see "IO access drivers" in
+// the startup kit), ioperm() and so root on Linux.
+class la_registers
+{
+public:
+	la_registers() : base(0) {}
+
+	bool open(uint16_t io_address = LA_IO_ADDRESS);
+	void close() { base = 0; }
+	bool is_open() const { return base != 0; }
+
+	void write(unsigned int index, uint32_t value);
+	uint32_t read(unsigned int index);
+
+private:
+	uint16_t base;
+};
+
+struct trigger_stage
+{
+	uint32_t AD_value;
+	uint32_t AD_mask;		// 1 where the AD bit is compared
+	uint16_t control_value;		// PCI_CTRL_* bits
+	uint16_t control_mask;
+	uint16_t commands;		// bit n set: CBE n matches
+	bool address_phase;		// only on the first clock of a transaction
+	uint16_t count;			// matching clocks to wait for, 0 counts as 1
+
+	// Matches every clock
+	trigger_stage() : AD_value(0), AD_mask(0), control_value(0), control_mask(0),
+		commands(TRIGGER_ANY_COMMAND), address_phase(false), count(1) {}
+
+	// The address phase of a transaction with command cbe
+	void match_command(uint8_t cbe);
+	// AD bits set in mask equal to those of value
+	void match_AD(uint32_t value, uint32_t mask = 0xFFFFFFFF);
+	// A control line (PCI_CTRL_*) asserted, i.e. low, or deasserted
+	void match_control(uint16_t line, bool asserted);
+};
+
+// A stage from an expression of soft_trigger.h, with the terms the board can
+// match: a single && group of line levels, commands, AD values and masks,
+// AD ranges of a power of 2 aligned on their size, and "FRAMEn falls" for
+// the address phase. False with *error set otherwise.
+bool compile_trigger_stage(const char *expression, unsigned int count, trigger_stage *stage, std::string *error);
+
+struct trigger_program
+{
+	trigger_stage stage[TRIGGER_STAGES];
+	unsigned int stages;		// 1 to TRIGGER_STAGES
+
+	trigger_program() : stages(1) {}
+
+	// The register words 0 to TRIGGER_REG_STATUS - 1 it is loaded as
+	void encode(uint32_t words[TRIGGER_REG_STATUS]) const;
+};
+
+struct trigger_status
+{
+	bool armed;
+	bool fired;
+	unsigned int stage;		// being matched
+	uint16_t hits;			// its matching clocks so far
+};
+
+struct capture_status
+{
+	bool waiting;			// armed, for the trigger
+	bool triggered;			// taking the entries after it
+	bool done;			// RAM_LA holds the capture, it can be read
+	unsigned int trigger_entry;	// in the dump, once done
+};
+
+// Write the stages, then the control word, which arms the sequencer and the capture
+void load_trigger(la_registers *registers, const trigger_program &program);
+// Back to capturing on any transaction; arms the capture
+void disable_trigger(la_registers *registers);
+trigger_status read_trigger_status(la_registers *registers);
+
+// Set the entries kept from the trigger on (1 to LA_ENTRIES), and arm the
+// capture. Set before load_trigger(): the sequencer only starts matching
+// when the entries before the trigger are there.
+void set_post_trigger(la_registers *registers, unsigned int entries);
+// Same, by the entries kept before the trigger (0 to LA_ENTRIES - 1)
+void set_pre_trigger(la_registers *registers, unsigned int entries);
+capture_status read_capture_status(la_registers *registers);
+
+// The .pcitrg file of a dump; false if it cannot be written, or read
+bool write_trigger_entry(const char *capture_filename, unsigned int entry);
+bool read_trigger_entry(const char *capture_filename, unsigned int *entry);
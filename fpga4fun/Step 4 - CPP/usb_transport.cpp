@@ -0,0 +1,123 @@
+#include <chrono>
+
+#include "usb_transport.h"
+
+uint64_t transport_clock()
+{
+	return (uint64_t)std::chrono::duration_cast<std::chrono::nanoseconds>(
+		std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+file_transport::file_transport()
+	: F(NULL), loop(false), transfer_delay_us(0), rate(0), ready(0), closing(false)
+{
+}
+
+file_transport::~file_transport()
+{
+	close();
+}
+
+bool file_transport::open(const char *filename, bool loop_in, unsigned int transfer_delay_us_in)
+{
+	close();
+	F = fopen(filename, "rb");
+	if (F == NULL)
+		return false;
+	loop = loop_in;
+	transfer_delay_us = transfer_delay_us_in;
+	closing = false;
+	ready = 0;
+	service = std::thread(service_thread, this);
+	return true;
+}
+
+void file_transport::close()
+{
+	if (F == NULL)
+		return;
+	{
+		std::lock_guard<std::mutex> guard(lock);
+		closing = true;
+		work.notify_one();
+	}
+	service.join();
+	fclose(F);
+	F = NULL;
+	queued.clear();
+	completed.clear();
+}
+
+void file_transport::service_thread(file_transport *self)
+{
+	std::unique_lock<std::mutex> guard(self->lock);
+	for (;;) {
+		while (self->queued.empty() && !self->closing)
+			self->work.wait(guard);
+		if (self->closing)
+			break;
+		usb_transfer *transfer = self->queued.front();
+		guard.unlock();
+
+		uint64_t start = transport_clock();
+		uint64_t deadline = start + (uint64_t)self->transfer_delay_us * 1000;
+		size_t n = fread(transfer->buffer, 1, transfer->size, self->F);
+		while (n < transfer->size && self->loop && ftell(self->F) > 0) {
+			rewind(self->F);
+			n += fread(transfer->buffer + n, 1, transfer->size - n, self->F);
+		}
+
+		// the data is captured at rate, a slow reader does not get it faster later
+		if (self->rate > 0) {
+			if (self->ready < start)
+				self->ready = start;
+			self->ready += (uint64_t)((double)n * 1e9 / (double)self->rate);
+			if (self->ready > deadline)
+				deadline = self->ready;
+		}
+		uint64_t now = transport_clock();
+		if (now < deadline)
+			std::this_thread::sleep_for(std::chrono::nanoseconds(deadline - now));
+		transfer->transferred = n;
+		transfer->ok = n > 0;
+
+		guard.lock();
+		transfer->completed = transport_clock();
+		self->queued.pop_front();
+		self->completed.push_back(transfer);
+		self->done.notify_one();
+	}
+}
+
+bool file_transport::submit_read(usb_transfer *transfer)
+{
+	if (F == NULL)
+		return false;
+	std::lock_guard<std::mutex> guard(lock);
+	transfer->transferred = 0;
+	transfer->ok = false;
+	transfer->submitted = transport_clock();
+	queued.push_back(transfer);
+	work.notify_one();
+	return true;
+}
+
+usb_transfer *file_transport::wait_completion()
+{
+	std::unique_lock<std::mutex> guard(lock);
+	if (queued.empty() && completed.empty())
+		return NULL;
+	while (completed.empty())
+		done.wait(guard);
+	usb_transfer *transfer = completed.front();
+	completed.pop_front();
+	return transfer;
+}
+
+unsigned int file_transport::outstanding() const
+{
+	std::lock_guard<std::mutex> guard(lock);
+	return (unsigned int)(queued.size() + completed.size());
+}
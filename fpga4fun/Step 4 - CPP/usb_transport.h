@@ -0,0 +1,81 @@
+#pragma once
+
+// Asynchronous bulk-read transport.
+// Reads are submitted with a buffer and completed later, in submission
+// order, through wait_completion(); several can be outstanding at once so
+// the device never waits on a host round-trip. Each transfer records when it
+// was submitted and completed, for latency reporting.
+// dragon_transport (dragon_transport.h) talks to the board; file_transport
+// below stands in for it, serving the contents of a capture file.
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <thread>
+
+struct usb_transfer
+{
+	unsigned char *buffer;
+	size_t size;		// bytes requested
+	size_t transferred;	// bytes read, fewer than size for a short read
+	bool ok;		// false if the read failed, or a file_transport's file ended
+	uint64_t submitted;	// transport_clock() times
+	uint64_t completed;
+	void *user;
+};
+
+class usb_transport
+{
+public:
+	virtual ~usb_transport() {}
+
+	// Queue a read of transfer->size bytes into transfer->buffer
+	virtual bool submit_read(usb_transfer *transfer) = 0;
+	// Wait for the oldest outstanding transfer; NULL when none is outstanding
+	virtual usb_transfer *wait_completion() = 0;
+	virtual unsigned int outstanding() const = 0;
+};
+
+// Monotonic time in nanoseconds
+uint64_t transport_clock();
+
+// Mock device: serves reads from a file (a .pciacq capture) on a service
+// thread, one at a time like the device does, optionally rewinding at the
+// end. Each read takes at least transfer_delay_us, and with a rate set the
+// data comes out no faster than bytes_per_second, like a board capturing at
+// that rate.
+class file_transport : public usb_transport
+{
+public:
+	file_transport();
+	~file_transport();
+
+	bool open(const char *filename, bool loop, unsigned int transfer_delay_us);
+	void close();
+	// 0 for no limit; call before submitting reads
+	void set_rate(uint64_t bytes_per_second) { rate = bytes_per_second; }
+
+	bool submit_read(usb_transfer *transfer);
+	usb_transfer *wait_completion();
+	unsigned int outstanding() const;
+
+private:
+	static void service_thread(file_transport *self);
+
+	FILE *F;
+	bool loop;
+	unsigned int transfer_delay_us;
+	uint64_t rate;
+	uint64_t ready;		// transport_clock() time the data read so far is due
+	std::thread service;
+
+	mutable std::mutex lock;
+	std::condition_variable work;
+	std::condition_variable done;
+	std::deque<usb_transfer *> queued;
+	std::deque<usb_transfer *> completed;
+	bool closing;
+};